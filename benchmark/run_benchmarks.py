@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+"""Strong and weak scaling benchmarks for actor_parallel.
+
+Runs the simulation over a matrix of maps, rank counts and fleet sizes with plain mpirun, collects the tick time,
+ticks per second, simulated minutes per second and startup time of every run into CSV and JSON, works out the
+speedup and parallel efficiency against the smallest rank count and, when a baseline is given, fails if any run's
+tick time has regressed beyond the tolerance.
+
+Ranks 0 to 2 run the pool master, control and roadjunction, and without --elastic every other rank runs a vehicle
+actor for the whole run. The number of vehicle actors is read from the run's output rather than assumed, and the
+speedup and efficiency are measured against it. A run whose vehicle actors changed part way through is counted as
+failed, as it has no one number of vehicle ranks to scale by. Simulated minutes pass with the wall clock (MIN_LENGTH_SECONDS
+each), so the tick time and ticks per second are what measure the simulation's performance.
+"""
+import argparse
+import csv
+import json
+import os
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+import time
+
+RESERVED_RANKS = 3
+FIELDS = ["map", "mode", "ranks", "vehicle_ranks", "vehicles", "repeat", "tick_seconds", "ticks", "ticks_per_second",
+          "sim_minutes", "wall_seconds", "sim_minutes_per_second", "startup_seconds"]
+SUMMARY_FIELDS = ["map", "mode", "ranks", "vehicle_ranks", "vehicles", "tick_seconds", "ticks_per_second",
+                  "sim_minutes_per_second", "startup_seconds", "speedup", "efficiency"]
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", default="./bin/actor_parallel")
+    parser.add_argument("--maps", nargs="+", default=["./problem_size/tiny_problem", "./problem_size/small_problem"])
+    parser.add_argument("--ranks", nargs="+", type=int, default=[4, 6, 8])
+    parser.add_argument("--vehicles", nargs="+", type=int, default=[100, 400],
+                        help="initial vehicles, per vehicle rank in weak mode")
+    parser.add_argument("--mode", choices=["strong", "weak"], default="strong",
+                        help="strong keeps the fleet fixed, weak grows it with the vehicle ranks")
+    parser.add_argument("--max-mins", type=int, default=3, help="simulated minutes per run")
+    parser.add_argument("--seed", type=int, default=1, help="seed of every run, so the runs draw the same vehicles")
+    parser.add_argument("--repeats", type=int, default=1, help="runs of each configuration, the median is used")
+    parser.add_argument("--mpirun", default="mpirun")
+    parser.add_argument("--mpirun-args", default="--oversubscribe", help="extra arguments given to mpirun")
+    parser.add_argument("--timeout", type=int, default=900, help="seconds before a run is abandoned")
+    parser.add_argument("--output-dir", default="./benchmark/results")
+    parser.add_argument("--baseline", help="JSON results to compare against, a missing file is skipped")
+    parser.add_argument("--save-baseline", help="write this run's results here as the new baseline")
+    parser.add_argument("--tolerance", type=float, default=0.2,
+                        help="fractional increase in tick time counted as a regression")
+    return parser.parse_args()
+
+
+def run_once(args, map_file, ranks, vehicles):
+    """Runs the simulation once and returns its measurements, or None if it failed"""
+    command = [args.mpirun] + shlex.split(args.mpirun_args) + ["-n", str(ranks), args.binary, map_file,
+                                                               "--max-mins", str(args.max_mins),
+                                                               "--initial-vehicles", str(vehicles),
+                                                               "--seed", str(args.seed)]
+    start = time.monotonic()
+    try:
+        result = subprocess.run(command, capture_output=True, text=True, timeout=args.timeout)
+    except subprocess.TimeoutExpired:
+        print("  timed out after %d seconds" % args.timeout, file=sys.stderr)
+        return None
+    wall = time.monotonic() - start
+    output = result.stdout
+    tick = re.search(r"^Average time per loop is: ([0-9.]+) seconds", output, re.M)
+    loops = re.search(r"^Total time for (\d+) loops is: ([0-9.]+) seconds", output, re.M)
+    minutes = re.search(r"^Finished after (\d+) mins", output, re.M)
+    startup = re.search(r"^Startup time is: ([0-9.]+) seconds", output, re.M)
+    actors = re.search(r"^Vehicle actors: (\d+) to (\d+)", output, re.M)
+    if result.returncode != 0 or not (tick and loops and minutes and startup and actors):
+        print("  run failed with exit code %d\n%s" % (result.returncode, (result.stdout + result.stderr)[-2000:]),
+              file=sys.stderr)
+        return None
+    if actors.group(1) != actors.group(2):
+        print("  the vehicle actors changed from %s to %s during the run" % actors.groups(), file=sys.stderr)
+        return None
+    # The average is printed to the microsecond, so work it out from the total for small maps
+    loop_time, ticks = float(loops.group(2)), int(loops.group(1))
+    return {
+        "tick_seconds": loop_time / ticks if ticks > 0 else float(tick.group(1)),
+        "ticks": int(loops.group(1)),
+        "ticks_per_second": int(loops.group(1)) / loop_time if loop_time > 0 else 0.0,
+        "sim_minutes": int(minutes.group(1)),
+        "wall_seconds": wall,
+        "sim_minutes_per_second": int(minutes.group(1)) / wall,
+        "startup_seconds": float(startup.group(1)),
+        "vehicle_ranks": int(actors.group(1)),
+    }
+
+
+def summarise(runs):
+    """Takes the median of the repeats of each configuration and adds the speedup and efficiency against the
+    smallest rank count run with the same map, mode and fleet"""
+    groups = {}
+    for run in runs:
+        key = (run["map"], run["mode"], run["ranks"], run["vehicles"])
+        groups.setdefault(key, []).append(run)
+    summary = []
+    for (map_file, mode, ranks, vehicles), repeats in sorted(groups.items()):
+        row = {"map": map_file, "mode": mode, "ranks": ranks, "vehicle_ranks": repeats[0]["vehicle_ranks"],
+               "vehicles": vehicles}
+        for field in ["tick_seconds", "ticks_per_second", "sim_minutes_per_second", "startup_seconds"]:
+            row[field] = statistics.median(r[field] for r in repeats)
+        summary.append(row)
+
+    for row in summary:
+        # In weak mode the fleet grows with the vehicle ranks, so the base is matched on the fleet per vehicle rank
+        per_rank = row["vehicles"] // row["vehicle_ranks"] if row["mode"] == "weak" else row["vehicles"]
+        candidates = [r for r in summary if r["map"] == row["map"] and r["mode"] == row["mode"] and
+                      (r["vehicles"] // r["vehicle_ranks"] if r["mode"] == "weak" else r["vehicles"]) == per_rank]
+        base = min(candidates, key=lambda r: r["ranks"])
+        scale = row["vehicle_ranks"] / base["vehicle_ranks"]
+        ratio = base["tick_seconds"] / row["tick_seconds"] if row["tick_seconds"] > 0 else 0.0
+        if row["mode"] == "strong":
+            row["speedup"] = ratio
+            row["efficiency"] = ratio / scale
+        else:
+            # Weak scaling keeps the work per rank fixed, so the efficiency is the ratio of tick times and the
+            # scaled speedup is how much more work was done in the same time
+            row["efficiency"] = ratio
+            row["speedup"] = ratio * scale
+    return summary
+
+
+def check_regressions(summary, baseline_file, tolerance):
+    """Returns a description of every configuration whose tick time has grown beyond the tolerance"""
+    with open(baseline_file) as f:
+        baseline = json.load(f)
+    previous = {(r["map"], r["mode"], r["ranks"], r["vehicles"]): r for r in baseline["summary"]}
+    regressions = []
+    for row in summary:
+        old = previous.get((row["map"], row["mode"], row["ranks"], row["vehicles"]))
+        if old is None:
+            continue
+        change = row["tick_seconds"] / old["tick_seconds"] - 1 if old["tick_seconds"] > 0 else 0.0
+        status = "REGRESSED" if change > tolerance else "ok"
+        print("%-9s %s %s ranks=%d vehicles=%d tick %.6fs -> %.6fs (%+.1f%%)" % (
+            status, row["map"], row["mode"], row["ranks"], row["vehicles"], old["tick_seconds"],
+            row["tick_seconds"], change * 100))
+        if change > tolerance:
+            regressions.append(row)
+    return regressions
+
+
+def write_results(output_dir, runs, summary, args):
+    os.makedirs(output_dir, exist_ok=True)
+    with open(os.path.join(output_dir, "runs.csv"), "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        writer.writeheader()
+        writer.writerows(runs)
+    with open(os.path.join(output_dir, "summary.csv"), "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=SUMMARY_FIELDS)
+        writer.writeheader()
+        writer.writerows(summary)
+    results = {"max_mins": args.max_mins, "repeats": args.repeats, "runs": runs, "summary": summary}
+    with open(os.path.join(output_dir, "results.json"), "w") as f:
+        json.dump(results, f, indent=2)
+    return results
+
+
+def main():
+    args = parse_args()
+    runs, failed = [], 0
+    for map_file in args.maps:
+        for vehicles in args.vehicles:
+            for ranks in sorted(args.ranks):
+                if ranks <= RESERVED_RANKS:
+                    print("Skipping %d ranks, at least %d are needed" % (ranks, RESERVED_RANKS + 1), file=sys.stderr)
+                    continue
+                fleet = vehicles * (ranks - RESERVED_RANKS) if args.mode == "weak" else vehicles
+                for repeat in range(args.repeats):
+                    print("Running %s on %d ranks with %d vehicles (repeat %d)" % (map_file, ranks, fleet, repeat + 1))
+                    measured = run_once(args, map_file, ranks, fleet)
+                    if measured is None:
+                        failed += 1
+                        continue
+                    if measured["vehicle_ranks"] != ranks - RESERVED_RANKS:
+                        print("  ran on %d vehicle ranks rather than %d" % (measured["vehicle_ranks"],
+                                                                         ranks - RESERVED_RANKS), file=sys.stderr)
+                    measured.update({"map": map_file, "mode": args.mode, "ranks": ranks, "vehicles": fleet,
+                                     "repeat": repeat})
+                    runs.append(measured)
+
+    summary = summarise(runs)
+    results = write_results(args.output_dir, runs, summary, args)
+    for row in summary:
+        print("%s %s ranks=%d vehicles=%d tick=%.6fs ticks/s=%.1f startup=%.3fs speedup=%.2f efficiency=%.2f" % (
+            row["map"], row["mode"], row["ranks"], row["vehicles"], row["tick_seconds"], row["ticks_per_second"],
+            row["startup_seconds"], row["speedup"], row["efficiency"]))
+    print("Results written to %s" % args.output_dir)
+
+    if args.save_baseline:
+        with open(args.save_baseline, "w") as f:
+            json.dump(results, f, indent=2)
+        print("Baseline saved to %s" % args.save_baseline)
+
+    regressions = []
+    if args.baseline and os.path.exists(args.baseline):
+        regressions = check_regressions(summary, args.baseline, args.tolerance)
+    if failed:
+        print("%d runs failed" % failed, file=sys.stderr)
+    if regressions:
+        print("%d configurations regressed by more than %.0f%%" % (len(regressions), args.tolerance * 100),
+              file=sys.stderr)
+    return 1 if failed or regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
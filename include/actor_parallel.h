@@ -1,13 +1,34 @@
-static void createInitialActor(int);
+static void memberFilename(char **);
+static void discoverNodes();
+static void reportRouting();
+static int createActor(enum ActorType, int *, int);
+static int initialVehicleActors();
+static int restartVehicleActors();
 static void workerCode();
 static void control();
+static void writeCheckpoint(int, int *, int *);
+static void publishLiveMetrics(int, int, double);
+static int initControlRequests(MPI_Request *, int *, int *, int *);
+static int compareVehicleActors(const void *, const void *);
+static void buildControlTree();
+static void sendControlTree(MPI_Request *);
+static void addVehicleActor(int, char);
+static void splitNewVehicles(int, int *);
+static void balanceVehicleLoad();
+static int scaleVehicleActors(double, int);
 static void RoadJunction();
-static void Vehicle();
-static void loadRoadMap(char *);
-static int initVehicles();
-static int activateRandomVehicle();
-static int activateVehicle(enum VehicleType);
-static void handleVehicleUpdate(int);
-static int planRoute(int, int, struct JunctionStruct *, int, int);
-static void writeDetailedInfo();
-
+static void Vehicle(int, int, int);
+static void initVehicleTreeRequests(struct ControlTreeNode *, int *, int *, MPI_Request *, MPI_Request *, MPI_Request *);
+static void migrateVehicles(int *);
+static int checkpointVehicles(int, int, int);
+static void restoreVehicles(int, int);
+static void packVehicle(int, struct PackedVehicle *);
+static int packVehicles(struct PackedVehicle *, int);
+static void unpackVehicles(struct PackedVehicle *, int);
+static void sendStatistics(int);
+static void handleJunctionStats(int, int, int *, int);
+static void handleRoadStats(int, int, int *, int);
+static void exchangeRoutes(int, int *, int *);
+static void RouteService();
+static void receiveRoutingSpeeds(int *, int *);
+static void freeRequests(MPI_Request *, int);
@@ -0,0 +1,45 @@
+// include/checkpoint.h
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Identifies checkpoint files and the version of their layout
+#define CHECKPOINT_MAGIC "PDPCKPT1"
+#define CHECKPOINT_MAGIC_LEN 8
+// Longest file name of a checkpoint part
+#define CHECKPOINT_MAX_FILENAME 4096
+
+// The checkpoint file itself, written by control once every vehicle actor has written its part. The parts of the
+// checkpoint taken after elapsed_mins minutes are in the files "<checkpoint>.<elapsed_mins>.<part>"
+struct CheckpointHeader
+{
+    char magic[CHECKPOINT_MAGIC_LEN];
+    int elapsed_mins, num_parts;
+    int total_vehicles, passengers_delivered, passengers_stranded, vehicles_crashed, vehicles_exhausted_fuel;
+    unsigned long long seed;
+    struct RandomStream random; // Control's stream
+    long long saved_seconds;    // The wall clock when it was taken, the vehicles' times are moved on by the gap
+};
+
+// The start of a part written by a vehicle actor, followed by its vehicles and then the vehicles and crashes counted
+// at every junction and the vehicles and most concurrent vehicles counted on every road (in the order of their ids)
+struct CheckpointPart
+{
+    char magic[CHECKPOINT_MAGIC_LEN];
+    int elapsed_mins, num_vehicles, num_junctions, num_roads;
+    struct RandomStream random; // The vehicle actor's stream
+};
+
+// Writes the header atomically (through a temporary file), returns zero if it could not be written
+int writeCheckpointHeader(char *, struct CheckpointHeader *);
+// Reads and checks the header, returns zero if it is missing or not a checkpoint
+int readCheckpointHeader(char *, struct CheckpointHeader *);
+// Writes this actor's part, with or without its junction and road statistics. Returns zero if it could not be written
+int writeCheckpointPart(char *, int, int, struct PackedVehicle *, int, int);
+// Reads a part, adding its statistics to the road map if asked to. Returns its vehicles (to be freed) or NULL
+struct PackedVehicle *readCheckpointPart(char *, int, int, int, int *, struct RandomStream *);
+// The number of vehicles in all the parts of a checkpoint, read from their headers alone. Returns -1 if a part is missing
+int countCheckpointVehicles(char *, int, int);
+// Removes the parts of an earlier checkpoint once a newer one has been written
+void removeCheckpointParts(char *, int, int);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,30 @@
+// include/coalesce.h
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include "mpi.h"
+
+// Default number of ints a destination's buffer may hold before it is flushed automatically
+#define COALESCE_FLUSH_THRESHOLD 4096
+// Maximum number of distinct record tags that handlers can be registered for
+#define COALESCE_MAX_RECORD_TAGS 32
+
+// Called by the receiver for every record unpacked from a coalesced message
+typedef void (*CoalesceHandler)(int source, int record_tag, int *payload, int len);
+
+// Initialises the coalescing layer over a communicator, flushing a destination's buffer once it holds threshold ints
+void coalesceInit(int threshold, MPI_Comm comm);
+// Finalises the coalescing layer, waiting for any outstanding sends
+void coalesceFinalise();
+// Registers the handler that is called for records with this tag when they are received
+void coalesceRegisterHandler(int record_tag, CoalesceHandler handler);
+// Appends a record to the buffer for the destination rank, flushing it if the threshold is reached
+void coalescePut(int dest, int record_tag, int *payload, int len);
+// Sends whatever is buffered for the destination and marks the end of the current phase for it
+void coalesceFlush(int dest);
+// Sends whatever is buffered for every destination and marks the end of the current phase
+void coalesceFlushAll();
+// Receives and dispatches records until num_senders processes have marked the end of their phase
+void coalesceReceivePhase(int num_senders);
+
+#endif // COALESCE_H
@@ -12,33 +12,89 @@
 #define ROADJUNCTION_RANK 2
 
 #define UPDATED_RESULTS_TAG 1
-#define VEHICLE_CREATED_TAG 2
-#define RANDOM_CREATE_TAG 3
 #define UPDATE_JUNCTION_TAG 4
 #define UPDATED_JUNCTION_TAG 5
 #define UPDATE_VEHICLES_TAG 6
 #define FINISHED_UPDATED_JUNCTION_TAG 7
-#define FINISHED_UPDATED_VEHICLES_TAG 8
 #define PLAN_ROUTE_TAG 9
 #define ACTIVE_0 10
-#define TRAFFICLIGHT_ENABLED_TAG 11
 #define ROAD_SPEED_TAG 12
-#define VEHICLE_INDEX_TAG 13
-#define BEGIN_ROADS_UPDATE_TAG 14
-#define LOOP_BEGIN_TAG 15
-#define LOOP_END_TAG 16
-#define VEHICLE_INDEX_RETURN_ID_TAG 17
-#define FILE_WRITE_TAG 18
-#define BREAK_MESSAGE_TAG 19
+#define ROAD_OCCUPANCY_TAG 13
+#define VEHICLE_RANKS_TAG 14
+#define VEHICLE_MIGRATE_TAG 15
+#define VEHICLE_TREE_TAG 16
+#define ROUTE_ANSWER_TAG 17
+#define ROUTE_STOP_TAG 18
 #define FINISH_WRITE_TAG 20
 
+// Layout of the per-tick command sent by control to the roadjunction and vehicle actors
+#define TICK_COMMAND_LEN 12
+#define CMD_ELAPSED_MINS 0
+#define CMD_NEW_VEHICLES 1
+#define CMD_STOP 2
+#define CMD_NUM_VEHICLE_RANKS 3
+#define CMD_RANKS_CHANGED 4
+#define CMD_MIGRATE_TO 5
+#define CMD_MIGRATE_COUNT 6
+#define CMD_MIGRATE_FROM 7
+#define CMD_RETIRE 8
+#define CMD_CHECKPOINT 9 // One more than the part of the checkpoint to write after this tick, zero for none
+#define CMD_PUBLICATIONS 10 // How many times roadjunction published the road speeds before this tick
+#define CMD_PUBLISH 11      // Whether roadjunction recomputes and publishes the road speeds this tick
+
+// Layout of the per-tick results returned by each vehicle actor to control
+#define TICK_RESULTS_LEN 9
+#define RES_EXHAUSTED_FUEL 0
+#define RES_PASSENGERS_STRANDED 1
+#define RES_VEHICLES_CRASHED 2
+#define RES_PASSENGERS_DELIVERED 3
+#define RES_VEHICLES_CREATED 4
+#define RES_ACTIVE_VEHICLES 5
+#define RES_UPDATE_USECS 6
+#define RES_CHECKPOINT_FAILED 7
+#define RES_OCCUPANCY_DRIFT 8 // Vehicles the road occupancy has changed by since the last publication, with --sync-drift
+
+// Record tags for the coalesced end of run statistics
+#define JUNCTION_STATS_RECORD 0
+#define ROAD_STATS_RECORD 1
+
 #define MAX_ROAD_LEN 100
 #define MAX_VEHICLES 500
 #define MAX_MINS 100
 #define MIN_LENGTH_SECONDS 2
 #define MAX_NUM_ROADS_PER_JUNCTION 50
+// Layout of a road map image: the number of junctions, roads and traffic lights, then each road's from, to, length
+// and speed, then the junctions with traffic lights
+#define MAP_IMAGE_HEADER_LEN 3
+#define MAP_IMAGE_ROAD_LEN 4
 #define SUMMARY_FREQUENCY 5
 #define INITIAL_VEHICLES 50
+#define CHECKPOINT_INTERVAL_MINS 10
+
+// Elastic vehicle actors (--elastic): main starts this percentage of the vehicle ranks and control starts the rest
+// from the process pool when the vehicle ranks are overloaded. Without --elastic every vehicle rank starts up front
+#define INITIAL_VEHICLE_ACTORS_PERCENT 50
+#define ELASTIC_CHECK_INTERVAL 100
+#define ELASTIC_HIGH_LOAD 250
+#define ELASTIC_LOW_LOAD 50
+#define ELASTIC_MAX_TICK_TIME 0.05
+
+// Load balancing between vehicle ranks: every LOAD_BALANCE_INTERVAL ticks ranks whose vehicle updates cost more
+// than LOAD_BALANCE_TOLERANCE above the average hand batches (of at least LOAD_BALANCE_MIN_BATCH) to cheaper ranks
+#define LOAD_BALANCE_INTERVAL 100
+#define LOAD_BALANCE_TOLERANCE 0.2
+#define LOAD_BALANCE_MIN_BATCH 5
+
+// Control reaches the vehicle actors through a tree, node leaders fan out to this many other leaders and to this many
+// of the actors on their node (each of which fans out to this many more)
+#define CONTROL_TREE_FANOUT 4
+#define CONTROL_TREE_MAX_CHILDREN (2 * CONTROL_TREE_FANOUT)
+
+// Roadjunction publishes the road speeds and traffic lights as the entries that changed since the last tick, a count
+// followed by (index, value) pairs with the lights indexed after the roads, or as PUBLICATION_FULL followed by the whole
+// table when the changes would take more than PUBLICATION_DELTA_PERCENT of its length
+#define PUBLICATION_FULL -1
+#define PUBLICATION_DELTA_PERCENT 50
 
 #define BUS_PASSENGERS 80
 #define BUS_MAX_SPEED 50
@@ -73,6 +129,18 @@ enum ReadMode
     TRAFFICLIGHTS
 };
 
+enum ActorType
+{
+    CONTROL_ACTOR,
+    ROADJUNCTION_ACTOR,
+    VEHICLE_ACTOR,
+    ELASTIC_VEHICLE_ACTOR,
+    ROUTING_ACTOR
+};
+
+// Names of the actor types, as used in the instrumentation summary
+static const char *const actor_names[] = {"control", "roadjunction", "vehicle", "elastic_vehicle", "routing"};
+
 enum VehicleType
 {
     CAR,
@@ -100,6 +168,13 @@ struct RoadStruct
     int total_number_vehicles, max_concurrent_vehicles;
 };
 
+// A counter-based random number stream, the n-th number is a hash of the key and n. A stream has no hidden state
+// beyond its counter, so it can be saved, sent to another rank with its vehicle and replayed
+struct RandomStream
+{
+    unsigned long long key, counter;
+};
+
 struct VehicleStruct
 {
     int id;
@@ -111,19 +186,74 @@ struct VehicleStruct
     char active;
     struct JunctionStruct *currentJunction;
     struct RoadStruct *roadOn;
+    struct RandomStream random; // The vehicle's own stream, used for its collision checks wherever it is updated
+    int next_junction;          // Where the routing actors said to go from the current junction, or ROUTE_UNKNOWN
+};
+
+// A vehicle's next junction when it has not been asked for yet, and while the routing actors are working it out
+#define ROUTE_UNKNOWN -2
+#define ROUTE_REQUESTED -3
+
+// A vehicle as it is sent between vehicle processes, the junction and road are referred to by their indices
+struct PackedVehicle
+{
+    int passengers, source, dest, maxSpeed;
+    int speed, arrived_road_time, fuel;
+    int junction, road_from, road_index;
+    time_t last_distance_check_secs, start_t;
+    double remaining_distance;
+    struct RandomStream random;
 };
 
-struct JunctionStruct *roadMap;
-int num_junctions, num_roads;
+// Migrated vehicles are preceded by whether the sender is going back to sleep and how many vehicles follow
+#define MIGRATION_HEADER_SIZE (2 * sizeof(int))
+
+// Where a vehicle actor sits in control's tree, commands for its subtree come down from the parent and the subtree's
+// results go back up. This is sent as ints so must only hold ints
+struct ControlTreeNode
+{
+    int parent, subtree_size, num_children;
+    int children[CONTROL_TREE_MAX_CHILDREN], child_subtree_sizes[CONTROL_TREE_MAX_CHILDREN];
+};
+
+// Control's view of a vehicle actor and the migration planned for it in the next tick
+struct VehicleActor
+{
+    struct ControlTreeNode tree;
+    int rank, load;
+    int update_usecs; // Time spent updating its vehicles in the last tick
+    char elastic, retire;
+    int migrate_to, migrate_count, migrate_from;
+    // Measured seconds per vehicle update, and what has been measured since the last load balance
+    double cost, window_update_time;
+    long window_updates;
+};
+
+// The threaded engine runs the actors as threads of one process, so the state an actor keeps to itself is local to its
+// thread. Thread locals can not be common symbols, so these are declared here and defined once in simulation.c
+#define ACTOR_LOCAL _Thread_local
+
+extern ACTOR_LOCAL struct JunctionStruct *roadMap;
+extern ACTOR_LOCAL int num_junctions, num_roads;
 
-struct VehicleStruct *vehicles;
+extern ACTOR_LOCAL struct VehicleStruct *vehicles;
+struct VehicleActor *vehicle_actors;
+int num_vehicle_actors;
+int first_vehicle_rank; // The ranks before this run control, roadjunction and the routing actors
+// The vehicles waiting at a junction for the routing actors to plan their next junction this tick
+extern ACTOR_LOCAL int *route_request_vehicles, num_route_requests;
+int *rank_node;
 char *map_filename;
+int *shared_map_image; // The road map image in memory shared by the node's ranks, NULL to parse the file instead
+double program_start_time; // When this rank started, control reports the startup time from it
+// This actor's stream, keyed by the seed, the rank and how many actors it has run
+extern ACTOR_LOCAL struct RandomStream random_stream;
 
-int total_vehicles;
-int passengers_delivered;
-int vehicles_exhausted_fuel;
-int passengers_stranded;
-int vehicles_crashed ;
+extern ACTOR_LOCAL int total_vehicles;
+extern ACTOR_LOCAL int passengers_delivered;
+extern ACTOR_LOCAL int vehicles_exhausted_fuel;
+extern ACTOR_LOCAL int passengers_stranded;
+extern ACTOR_LOCAL int vehicles_crashed;
 
 static int size;
 static int rank;
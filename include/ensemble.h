@@ -0,0 +1,33 @@
+// include/ensemble.h
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "mpi.h"
+
+// Layout of the final totals control keeps for the ensemble report, the first is non-zero if this rank ran control
+#define ENSEMBLE_TOTALS_LEN 7
+#define ENS_RAN_CONTROL 0
+#define ENS_ELAPSED_MINS 1
+#define ENS_VEHICLES 2
+#define ENS_DELIVERED 3
+#define ENS_STRANDED 4
+#define ENS_CRASHED 5
+#define ENS_EXHAUSTED 6
+
+// The ranks running this rank's member of the ensemble, the whole job when there is only one member. Every actor
+// communicates over this rather than MPI_COMM_WORLD
+MPI_Comm sim_comm;
+int ensemble_member;
+int world_rank, world_size;
+int ensemble_totals[ENSEMBLE_TOTALS_LEN];
+
+// Splits the ranks into the given number of members of contiguous ranks, setting sim_comm and ensemble_member
+void ensembleInit(int);
+// Reads the road map once per node into memory shared by the node's ranks and points shared_map_image at it
+void ensembleShareMap(char *);
+// Gathers every member's final totals and prints them and their mean, minimum and maximum on world rank 0
+void ensembleReport(unsigned long long);
+// Frees the shared road map and the member's communicator
+void ensembleFinalise();
+
+#endif // ENSEMBLE_H
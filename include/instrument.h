@@ -0,0 +1,59 @@
+// include/instrument.h
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+// Set to 0 (here or with -DINSTRUMENT_ENABLED=0) to compile the instrumentation out
+#ifndef INSTRUMENT_ENABLED
+#define INSTRUMENT_ENABLED 1
+#endif
+// Message tags at or above this are counted together
+#define INSTRUMENT_MAX_TAGS 32
+// Number of phase events each rank keeps when tracing, once full the oldest are overwritten
+#define INSTRUMENT_TRACE_EVENTS 65536
+
+// The phases that are timed, a phase can be entered many times and its calls and total time are recorded
+enum InstrumentPhase
+{
+    INSTR_LOAD_MAP,
+    INSTR_CONTROL_TICK,
+    INSTR_CONTROL_WAIT,
+    INSTR_JUNCTION_EXCHANGE,
+    INSTR_JUNCTION_UPDATE,
+    INSTR_SPAWN,
+    INSTR_MIGRATION,
+    INSTR_ROAD_EXCHANGE,
+    INSTR_VEHICLE_UPDATE,
+    INSTR_RESULTS,
+    INSTR_STATS,
+    INSTR_ROUTING,
+    INSTR_ROUTE_EXCHANGE,
+    INSTR_NUM_PHASES
+};
+
+#if INSTRUMENT_ENABLED
+// Starts timing a phase
+void instrumentBegin(enum InstrumentPhase);
+// Stops timing a phase, adding the time since instrumentBegin to its total
+void instrumentEnd(enum InstrumentPhase);
+// Counts messages sent with a tag and their total size in bytes
+void instrumentMessages(int, int, long);
+// Adds the calling thread's measurements to the rank's, for a thread of the threaded engine before it finishes
+void instrumentMergeThread();
+#else
+// Compiled out, so code built without MPI (such as the microbenchmarks) does not need src/instrument.c
+#define instrumentBegin(phase) ((void)0)
+#define instrumentEnd(phase) ((void)0)
+#define instrumentMessages(tag, count, bytes) ((void)0)
+#define instrumentMergeThread() ((void)0)
+#endif
+// Records which actor this rank is running, so ranks can be summarised by actor
+void instrumentSetActor(int);
+// Collective over all ranks, starts recording every phase as a trace event into a ring buffer of the given size
+void instrumentStartTrace(int);
+// Collective over all ranks, merges the trace events of every rank into one Chrome trace JSON file
+void instrumentWriteTrace(const char *const *, int, char *);
+// Collective over all ranks, prints the min/mean/max of each measurement across the ranks running each actor and
+// optionally writes every rank's measurements as JSON
+void instrumentReport(const char *const *, int, char *);
+
+#endif // INSTRUMENT_H
@@ -0,0 +1,63 @@
+// include/live_metrics.h
+#ifndef LIVE_METRICS_H
+#define LIVE_METRICS_H
+
+#include <stdatomic.h>
+
+// Layout of the segment, changed whenever struct LiveMetrics changes so a reader can tell it can not read it
+#define LIVE_METRICS_VERSION 1
+// Most vehicle actors whose load is published, the rest are left out
+#define LIVE_METRICS_MAX_ACTORS 1024
+// Tick times are counted in buckets a quarter of a doubling wide, from a microsecond up to about 14 seconds
+#define LIVE_METRICS_BUCKETS_PER_DOUBLING 4
+#define LIVE_METRICS_BUCKETS 96
+// How often metrics_tail reads the segment by default
+#define LIVE_METRICS_TAIL_INTERVAL_MS 1000
+
+// The load of a vehicle actor (or vehicle thread) in its last tick
+struct LiveActorLoad
+{
+    int rank;
+    int vehicles;
+    int update_usecs;
+};
+
+// What control publishes every tick. It is the only writer, and makes sequence odd while it writes so readers copy
+// the struct and take the copy only if sequence was even and unchanged either side of it
+struct LiveMetrics
+{
+    unsigned int version;
+    _Atomic unsigned long long sequence;
+    int running; // Cleared once the run has finished
+    unsigned long long seed;
+    int member;
+    int elapsed_mins;
+    int ticks;
+    int total_vehicles;
+    int passengers_delivered;
+    int passengers_stranded;
+    int vehicles_crashed;
+    int vehicles_exhausted_fuel;
+    double last_tick_seconds;
+    // The 50th, 90th and 99th percentile tick times over the run so far, and the counts they are taken from, which
+    // a reader can take the difference of between two copies for the percentiles over that interval
+    double tick_percentiles[3];
+    unsigned long long tick_histogram[LIVE_METRICS_BUCKETS];
+    int num_actors;
+    struct LiveActorLoad actors[LIVE_METRICS_MAX_ACTORS];
+};
+
+// Creates the named shared memory segment for this run, returns zero (after a warning) if it can not
+int liveMetricsOpen(char *, unsigned long long, int);
+// Starts an update of the segment, returning the struct to fill in or NULL if there is no segment
+struct LiveMetrics *liveMetricsBegin();
+// Counts the tick's time and finishes the update started by liveMetricsBegin
+void liveMetricsEnd(struct LiveMetrics *, double);
+// Marks the run as finished and unmaps the segment, which is left for the readers
+void liveMetricsClose();
+// The bucket of the tick time histogram a time in seconds falls in
+int liveMetricsBucket(double);
+// The time a fraction of the counts in a tick time histogram are at or below, the top of its bucket
+double liveMetricsPercentile(unsigned long long *, double);
+
+#endif // LIVE_METRICS_H
@@ -0,0 +1,57 @@
+// include/mapgen.h
+#ifndef MAPGEN_H
+#define MAPGEN_H
+
+// Defaults, chosen to match the maps under problem_size/
+#define MAPGEN_DEFAULT_JUNCTIONS 1000
+#define MAPGEN_DEFAULT_DEGREE 4
+#define MAPGEN_DEFAULT_MIN_LENGTH 100
+#define MAPGEN_DEFAULT_MAX_LENGTH 10100
+#define MAPGEN_DEFAULT_MIN_SPEED 10
+#define MAPGEN_DEFAULT_MAX_SPEED 110
+#define MAPGEN_DEFAULT_LIGHTS 0.22
+
+enum MapFamily
+{
+    GRID_MAP,
+    GEOMETRIC_MAP,
+    SCALE_FREE_MAP
+};
+
+struct MapParameters
+{
+    enum MapFamily family;
+    int junctions, degree;
+    int min_length, max_length, min_speed, max_speed;
+    double lights;
+    unsigned long long seed;
+    char *output;
+};
+
+// The undirected roads between junctions, every one is written in both directions. Each junction holds at most
+// MAX_NUM_ROADS_PER_JUNCTION roads so the simulation can load the map
+struct MapGraph
+{
+    int num_junctions;
+    int *degree;
+    int *neighbours; // num_junctions * MAX_NUM_ROADS_PER_JUNCTION
+    int *lengths;    // length of the road to each neighbour
+    double *x, *y;   // positions, only for the geometric family
+};
+
+static int parseParameters(int, char *[], struct MapParameters *);
+static void printUsage(char *);
+static unsigned long long nextRandom();
+static double uniformRandom();
+static int randomBetween(int, int);
+static void initGraph(struct MapGraph *, int);
+static void freeGraph(struct MapGraph *);
+static int addRoad(struct MapGraph *, int, int, int);
+static void generateGrid(struct MapGraph *, struct MapParameters *);
+static void generateGeometric(struct MapGraph *, struct MapParameters *);
+static void generateScaleFree(struct MapGraph *, struct MapParameters *);
+static void connectComponents(struct MapGraph *, struct MapParameters *);
+static int findRoot(int *, int);
+static void writeMap(FILE *, struct MapGraph *, struct MapParameters *);
+
+#endif // MAPGEN_H
@@ -0,0 +1,38 @@
+// include/microbench.h
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+// Defaults for the microbenchmarks, the route queries are a full Dijkstra search each so there are fewer of them
+#define MICROBENCH_DEFAULT_MAP "./problem_size/large_problem"
+#define MICROBENCH_DEFAULT_REPEATS 5
+#define MICROBENCH_DEFAULT_ROUTE_QUERIES 4
+#define MICROBENCH_DEFAULT_OPS 1000000
+// Most findIndexOfMinimum scans per repeat, each covers every junction
+#define MICROBENCH_MAX_SCANS 2000
+// Changes of speed applied to the destination trees per repeat, and the percentage of the roads each one slows or
+// speeds up
+#define MICROBENCH_SPEED_CHANGES 20
+#define MICROBENCH_CHANGED_ROADS_PERCENT 1
+
+// The timings of the repeats of one benchmark, each repeat being a batch of operations
+struct BenchResult
+{
+    const char *name;
+    long ops;
+    int repeats;
+    double ns_per_op[64];
+};
+
+static double nowNanoseconds();
+static void report(struct BenchResult *);
+static void benchLoadRoadMap(char *, int);
+static void benchRoutingInit(char *, int);
+static void benchPlanRoute(int, int);
+static void benchSpeedChanges(int);
+static void benchFindIndexOfMinimum(int, int);
+static void benchFindAppropriateRoad(int, long);
+static void benchFindFreeVehicle(int, long, int);
+static void benchHandleVehicleUpdate(int, int, int);
+static void clearVehicles();
+
+#endif // MICROBENCH_H
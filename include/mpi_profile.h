@@ -0,0 +1,14 @@
+// include/mpi_profile.h
+#ifndef MPI_PROFILE_H
+#define MPI_PROFILE_H
+
+// The PMPI wrappers in src/mpi_profile.c are linked in by `make profile`, the simulation itself does not call
+// anything here. Point to point traffic is recorded per peer and per tag, tags at or above this are counted together
+#define MPI_PROFILE_MAX_TAGS 32
+// Most nonblocking and persistent requests that can be tracked at once, requests beyond this are not recorded
+#define MPI_PROFILE_MAX_REQUESTS 8192
+// Environment variable naming the file the communication matrix is written to at MPI_Finalize
+#define MPI_PROFILE_FILE_ENV "MPI_PROFILE_FILE"
+#define MPI_PROFILE_DEFAULT_FILE "mpi_profile.txt"
+
+#endif // MPI_PROFILE_H
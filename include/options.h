@@ -0,0 +1,34 @@
+// include/options.h
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// Options given on the command line after the roadmap file
+struct RunOptions
+{
+    char *map_filename;
+    int max_mins;              // Simulated minutes to run for
+    int initial_vehicles;      // Vehicles created at the start, split between the vehicle actors
+    char *stats_json_filename; // Where to write the instrumentation as JSON, NULL to only print the summary
+    char *trace_filename;      // Where to write the Chrome trace of every rank's phases, NULL to not trace
+    int perf_counters;         // Whether to count hardware events around the hot regions
+    unsigned long long seed;   // Seed of every random number stream, taken from the clock if it is not given
+    int seed_given;            // Whether --seed was given, otherwise a restart carries on with the checkpoint's seed
+    char *checkpoint_filename; // Where to write checkpoints, NULL to not checkpoint
+    int checkpoint_every;      // Simulated minutes between checkpoints
+    char *restart_filename;    // The checkpoint to carry on from, NULL to start afresh
+    int ensemble_members;      // Independent simulations the ranks are split between, each with its own seed
+    int vehicle_threads;       // Vehicle threads of the threaded engine, zero to run the actors on MPI ranks
+    int sync_every;            // Ticks between roadjunction's publications of the road speeds
+    int sync_drift;            // Occupancy change that brings the next publication forward, zero to only go by ticks
+    char *live_metrics_name;   // Shared memory segment control publishes the run's progress to, NULL to not publish
+    int elastic;               // Whether to start only some vehicle actors and scale them with the load
+};
+
+struct RunOptions run_options;
+
+// Parses the command line into run_options, returns zero (printing why if asked to) if it is not valid
+int parseOptions(int, char *[], int);
+// Prints how to run the program to stderr
+void printUsage(char *);
+
+#endif // OPTIONS_H
@@ -0,0 +1,46 @@
+// include/perf_counters.h
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+// Set to 0 (here or with -DPERF_COUNTERS_ENABLED=0) to compile the counters out
+#ifndef PERF_COUNTERS_ENABLED
+#define PERF_COUNTERS_ENABLED 1
+#endif
+
+// The regions that hardware counters can be wrapped around
+enum PerfRegion
+{
+    PERF_LOAD_MAP,
+    PERF_VEHICLE_UPDATE,
+    PERF_ROUTE_QUERY,
+    PERF_NUM_REGIONS
+};
+
+// The hardware events that are counted
+enum PerfCounter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NUM_COUNTERS
+};
+
+// Opens the counters for this process, if the system does not allow them the regions are simply not measured
+void perfCountersInit();
+#if PERF_COUNTERS_ENABLED
+// Starts counting a region
+void perfRegionBegin(enum PerfRegion);
+// Stops counting a region, adding the counts since perfRegionBegin. The units are what the report is normalised by,
+// such as the number of vehicles updated
+void perfRegionEnd(enum PerfRegion, long);
+#else
+#define perfRegionBegin(region) ((void)0)
+#define perfRegionEnd(region, units) ((void)0)
+#endif
+// Collective over all ranks, prints the counts of every region on every rank per unit along with the IPC
+void perfCountersReport();
+// Closes the counters
+void perfCountersFinalise();
+
+#endif // PERF_COUNTERS_H
@@ -10,14 +10,21 @@ enum PP_Control_Command {
 	PP_RUNCOMPLETE=4
 };
 
-// An example data package which combines the command with some optional data, an example and can be extended
+// Most ints of payload that can be carried to a worker along with the command that starts it
+#define PP_MAX_PAYLOAD 8
+
+// The data package which combines the command with the parent rank, and for a start the actor type and a small payload,
+// so a worker can be launched with a single message
 struct PP_Control_Package {
 	enum PP_Control_Command command;
-    int data;
+	int data;
+	int actorType;
+	int payloadLength;
+	int payload[PP_MAX_PAYLOAD];
 };
 
-// Initialises the process pool
-int processPoolInit();
+// Initialises the process pool over the processes of the communicator
+int processPoolInit(MPI_Comm);
 // Finalises the process pool
 void processPoolFinalise();
 // Called by the master in loop, blocks until state change, 1=continue and 0=stop
@@ -26,11 +33,15 @@ int masterPoll();
 int workerSleep();
 // Determines whether the current worker should stop or not (i.e. whether the pool is shutting down)
 int shouldWorkerStop();
-// Called by the master or a worker to start a new worker process
-int startWorkerProcess();
+// Called by the master or a worker to start a new worker process running the given actor type with an optional payload
+int startWorkerProcess(int, int *, int);
 // Called by a worker to shut the pool down
 void shutdownPool();
 // Retrieves the optional data associated with the command, provides an example of how this can be done
 int getCommandData();
+// Retrieves the actor type the worker was started to run
+int getActorType();
+// Copies the payload the worker was started with into the buffer and returns its length
+int getCommandPayload(int *);
 
 #endif /* POOL_H_ */
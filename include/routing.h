@@ -0,0 +1,102 @@
+// include/routing.h
+#ifndef ROUTING_H
+#define ROUTING_H
+
+// The ways planRoute() can find the next junction on the shortest route
+enum RoutingMode
+{
+    ROUTING_DIJKSTRA, // Search the whole map outwards from the source (the original planner)
+    ROUTING_ALT,      // A* guided by lower bounds from the distances to and from a set of landmark junctions
+    ROUTING_CH,       // Bidirectional search upwards through a contraction hierarchy of the free flow road graph
+    ROUTING_TREES,    // Look ups in a shortest path tree built backwards from each destination and shared by its vehicles
+    NUM_ROUTING_MODES
+};
+
+static const char *const routing_mode_names[] = {"dijkstra", "alt", "ch", "trees"};
+
+#define ROUTING_DEFAULT_LANDMARKS 8
+#define ROUTING_MAX_LANDMARKS 64
+// Most junctions a witness search may settle while contracting, past this a shortcut is added to be safe
+#define CH_WITNESS_SETTLE_LIMIT 500
+// The contraction hierarchy is cached in the file named after the map with this suffix
+#define CH_CACHE_SUFFIX ".ch"
+#define CH_CACHE_MAGIC "PDPCH001"
+// Default memory the destination trees may take up, the least recently used tree is evicted to make room
+#define ROUTING_TREE_MEMORY_MB 64
+// A junction whose best road leads to a route back through itself, its next junction needs a search
+#define ROUTING_TREE_SEARCH -2
+// A live tree is built again from scratch, rather than repaired, once more than this percentage of its junctions
+// have routes through roads that slowed down
+#define ROUTING_TREE_REPAIR_PERCENT 25
+// Distance to a junction that can not be reached
+#define ROUTING_UNREACHABLE 0x7fffffff
+
+struct RoutingSettings
+{
+    enum RoutingMode mode;
+    int num_landmarks;
+    int tree_memory_mb;
+    int live_trees; // The trees cost every road at its current speed, and are repaired as the speeds change
+    int num_actors; // Routing actors planning the routes for the vehicle actors, none to plan them on each vehicle actor
+};
+
+// How much searching the route queries have done, a junction is settled once its distance is final. Queries that
+// had to fall back to a plain Dijkstra search are also counted, as are the destination trees built and evicted and
+// the live trees repaired or built again when the speeds changed, and the batches of queries the routing actors answered
+struct RoutingCounters
+{
+    long queries, settled, fallback_queries;
+    long tree_builds, tree_evictions, tree_repairs, tree_rebuilds;
+    long batches;
+};
+
+// A shortest path tree rooted at a destination, with every junction's free flow distance to it and the times its
+// subtree was entered and left by a depth first walk (so a junction's route goes through another exactly when the
+// other's interval contains its own). The next junction from each junction is worked out when it is first asked
+// for with the current road speeds, and again once they have changed. A live tree has distances at the current
+// speeds and keeps only those and each junction's next junction, its parent in the tree
+struct RouteTree
+{
+    int dest;
+    long last_used;
+    int *dist, *enter, *leave, *next, *next_epoch;
+};
+
+// An edge of the contraction hierarchy, a shortcut bypasses the junction mid (which is -1 for a road)
+struct ChEdge
+{
+    int node, cost, mid;
+};
+
+// Identifies the map a cached contraction hierarchy was built for, followed by the junctions' ranks and the upward
+// and downward edges in compressed rows
+struct ChCacheHeader
+{
+    char magic[8];
+    int num_junctions, num_roads, num_up, num_down;
+    unsigned long long checksum;
+};
+
+struct RoutingSettings routing_settings;
+extern ACTOR_LOCAL struct RoutingCounters routing_counters;
+
+// Sets the default routing settings
+void routingDefaults();
+// Returns the mode with this name, or -1 if there is none
+int routingModeFromName(const char *);
+// Does any preprocessing the routing mode needs for the road map that has just been loaded from the given file
+void routingInit(char *);
+// Shares this thread's landmarks and contraction hierarchy with the threads that call routingInit later
+void routingShare();
+// Frees the preprocessing, before the road map is freed
+void routingFinalise();
+// The next junction on the shortest route from source to dest with A* and landmarks, -1 if there is no route
+int altRoute(int, int);
+// The next junction on the shortest route from source to dest with the contraction hierarchy, -1 if there is no route
+int chRoute(int, int);
+// The next junction on the shortest route from source to dest from dest's tree, -1 if there is no route
+int treeRoute(int, int);
+// Tells the routing that the current speeds of the roads with the given ids have changed
+void routingSpeedsChanged(int *, int);
+
+#endif // ROUTING_H
@@ -0,0 +1,42 @@
+// include/simulation.h
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+// Loads the road map from a file (or the shared image if there is one) into roadMap, setting num_junctions and num_roads
+void loadRoadMap(char *);
+// Parses a road map file into an image of ints that can be shared between processes
+int *readRoadMapImage(char *);
+// The number of ints in a road map image
+int roadMapImageLength(int *);
+// Builds roadMap from a road map image
+void buildRoadMap(int *);
+// Switches the traffic lights and sets the road speeds from the vehicle actors' occupancy, publishing them
+void updateJunctions(int, int *, int, int *);
+// Writes the vehicles on each road, returning how far they have drifted from the given occupancy if there is one
+int readOccupancy(int *, int *);
+// Applies the published road speeds and traffic lights, listing the roads whose speed changed and returning how many
+int applyPublishedSpeeds(int *, int *);
+// Encodes the published table as the changes since the last publication, or the whole table if there are too many
+int encodePublication(int *, int *, int, int *);
+// Applies a publication from encodePublication, listing the roads whose speed changed and returning how many
+int applyPublication(int *, int *);
+// Frees the road map
+void freeRoadMap();
+// Activates the given number of random vehicles, returns how many could be activated
+int initVehicles(int);
+// Picks a vehicle type at random
+int activateRandomVehicle();
+// Activates a free vehicle of the given type with a random route, returns its index or -1 if there are none free
+int activateVehicle(enum VehicleType);
+// Takes a vehicle out of the simulation, off the road or junction it was on
+void retireVehicle(int);
+// Moves a vehicle along its route, retiring it if it arrives, crashes or runs out of fuel
+void handleVehicleUpdate(int);
+// Queues a vehicle at a junction to have its next junction planned by the routing actors
+void requestRoute(int);
+// Plans the shortest route between two junctions, returning the next junction to go to or -1 if there is no route
+int planRoute(int, int, struct JunctionStruct *, int, int);
+// Writes the statistics of every junction and road to the results file
+void writeDetailedInfo();
+
+#endif // SIMULATION_H
@@ -0,0 +1,9 @@
+// include/simulation_check.h
+#ifndef SIMULATION_CHECK_H
+#define SIMULATION_CHECK_H
+
+// Defaults for the checks of the vehicle model, the map is small so every vehicle gets to move many times
+#define SIMULATION_CHECK_DEFAULT_MAP "./problem_size/tiny_problem"
+#define SIMULATION_CHECK_STEPS 200
+
+#endif // SIMULATION_CHECK_H
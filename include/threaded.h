@@ -0,0 +1,34 @@
+// include/threaded.h
+#ifndef THREADED_H
+#define THREADED_H
+
+// Most vehicle threads the threaded engine can run
+#define THREADED_MAX_VEHICLE_THREADS 64
+
+// What the threads share, each part is written by one thread between two barriers and only read by the others once
+// they are past the second
+struct ThreadedEngine
+{
+    int num_vehicle_threads;
+    // Control's command for the tick, whether to stop, whether roadjunction publishes the speeds and how many new
+    // vehicles each vehicle thread creates
+    int stop;
+    int publish;
+    int new_vehicles[THREADED_MAX_VEHICLE_THREADS];
+    // Written by the vehicle threads for roadjunction (on the main thread), num_roads ints each
+    int *occupancy;
+    // Written by roadjunction for the vehicle threads, the road speeds followed by the traffic lights
+    int *published;
+    // Written by the vehicle threads for control
+    int results[THREADED_MAX_VEHICLE_THREADS][TICK_RESULTS_LEN];
+    struct RoutingCounters routing[THREADED_MAX_VEHICLE_THREADS];
+    // Control hands out the command, the vehicle threads hand roadjunction their occupancy, roadjunction hands them
+    // the speeds back (both only on the ticks it publishes) and the vehicle threads hand control their results
+    pthread_barrier_t command_ready, occupancy_ready, speeds_ready, results_ready;
+};
+
+// Runs the whole simulation in this process, control and roadjunction on the calling thread and the given number of
+// vehicle actors on threads of their own
+void threadedRun(int);
+
+#endif // THREADED_H
@@ -8,6 +8,9 @@
 int findFreeVehicle();
 int findAppropriateRoad(int, struct JunctionStruct *);
 int getRandomInteger(int, int);
+unsigned long long randomKey(unsigned long long, unsigned long long, unsigned long long);
+unsigned long long randomNext(struct RandomStream *);
+int randomInteger(struct RandomStream *, int, int);
 time_t getCurrentSeconds();
 int findIndexOfMinimum(double *, char *, int);
 
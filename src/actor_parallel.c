@@ -6,81 +6,345 @@
 #include "mpi.h"
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "../include/pool.h"
+#include "../include/coalesce.h"
+#include "../include/instrument.h"
+#include "../include/options.h"
+#include "../include/perf_counters.h"
 #include "../include/data_structures.h"
 #include "../include/utils.h"
+#include "../include/simulation.h"
+#include "../include/checkpoint.h"
+#include "../include/routing.h"
+#include "../include/ensemble.h"
+#include "../include/threaded.h"
+#include "../include/live_metrics.h"
 #include "../include/actor_parallel.h"
 
 int main(int argc, char *argv[])
 {
-    int i, detachsize;
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
-    // if argc is not 2, print error message and exit
-    if (argc != 2)
+    int i, detachsize, thread_support;
+    // Only the main thread calls MPI, the threaded engine's vehicle threads do not
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
+    program_start_time = MPI_Wtime();
+    // the roadmap file must be given first, followed by any options. Every rank parses the same arguments, so only
+    // world rank 0 says what is wrong with them, and the others wait until it has before the job is aborted
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    if (!parseOptions(argc, argv, world_rank == 0))
     {
-        fprintf(stderr, "Error: You need to provide the roadmap file as the only argument\n");
+        if (world_rank == 0)
+        {
+            printUsage(argv[0]);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    // Each member of an ensemble is an independent simulation on its own block of ranks, from here on rank and size
+    // are within the member and the actors only talk over sim_comm
+    ensembleInit(run_options.ensemble_members);
+    MPI_Comm_rank(sim_comm, &rank);
+    MPI_Comm_size(sim_comm, &size);
+    if (run_options.ensemble_members > 1)
+    {
+        memberFilename(&run_options.checkpoint_filename);
+        memberFilename(&run_options.restart_filename);
+        memberFilename(&run_options.live_metrics_name);
+    }
+    // A restart carries on with the seed the checkpoint was taken with, unless another is given. That of member 0
+    // is the ensemble's seed, as the other members' checkpoints were taken with the seeds following it
+    struct CheckpointHeader restart_header;
+    if (world_rank == 0 && run_options.restart_filename != NULL && !run_options.seed_given &&
+        readCheckpointHeader(run_options.restart_filename, &restart_header))
+    {
+        run_options.seed = restart_header.seed;
+    }
+    // Every rank must draw from the same seed, so the one rank 0 has (given, from the checkpoint or from the clock)
+    // is used everywhere. The members of an ensemble take the seeds following it in turn
+    MPI_Bcast(&run_options.seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    unsigned long long ensemble_seed = run_options.seed;
+    run_options.seed += ensemble_member;
+    random_stream.key = randomKey(run_options.seed, rank, 0);
+    random_stream.counter = 0;
+    map_filename = run_options.map_filename;
+    // The routing actors take the ranks straight after roadjunction, there must still be one for a vehicle actor in
+    // every member (the smallest member has the fewest ranks)
+    first_vehicle_rank = ROADJUNCTION_RANK + 1 + routing_settings.num_actors;
+    if (run_options.vehicle_threads > 0)
+    {
+        // The threaded engine runs every actor on this one process, so has none of the features that need more ranks
+        if (world_size > 1 || run_options.ensemble_members > 1 || routing_settings.num_actors > 0 ||
+            run_options.checkpoint_filename != NULL || run_options.restart_filename != NULL || run_options.elastic)
+        {
+            if (world_rank == 0)
+            {
+                fprintf(stderr, "Error: --threads runs on a single rank, without routing actors, checkpoints, elastic "
+                                "vehicle actors or an ensemble\n");
+            }
+            MPI_Finalize();
+            exit(-1);
+        }
+        if (thread_support < MPI_THREAD_FUNNELED)
+        {
+            fprintf(stderr, "Error: --threads needs an MPI library that supports threads (MPI_THREAD_FUNNELED)\n");
+            MPI_Finalize();
+            exit(-1);
+        }
+    }
+    else if (world_size / run_options.ensemble_members <= first_vehicle_rank)
+    {
+        if (world_rank == 0)
+        {
+            fprintf(stderr, "Error: %d ensemble members with %d routing actors each need at least %d ranks\n",
+                    run_options.ensemble_members, routing_settings.num_actors,
+                    (first_vehicle_rank + 1) * run_options.ensemble_members);
+        }
+        MPI_Finalize();
         exit(-1);
     }
-    // srand is used to generate random numbers
-    srand(time(NULL));
-    map_filename = argv[1];
+    if (run_options.vehicle_threads == 0 && restartVehicleActors() > size - first_vehicle_rank)
+    {
+        // Each vehicle actor holds at most MAX_VEHICLES, so the rest of the checkpoint's vehicles would be lost
+        if (rank == 0)
+        {
+            fprintf(stderr, "Error: Restarting from '%s' needs at least %d vehicle ranks\n", run_options.restart_filename,
+                    restartVehicleActors());
+        }
+        MPI_Finalize();
+        exit(-1);
+    }
+    // Parse the road map once per node, every actor on the node builds its road map from the shared copy
+    ensembleShareMap(map_filename);
+
+    // Work out which node every rank is on, control arranges the vehicle actors into a tree by node
+    discoverNodes();
+    if (run_options.trace_filename != NULL)
+    {
+        instrumentStartTrace(INSTRUMENT_TRACE_EVENTS);
+    }
+    if (run_options.perf_counters)
+    {
+        perfCountersInit();
+    }
 
-    // Main function of the program
-    int statusCode = processPoolInit();
-    if (statusCode == 1)
+    // Main function of the program, the threaded engine runs the actors on threads of this process instead of
+    // starting them on the ranks of the process pool
+    if (run_options.vehicle_threads > 0)
     {
-        workerCode();
+        threadedRun(run_options.vehicle_threads);
     }
-    else if (statusCode == 2)
+    else
     {
-        createInitialActor(0);
-        createInitialActor(1);
-        for (int i = 0; i < size - 3; i++)
+        int statusCode = processPoolInit(sim_comm);
+        if (statusCode == 1)
         {
-            createInitialActor(2);
+            workerCode();
         }
-
-        int masterStatus = masterPoll();
-        while (masterStatus)
+        else if (statusCode == 2)
         {
-            masterStatus = masterPoll();
+            createActor(CONTROL_ACTOR, NULL, 0);
+            createActor(ROADJUNCTION_ACTOR, NULL, 0);
+            for (int i = 0; i < routing_settings.num_actors; i++)
+            {
+                createActor(ROUTING_ACTOR, NULL, 0);
+            }
+            // Each vehicle actor is told its share of the initial vehicles when it is started, the last one takes the
+            // extra vehicles if the division is not even. When restarting they are instead told which share of the
+            // checkpoint's vehicles to take. The remaining ranks stay asleep in the pool until control needs more
+            // vehicle actors
+            int participating_processes = initialVehicleActors();
+            for (int i = 0; i < participating_processes; i++)
+            {
+                int vehicle_payload[3] = {run_options.initial_vehicles / participating_processes, i, participating_processes};
+                if (i == participating_processes - 1)
+                {
+                    vehicle_payload[0] += run_options.initial_vehicles % participating_processes;
+                }
+                if (run_options.restart_filename != NULL)
+                {
+                    vehicle_payload[0] = 0;
+                }
+                createActor(VEHICLE_ACTOR, vehicle_payload, 3);
+            }
+
+            int masterStatus = masterPoll();
+            while (masterStatus)
+            {
+                masterStatus = masterPoll();
+            }
         }
-    }
 
-    processPoolFinalise();
+        processPoolFinalise();
+    }
+    ensembleReport(ensemble_seed);
+    // Every rank has finished its actors, so summarise how long they spent in each phase and what they sent
+    instrumentReport(actor_names, ROUTING_ACTOR + 1, run_options.stats_json_filename);
+    reportRouting();
+    if (run_options.trace_filename != NULL)
+    {
+        instrumentWriteTrace(actor_names, ROUTING_ACTOR + 1, run_options.trace_filename);
+    }
+    if (run_options.perf_counters)
+    {
+        perfCountersReport();
+        perfCountersFinalise();
+    }
+    free(rank_node);
+    ensembleFinalise();
     MPI_Finalize();
     return 0;
 }
 
-static void createInitialActor(int type)
+/**
+ * Gives a checkpoint file name the member's suffix, so the members of an ensemble each checkpoint (and restart from)
+ * their own file. The name is left as NULL if it was not given
+ **/
+static void memberFilename(char **filename)
+{
+    if (*filename == NULL)
+    {
+        return;
+    }
+    char *member_filename = (char *)malloc(CHECKPOINT_MAX_FILENAME);
+    snprintf(member_filename, CHECKPOINT_MAX_FILENAME, "%s.member%d", *filename, ensemble_member);
+    *filename = member_filename;
+}
+
+/**
+ * Fills in rank_node with the node every rank is on, identified by the lowest rank sharing memory with it. This is
+ * collective so is called by every rank before the process pool starts
+ **/
+static void discoverNodes()
+{
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(sim_comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+    int node = rank;
+    MPI_Bcast(&node, 1, MPI_INT, 0, node_comm);
+    MPI_Comm_free(&node_comm);
+    rank_node = (int *)malloc(sizeof(int) * size);
+    MPI_Allgather(&node, 1, MPI_INT, rank_node, 1, MPI_INT, sim_comm);
+}
+
+/**
+ * Sums how much searching the route queries did on every rank and prints it on rank 0, this is collective
+ **/
+static void reportRouting()
+{
+    long local[8] = {routing_counters.queries, routing_counters.settled, routing_counters.fallback_queries,
+                     routing_counters.tree_builds, routing_counters.tree_evictions, routing_counters.tree_repairs,
+                     routing_counters.tree_rebuilds, routing_counters.batches};
+    long total[8];
+    MPI_Reduce(local, total, 8, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (world_rank == 0 && total[0] > 0)
+    {
+        printf("[Routing] %s", routing_mode_names[routing_settings.mode]);
+        if (routing_settings.mode == ROUTING_ALT)
+        {
+            printf(" with %d landmarks", routing_settings.num_landmarks);
+        }
+        if (routing_settings.mode == ROUTING_TREES && routing_settings.live_trees)
+        {
+            printf(" (live)");
+        }
+        printf(": %ld route queries, %.1f junctions settled per query", total[0], (double)total[1] / total[0]);
+        if (routing_settings.mode == ROUTING_TREES)
+        {
+            printf(", %ld trees built (%ld evicted)", total[3], total[4]);
+        }
+        if (routing_settings.mode == ROUTING_TREES && routing_settings.live_trees)
+        {
+            printf(", %ld repaired and %ld rebuilt as speeds changed", total[5], total[6]);
+        }
+        else if (routing_settings.mode == ROUTING_CH || routing_settings.mode == ROUTING_TREES)
+        {
+            printf(", %ld fell back to Dijkstra", total[2]);
+        }
+        if (routing_settings.num_actors > 0)
+        {
+            printf(", answered by %d routing actors in %ld batches", routing_settings.num_actors, total[7]);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * Starts a worker from the process pool running the given actor, the type and payload travel with the pool's
+ * start command. Returns the rank the actor was started on
+ **/
+static int createActor(enum ActorType type, int *payload, int payload_length)
+{
+    return startWorkerProcess(type, payload, payload_length);
+}
+
+/**
+ * The number of vehicle actors started by main, every vehicle rank unless they are elastic, in which case the rest
+ * are left for control to start. When restarting there are at least enough to hold every vehicle in the checkpoint
+ **/
+static int initialVehicleActors()
+{
+    int initial = size - first_vehicle_rank;
+    if (run_options.elastic)
+    {
+        initial = initial * INITIAL_VEHICLE_ACTORS_PERCENT / 100;
+    }
+    int restart = restartVehicleActors();
+    if (restart > initial)
+    {
+        initial = restart;
+    }
+    return initial > 0 ? initial : 1;
+}
+
+/**
+ * The fewest vehicle actors that can hold all the vehicles of the checkpoint being restarted from, or zero if not
+ * restarting (or the checkpoint can not be read, which the vehicle actors report)
+ **/
+static int restartVehicleActors()
 {
-    int data[1];
-    int workerPid = startWorkerProcess();
-    data[0] = type;
-    MPI_Send(data, 1, MPI_INT, workerPid, 0, MPI_COMM_WORLD);
+    struct CheckpointHeader header;
+    if (run_options.restart_filename == NULL || !readCheckpointHeader(run_options.restart_filename, &header))
+    {
+        return 0;
+    }
+    int count = countCheckpointVehicles(run_options.restart_filename, header.elapsed_mins, header.num_parts);
+    return count > 0 ? (count + MAX_VEHICLES - 1) / MAX_VEHICLES : 0;
 }
 
 static void workerCode()
 {
-    int workerStatus = 1, data[1];
+    int workerStatus = 1, payload[PP_MAX_PAYLOAD], actors_run = 0;
     while (workerStatus)
     {
-        int parentId = getCommandData();
-        MPI_Recv(data, 1, MPI_INT, parentId, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        if (data[0] == 0)
+        int actorType = getActorType();
+        int payload_length = getCommandPayload(payload);
+        instrumentSetActor(actorType);
+        // Each actor this rank runs gets its own stream, so the draws do not depend on what ran here before it
+        random_stream.key = randomKey(run_options.seed, rank, ++actors_run);
+        random_stream.counter = 0;
+        if (actorType == CONTROL_ACTOR)
         {
             control();
         }
-        else if (data[0] == 1)
+        else if (actorType == ROADJUNCTION_ACTOR)
         {
             RoadJunction();
         }
-        else if (data[0] == 2)
+        else if (actorType == VEHICLE_ACTOR || actorType == ELASTIC_VEHICLE_ACTOR)
         {
-            Vehicle();
+            // Elastic vehicle actors start without any vehicles of their own
+            if (payload_length >= 3)
+            {
+                Vehicle(payload[0], payload[1], payload[2]);
+            }
+            else
+            {
+                Vehicle(0, 0, 0);
+            }
+        }
+        else if (actorType == ROUTING_ACTOR)
+        {
+            RouteService();
         }
         workerStatus = workerSleep();
     }
@@ -93,20 +357,110 @@ static void control()
     time_t start_seconds = getCurrentSeconds(); // Capture the start time
     int elapsed_mins = 0;                       // Counter for elapsed minutes in the simulation
 
-    // Update the total vehicles
-    total_vehicles += INITIAL_VEHICLES; // Increment the total vehicle count by the initial vehicles
+    printf("Random seed is: %llu\n", run_options.seed);
+    if (run_options.live_metrics_name != NULL)
+    {
+        liveMetricsOpen(run_options.live_metrics_name, run_options.seed, ensemble_member);
+    }
 
-    MPI_Status status; // Status variable for MPI operations
-    // Main loop to continue until the maximum minutes are reached
+    // The checkpoint written last, its parts are removed once a newer one has been written
+    int checkpoint_mins = -1, checkpoint_parts = 0;
+    if (run_options.restart_filename != NULL)
+    {
+        // Carry on from the checkpoint, the vehicle actors pick up its vehicles between them
+        struct CheckpointHeader header;
+        if (!readCheckpointHeader(run_options.restart_filename, &header))
+        {
+            fprintf(stderr, "Error: Can not read the checkpoint '%s'\n", run_options.restart_filename);
+            exit(-1);
+        }
+        elapsed_mins = header.elapsed_mins;
+        total_vehicles = header.total_vehicles;
+        passengers_delivered = header.passengers_delivered;
+        passengers_stranded = header.passengers_stranded;
+        vehicles_crashed = header.vehicles_crashed;
+        vehicles_exhausted_fuel = header.vehicles_exhausted_fuel;
+        random_stream = header.random;
+        if (run_options.checkpoint_filename != NULL && strcmp(run_options.checkpoint_filename, run_options.restart_filename) == 0)
+        {
+            checkpoint_mins = header.elapsed_mins;
+            checkpoint_parts = header.num_parts;
+        }
+        printf("Restarted from %s after %d mins with %d vehicles\n", run_options.restart_filename, elapsed_mins,
+               total_vehicles);
+    }
+    else
+    {
+        // Update the total vehicles
+        total_vehicles += run_options.initial_vehicles; // Increment the total vehicle count by the initial vehicles
+    }
+
+    // The vehicle actors started by main are on the ranks straight after roadjunction and the routing actors
+    int max_vehicle_actors = size - first_vehicle_rank; // Most vehicle actors there can be (excluding the reserved ranks)
+    vehicle_actors = (struct VehicleActor *)malloc(sizeof(struct VehicleActor) * max_vehicle_actors);
+    num_vehicle_actors = 0;
+    for (int i = 0; i < initialVehicleActors(); i++)
+    {
+        addVehicleActor(i + first_vehicle_rank, 0);
+    }
+    int actors_changed = 1, pending_sleep = 0, scaled = 0;
+    // The fewest and most vehicle actors any tick ran on, which only differ with --elastic
+    int fewest_vehicle_actors = num_vehicle_actors, most_vehicle_actors = num_vehicle_actors;
+    // Roadjunction's publications of the road speeds so far, the tick of the last one, those brought forward by the
+    // occupancy drifting and the drift the vehicle actors reported last tick
+    int publications = 0, last_publication = 0, early_publications = 0, drift = 0;
+
+    // The vehicle actors are arranged into a tree, control only talks to the actors leading each node (and they in
+    // turn to the others) so the commands and results are held in the tree's pre-order, with each child's subtree
+    // a contiguous slice. The same messages flow every tick, so set up persistent requests once (and again only
+    // when vehicle actors are started or put back to sleep): the commands to roadjunction and control's children
+    // come first (so they can be started on their own to stop the actors), followed by the completion message
+    // from roadjunction and the results from control's children
+    int num_requests = 0;
+    int *commands = (int *)malloc(sizeof(int) * TICK_COMMAND_LEN * (max_vehicle_actors + 1));
+    int *results = (int *)malloc(sizeof(int) * TICK_RESULTS_LEN * max_vehicle_actors);
+    int *actor_ranks = (int *)malloc(sizeof(int) * max_vehicle_actors);
+    int finished_Road = 0;
+    MPI_Request *requests = (MPI_Request *)malloc(sizeof(MPI_Request) * 2 * (max_vehicle_actors + 1));
+    MPI_Request *tree_requests = (MPI_Request *)malloc(sizeof(MPI_Request) * max_vehicle_actors);
+    for (int i = 0; i < max_vehicle_actors; i++)
+    {
+        tree_requests[i] = MPI_REQUEST_NULL;
+    }
 
     // record the time
     int round = 0;
-    double total_time = 0.0, start_time, end_time;
+    double total_time = 0.0, window_time = 0.0, start_time, end_time, startup_time = 0.0;
 
-    while (elapsed_mins < MAX_MINS)
+    // Main loop to continue until the maximum minutes are reached
+    while (elapsed_mins < run_options.max_mins)
     {
         // record the start time
         start_time = MPI_Wtime();
+        if (round == 0)
+        {
+            startup_time = start_time - program_start_time;
+        }
+        instrumentBegin(INSTR_CONTROL_TICK);
+
+        if (actors_changed)
+        {
+            // Rearrange the tree, rebuild the persistent requests and tell roadjunction which ranks now run vehicle actors
+            freeRequests(requests, num_requests);
+            buildControlTree();
+            for (int i = 0; i < num_vehicle_actors; i++)
+            {
+                actor_ranks[i] = vehicle_actors[i].rank;
+            }
+            num_requests = initControlRequests(requests, commands, results, &finished_Road);
+            sendControlTree(tree_requests);
+        }
+
+        int minute_passed = 0, checkpoint = 0;
+        for (int i = 0; i <= num_vehicle_actors; i++)
+        {
+            commands[i * TICK_COMMAND_LEN + CMD_NEW_VEHICLES] = 0;
+        }
 
         time_t current_seconds = getCurrentSeconds(); // Get the current time in seconds
         // Check if a second has passed
@@ -120,229 +474,786 @@ static void control()
                 if ((seconds - start_seconds) % MIN_LENGTH_SECONDS == 0)
                 {
                     elapsed_mins++; // Increment the elapsed minutes
-                    // Ask roadjunction to randomly generate vehicles
+                    minute_passed = 1;
+                    // Ask the vehicle processes to randomly generate vehicles
                     int total_new_vehicles = getRandomInteger(100, 200); // Random number of vehicles to create
-                    int participating_processes = size - 3;              // Number of processes participating (excluding 3 reserved ranks)
-
-                    // Determine the number of vehicles for each process to create
-                    int vehicles_per_process = total_new_vehicles / participating_processes;
-                    int extra_vehicles = total_new_vehicles % participating_processes;
-
-                    // Distribute vehicle creation tasks among the processes
-                    for (int i = 3; i < size; i++)
-                    {
-                        int vehicles_to_create = vehicles_per_process + (i - 3 < extra_vehicles);
-                        MPI_Send(&vehicles_to_create, 1, MPI_INT, i, RANDOM_CREATE_TAG, MPI_COMM_WORLD);
-                    }
-
-                    // Receive the number of vehicles created by each process
-                    int total_created_vehicles = 0;
-                    for (int i = 3; i < size; i++)
-                    {
-                        int created_vehicles = 0;
-                        MPI_Recv(&created_vehicles, 1, MPI_INT, i, VEHICLE_CREATED_TAG, MPI_COMM_WORLD, &status);
-                        total_created_vehicles += created_vehicles;
-                    }
-                    // Update total vehicles count
-                    total_vehicles += total_created_vehicles;
-
-                    // Print summary information every SUMMARY_FREQUENCY minutes
-                    if (elapsed_mins % SUMMARY_FREQUENCY == 0)
-                    {
-                        printf("[Time: %d mins] %d vehicles, %d passengers delivered, %d stranded passengers, %d crashed vehicles, %d vehicles exhausted fuel\n",
-                               elapsed_mins, total_vehicles, passengers_delivered, passengers_stranded, vehicles_crashed, vehicles_exhausted_fuel);
-                    }
+
+                    // Distribute vehicle creation tasks among the processes, these go out with this tick's command
+                    splitNewVehicles(total_new_vehicles, commands);
+                    // Snapshot the simulation at the end of this tick, once every vehicle has been updated
+                    checkpoint = run_options.checkpoint_filename != NULL && elapsed_mins % run_options.checkpoint_every == 0;
                 }
             }
         }
 
-        // Command roadjunction to update each intersection
-        MPI_Send(&elapsed_mins, 1, MPI_INT, ROADJUNCTION_RANK, UPDATE_JUNCTION_TAG, MPI_COMM_WORLD);
-        // Wait for the completion message from roadjunction
-        int finished_Road = 0;
-        MPI_Recv(&finished_Road, 1, MPI_INT, ROADJUNCTION_RANK, FINISHED_UPDATED_JUNCTION_TAG, MPI_COMM_WORLD, &status);
+        // The road speeds are published every --sync-every ticks, or sooner if the vehicles have moved around enough
+        // since the last time. They always are when the vehicle actors change, as new ones start at free flow speeds
+        int publish = actors_changed || round - last_publication >= run_options.sync_every;
+        if (!publish && run_options.sync_drift > 0 && drift >= run_options.sync_drift)
+        {
+            publish = 1;
+            early_publications++;
+        }
+
+        for (int i = 0; i <= num_vehicle_actors; i++)
+        {
+            int *command = &commands[i * TICK_COMMAND_LEN];
+            command[CMD_ELAPSED_MINS] = elapsed_mins;
+            command[CMD_STOP] = 0;
+            command[CMD_NUM_VEHICLE_RANKS] = num_vehicle_actors;
+            command[CMD_RANKS_CHANGED] = actors_changed;
+            command[CMD_MIGRATE_TO] = -1;
+            command[CMD_MIGRATE_COUNT] = 0;
+            command[CMD_MIGRATE_FROM] = 0;
+            command[CMD_RETIRE] = 0;
+            command[CMD_CHECKPOINT] = checkpoint ? i : 0;
+            command[CMD_PUBLICATIONS] = publications;
+            command[CMD_PUBLISH] = publish;
+            if (i > 0)
+            {
+                // Pass on any vehicle migrations planned for this vehicle process
+                struct VehicleActor *actor = &vehicle_actors[i - 1];
+                command[CMD_MIGRATE_TO] = actor->migrate_to;
+                command[CMD_MIGRATE_COUNT] = actor->migrate_count;
+                command[CMD_MIGRATE_FROM] = actor->migrate_from;
+                command[CMD_RETIRE] = actor->retire;
+                actor->migrate_to = -1;
+                actor->migrate_count = 0;
+                actor->migrate_from = 0;
+            }
+        }
+        if (publish)
+        {
+            publications++;
+            last_publication = round;
+        }
+
+        // Command roadjunction to update each intersection and the vehicle processes to update their vehicles (the
+        // commands fan out down the tree), then wait for the completion message from roadjunction and the updated
+        // results from the vehicle processes (which are gathered back up the tree)
+        MPI_Startall(num_requests, requests);
+        instrumentMessages(UPDATE_JUNCTION_TAG, 1, sizeof(int) * TICK_COMMAND_LEN);
+        instrumentMessages(UPDATE_VEHICLES_TAG, num_requests / 2 - 1, sizeof(int) * TICK_COMMAND_LEN * num_vehicle_actors);
+        if (actors_changed)
+        {
+            MPI_Send(actor_ranks, num_vehicle_actors, MPI_INT, ROADJUNCTION_RANK, VEHICLE_RANKS_TAG, sim_comm);
+            instrumentMessages(VEHICLE_RANKS_TAG, 1, sizeof(int) * num_vehicle_actors);
+            actors_changed = 0;
+        }
+        instrumentBegin(INSTR_CONTROL_WAIT);
+        MPI_Waitall(num_requests, requests, MPI_STATUSES_IGNORE);
+        MPI_Waitall(max_vehicle_actors, tree_requests, MPI_STATUSES_IGNORE);
+        instrumentEnd(INSTR_CONTROL_WAIT);
+
+        // Aggregate results from the vehicle processes
+        drift = 0;
+        for (int i = 0; i < num_vehicle_actors; i++)
+        {
+            int *data = &results[i * TICK_RESULTS_LEN];
+            vehicles_exhausted_fuel += data[RES_EXHAUSTED_FUEL];
+            passengers_stranded += data[RES_PASSENGERS_STRANDED];
+            vehicles_crashed += data[RES_VEHICLES_CRASHED];
+            passengers_delivered += data[RES_PASSENGERS_DELIVERED];
+            // Update total vehicles count
+            total_vehicles += data[RES_VEHICLES_CREATED];
+            vehicle_actors[i].load = data[RES_ACTIVE_VEHICLES];
+            vehicle_actors[i].update_usecs = data[RES_UPDATE_USECS];
+            vehicle_actors[i].window_update_time += data[RES_UPDATE_USECS] / 1e6;
+            vehicle_actors[i].window_updates += data[RES_ACTIVE_VEHICLES];
+            checkpoint = checkpoint && !data[RES_CHECKPOINT_FAILED];
+            drift += data[RES_OCCUPANCY_DRIFT];
+        }
+
+        if (checkpoint)
+        {
+            // Every vehicle actor has written its part, so the checkpoint can now name them
+            writeCheckpoint(elapsed_mins, &checkpoint_mins, &checkpoint_parts);
+        }
+        else if (minute_passed && run_options.checkpoint_filename != NULL && elapsed_mins % run_options.checkpoint_every == 0)
+        {
+            fprintf(stderr, "Warning: A vehicle actor could not write its part of the checkpoint after %d mins, keeping the previous one\n", elapsed_mins);
+        }
+
+        // Vehicle actors that have handed over their vehicles have now gone back to sleep
+        for (int i = 0; i < num_vehicle_actors; i++)
+        {
+            if (vehicle_actors[i].retire)
+            {
+                vehicle_actors[i] = vehicle_actors[--num_vehicle_actors];
+                actors_changed = 1;
+                i--;
+            }
+        }
+
+        // Print summary information every SUMMARY_FREQUENCY minutes
+        if (minute_passed && elapsed_mins % SUMMARY_FREQUENCY == 0)
+        {
+            printf("[Time: %d mins] %d vehicles, %d passengers delivered, %d stranded passengers, %d crashed vehicles, %d vehicles exhausted fuel\n",
+                   elapsed_mins, total_vehicles, passengers_delivered, passengers_stranded, vehicles_crashed, vehicles_exhausted_fuel);
+        }
+
+        // record the end time
+        end_time = MPI_Wtime();
+        instrumentEnd(INSTR_CONTROL_TICK);
+        // increment the total time
+        total_time += (end_time - start_time);
+        window_time += (end_time - start_time);
+        round++;
+        fewest_vehicle_actors = num_vehicle_actors < fewest_vehicle_actors ? num_vehicle_actors : fewest_vehicle_actors;
+        most_vehicle_actors = num_vehicle_actors > most_vehicle_actors ? num_vehicle_actors : most_vehicle_actors;
+        publishLiveMetrics(elapsed_mins, round, end_time - start_time);
+
+        // 每隔100轮输出平均时间
+        if (round % 100 == 0 || round % 50 == 0)
+        {
+            printf("After %d loops, average time per loop is: %f seconds\n", round, total_time / round);
+        }
+
+        // Periodically check whether the vehicle processes are overloaded or have capacity to spare
+        if (run_options.elastic && round % ELASTIC_CHECK_INTERVAL == 0)
+        {
+            // A rank put to sleep at the last check has had a whole interval to get back into the pool
+            int idle_ranks = max_vehicle_actors - num_vehicle_actors - pending_sleep;
+            pending_sleep = 0;
+            int change = scaleVehicleActors(window_time / ELASTIC_CHECK_INTERVAL, idle_ranks);
+            if (change > 0)
+            {
+                actors_changed = 1;
+            }
+            else if (change < 0)
+            {
+                pending_sleep = 1;
+            }
+            window_time = 0.0;
+            scaled = change != 0;
+        }
+
+        // Periodically even out the cost of the vehicle updates, unless actors have just been started or put to sleep
+        if (round % LOAD_BALANCE_INTERVAL == 0)
+        {
+            if (!scaled)
+            {
+                balanceVehicleLoad();
+            }
+            scaled = 0;
+        }
+    }
+    // Send the stop command to roadjunction and all vehicle processes, the vehicle processes then do the final write
+    if (actors_changed)
+    {
+        // The last tick changed the vehicle actors, so the tree needs to cover the remaining ones for the stop to reach them
+        freeRequests(requests, num_requests);
+        buildControlTree();
+        num_requests = initControlRequests(requests, commands, results, &finished_Road);
+        sendControlTree(tree_requests);
+    }
+    for (int i = 0; i <= num_vehicle_actors; i++)
+    {
+        commands[i * TICK_COMMAND_LEN + CMD_STOP] = 1;
+        commands[i * TICK_COMMAND_LEN + CMD_NUM_VEHICLE_RANKS] = num_vehicle_actors;
+        commands[i * TICK_COMMAND_LEN + CMD_RANKS_CHANGED] = i > 0 && actors_changed;
+    }
+    MPI_Startall(num_requests / 2, requests);
+    MPI_Waitall(num_requests / 2, requests, MPI_STATUSES_IGNORE);
+    MPI_Waitall(max_vehicle_actors, tree_requests, MPI_STATUSES_IGNORE);
+    // Every tick's routes have been answered, so the routing actors can stop once they have had every publication
+    for (int i = 0; i < routing_settings.num_actors; i++)
+    {
+        MPI_Send(&publications, 1, MPI_INT, ROADJUNCTION_RANK + 1 + i, ROUTE_STOP_TAG, sim_comm);
+    }
+    freeRequests(requests, num_requests);
+    free(requests);
+    free(tree_requests);
+    free(commands);
+    free(results);
+    free(actor_ranks);
+    free(vehicle_actors);
+    liveMetricsClose();
+
+    // Final summary printout
+    printf("Finished after %d mins: %d vehicles, %d passengers delivered, %d passengers stranded, %d crashed vehicles, %d vehicles exhausted fuel\n",
+           elapsed_mins, total_vehicles, passengers_delivered, passengers_stranded, vehicles_crashed, vehicles_exhausted_fuel);
+    // Kept for the ensemble report, which main prints once every member has finished
+    int totals[ENSEMBLE_TOTALS_LEN] = {1, elapsed_mins, total_vehicles, passengers_delivered, passengers_stranded,
+                                       vehicles_crashed, vehicles_exhausted_fuel};
+    memcpy(ensemble_totals, totals, sizeof(totals));
+
+    // Print the total time taken for the simulation
+    printf("Total time for %d loops is: %f seconds\n", round, total_time);
+    printf("Average time per loop is: %f seconds\n", total_time / round);
+    printf("Startup time is: %f seconds\n", startup_time);
+    printf("Vehicle actors: %d to %d\n", fewest_vehicle_actors, most_vehicle_actors);
+    if (run_options.sync_every > 1 || run_options.sync_drift > 0)
+    {
+        printf("[Sync] Road speeds published on %d of %d ticks (every %d ticks, %d brought forward by drift), %.1f ticks per second\n",
+               publications, round, run_options.sync_every, early_publications, round / total_time);
+    }
+
+    // Shut down the MPI worker pool before exiting
+    shutdownPool();
+}
+
+/**
+ * Copies the totals and each vehicle actor's load in the tick just finished to the live metrics segment, if there is
+ * one, for metrics_tail or anything else on the node to read without getting in control's way
+ **/
+static void publishLiveMetrics(int elapsed_mins, int round, double tick_time)
+{
+    struct LiveMetrics *metrics = liveMetricsBegin();
+    if (metrics == NULL)
+    {
+        return;
+    }
+    metrics->elapsed_mins = elapsed_mins;
+    metrics->ticks = round;
+    metrics->total_vehicles = total_vehicles;
+    metrics->passengers_delivered = passengers_delivered;
+    metrics->passengers_stranded = passengers_stranded;
+    metrics->vehicles_crashed = vehicles_crashed;
+    metrics->vehicles_exhausted_fuel = vehicles_exhausted_fuel;
+    metrics->num_actors = num_vehicle_actors < LIVE_METRICS_MAX_ACTORS ? num_vehicle_actors : LIVE_METRICS_MAX_ACTORS;
+    for (int i = 0; i < metrics->num_actors; i++)
+    {
+        metrics->actors[i].rank = vehicle_actors[i].rank;
+        metrics->actors[i].vehicles = vehicle_actors[i].load;
+        metrics->actors[i].update_usecs = vehicle_actors[i].update_usecs;
+    }
+    liveMetricsEnd(metrics, tick_time);
+}
+
+/**
+ * Writes the checkpoint taken at the end of this tick, naming the parts just written by the vehicle actors along with
+ * control's totals and random number stream, and then removes the parts of the previous checkpoint
+ **/
+static void writeCheckpoint(int elapsed_mins, int *checkpoint_mins, int *checkpoint_parts)
+{
+    struct CheckpointHeader header;
+    memset(&header, 0, sizeof(struct CheckpointHeader));
+    header.elapsed_mins = elapsed_mins;
+    header.num_parts = num_vehicle_actors;
+    header.total_vehicles = total_vehicles;
+    header.passengers_delivered = passengers_delivered;
+    header.passengers_stranded = passengers_stranded;
+    header.vehicles_crashed = vehicles_crashed;
+    header.vehicles_exhausted_fuel = vehicles_exhausted_fuel;
+    header.seed = run_options.seed;
+    header.random = random_stream;
+    header.saved_seconds = getCurrentSeconds();
+    if (!writeCheckpointHeader(run_options.checkpoint_filename, &header))
+    {
+        fprintf(stderr, "Warning: Can not write the checkpoint '%s', keeping the previous one\n", run_options.checkpoint_filename);
+        removeCheckpointParts(run_options.checkpoint_filename, elapsed_mins, num_vehicle_actors);
+        return;
+    }
+    if (*checkpoint_mins >= 0 && *checkpoint_mins != elapsed_mins)
+    {
+        removeCheckpointParts(run_options.checkpoint_filename, *checkpoint_mins, *checkpoint_parts);
+    }
+    *checkpoint_mins = elapsed_mins;
+    *checkpoint_parts = num_vehicle_actors;
+    printf("Checkpoint written to %s after %d mins\n", run_options.checkpoint_filename, elapsed_mins);
+}
+
+/**
+ * Sets up control's persistent requests, the tick commands to roadjunction and each of control's children in the
+ * tree come first and are followed by the matching receives of the junction completion message and the children's
+ * results. A child's commands and results cover its whole subtree. Returns the number of requests
+ **/
+static int initControlRequests(MPI_Request *requests, int *commands, int *results, int *finished_Road)
+{
+    int num_children = 0;
+    MPI_Send_init(commands, TICK_COMMAND_LEN, MPI_INT, ROADJUNCTION_RANK, UPDATE_JUNCTION_TAG, sim_comm, &requests[0]);
+    for (int i = 0; i < num_vehicle_actors; i++)
+    {
+        if (vehicle_actors[i].tree.parent == CONTROL_RANK)
+        {
+            MPI_Send_init(&commands[(i + 1) * TICK_COMMAND_LEN], TICK_COMMAND_LEN * vehicle_actors[i].tree.subtree_size, MPI_INT,
+                          vehicle_actors[i].rank, UPDATE_VEHICLES_TAG, sim_comm, &requests[++num_children]);
+        }
+    }
+    MPI_Recv_init(finished_Road, 1, MPI_INT, ROADJUNCTION_RANK, FINISHED_UPDATED_JUNCTION_TAG, sim_comm, &requests[num_children + 1]);
+    for (int i = 0, child = 0; i < num_vehicle_actors; i++)
+    {
+        if (vehicle_actors[i].tree.parent == CONTROL_RANK)
+        {
+            MPI_Recv_init(&results[i * TICK_RESULTS_LEN], TICK_RESULTS_LEN * vehicle_actors[i].tree.subtree_size, MPI_INT,
+                          vehicle_actors[i].rank, UPDATED_RESULTS_TAG, sim_comm, &requests[num_children + 2 + child++]);
+        }
+    }
+    return 2 * (num_children + 1);
+}
+
+/**
+ * Orders vehicle actors by the node they are on and then by rank
+ **/
+static int compareVehicleActors(const void *a, const void *b)
+{
+    const struct VehicleActor *actor_a = (const struct VehicleActor *)a, *actor_b = (const struct VehicleActor *)b;
+    if (rank_node[actor_a->rank] != rank_node[actor_b->rank])
+        return rank_node[actor_a->rank] - rank_node[actor_b->rank];
+    return actor_a->rank - actor_b->rank;
+}
+
+/**
+ * Arranges the vehicle actors into the tree that control's commands fan out down and results are gathered up. The
+ * lowest rank on each node leads it, the node leaders form a CONTROL_TREE_FANOUT-ary tree under control and the
+ * other actors on a node form a CONTROL_TREE_FANOUT-ary tree under their leader, so the depth grows logarithmically
+ * with both the number of nodes and the actors per node. The vehicle actors are reordered into the tree's pre-order
+ * (so every subtree is contiguous) and each one's place in the tree is filled in
+ **/
+static void buildControlTree()
+{
+    int n = num_vehicle_actors, root = n;
+    qsort(vehicle_actors, n, sizeof(struct VehicleActor), compareVehicleActors);
+
+    // Child lists over indices into the sorted actors, with the index n standing for control
+    int *parent = (int *)malloc(sizeof(int) * (n + 1));
+    int *num_children = (int *)calloc(n + 1, sizeof(int));
+    int *children = (int *)malloc(sizeof(int) * (n + 1) * CONTROL_TREE_MAX_CHILDREN);
+    int *leaders = (int *)malloc(sizeof(int) * n);
+    int num_leaders = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (i == 0 || rank_node[vehicle_actors[i].rank] != rank_node[vehicle_actors[i - 1].rank])
+            leaders[num_leaders++] = i;
+    }
+    for (int l = 0; l < num_leaders; l++)
+    {
+        // Node leaders form a heap under control
+        int p = l < CONTROL_TREE_FANOUT ? root : leaders[l / CONTROL_TREE_FANOUT - 1];
+        parent[leaders[l]] = p;
+        children[p * CONTROL_TREE_MAX_CHILDREN + num_children[p]++] = leaders[l];
+
+        // The rest of the node forms a heap under its leader
+        int first = leaders[l] + 1;
+        int last = l + 1 < num_leaders ? leaders[l + 1] : n;
+        for (int m = 0; first + m < last; m++)
+        {
+            p = m < CONTROL_TREE_FANOUT ? leaders[l] : first + m / CONTROL_TREE_FANOUT - 1;
+            parent[first + m] = p;
+            children[p * CONTROL_TREE_MAX_CHILDREN + num_children[p]++] = first + m;
+        }
+    }
+
+    // Walk the tree in pre-order, then work out subtree sizes from the leaves up
+    int *order = (int *)malloc(sizeof(int) * (n + 1));
+    int *stack = (int *)malloc(sizeof(int) * (n + 1));
+    int *subtree_size = (int *)malloc(sizeof(int) * (n + 1));
+    int num_ordered = 0, stack_size = 0;
+    stack[stack_size++] = root;
+    while (stack_size > 0)
+    {
+        int v = stack[--stack_size];
+        order[num_ordered++] = v;
+        subtree_size[v] = 1;
+        for (int c = num_children[v] - 1; c >= 0; c--)
+            stack[stack_size++] = children[v * CONTROL_TREE_MAX_CHILDREN + c];
+    }
+    for (int k = n; k > 0; k--)
+        subtree_size[parent[order[k]]] += subtree_size[order[k]];
+
+    struct VehicleActor *ordered = (struct VehicleActor *)malloc(sizeof(struct VehicleActor) * n);
+    for (int k = 1; k <= n; k++)
+    {
+        int v = order[k];
+        struct VehicleActor *actor = &ordered[k - 1];
+        *actor = vehicle_actors[v];
+        actor->tree.parent = parent[v] == root ? CONTROL_RANK : vehicle_actors[parent[v]].rank;
+        actor->tree.subtree_size = subtree_size[v];
+        actor->tree.num_children = num_children[v];
+        for (int c = 0; c < num_children[v]; c++)
+        {
+            int child = children[v * CONTROL_TREE_MAX_CHILDREN + c];
+            actor->tree.children[c] = vehicle_actors[child].rank;
+            actor->tree.child_subtree_sizes[c] = subtree_size[child];
+        }
+    }
+    memcpy(vehicle_actors, ordered, sizeof(struct VehicleActor) * n);
+
+    free(ordered);
+    free(subtree_size);
+    free(stack);
+    free(order);
+    free(leaders);
+    free(children);
+    free(num_children);
+    free(parent);
+}
+
+/**
+ * Tells every vehicle actor where it now sits in control's tree, they receive this when their next command says
+ * the vehicle ranks have changed
+ **/
+static void sendControlTree(MPI_Request *tree_requests)
+{
+    for (int i = 0; i < num_vehicle_actors; i++)
+    {
+        MPI_Isend(&vehicle_actors[i].tree, sizeof(struct ControlTreeNode) / sizeof(int), MPI_INT, vehicle_actors[i].rank,
+                  VEHICLE_TREE_TAG, sim_comm, &tree_requests[i]);
+    }
+}
+
+/**
+ * Adds a vehicle actor running on the given rank to those control sends commands to
+ **/
+static void addVehicleActor(int actor_rank, char elastic)
+{
+    struct VehicleActor *actor = &vehicle_actors[num_vehicle_actors++];
+    actor->rank = actor_rank;
+    actor->load = 0;
+    actor->update_usecs = 0;
+    actor->elastic = elastic;
+    actor->retire = 0;
+    actor->migrate_to = -1;
+    actor->migrate_count = 0;
+    actor->migrate_from = 0;
+    actor->cost = 0.0;
+    actor->window_update_time = 0.0;
+    actor->window_updates = 0;
+}
+
+/**
+ * Splits the new vehicles between the vehicle processes so that those with the fewest active vehicles get the
+ * most, each vehicle goes to whichever process has the fewest once the ones already given to it are counted.
+ * Vehicle actors being put back to sleep do not take any new vehicles, and once every process is full the rest are
+ * not created
+ **/
+static void splitNewVehicles(int total_new_vehicles, int *commands)
+{
+    for (int n = 0; n < total_new_vehicles; n++)
+    {
+        int lightest = -1, lightest_load = 0;
+        for (int i = 0; i < num_vehicle_actors; i++)
+        {
+            int load = vehicle_actors[i].load + commands[(i + 1) * TICK_COMMAND_LEN + CMD_NEW_VEHICLES];
+            if (!vehicle_actors[i].retire && (lightest == -1 || load < lightest_load))
+            {
+                lightest = i;
+                lightest_load = load;
+            }
+        }
+        if (lightest == -1 || lightest_load >= MAX_VEHICLES)
+            break;
+        commands[(lightest + 1) * TICK_COMMAND_LEN + CMD_NEW_VEHICLES]++;
+    }
+}
+
+/**
+ * Plans vehicle migrations from the vehicle processes whose updates are taking the longest to those with time to
+ * spare. Each process's load is its active vehicles multiplied by the time it has measured per vehicle update over
+ * the last interval, so a slower rank is given fewer vehicles. A process more than LOAD_BALANCE_TOLERANCE above
+ * the average sends its excess to the process with the most room, and the migrations go out with the next tick's
+ * commands
+ **/
+static void balanceVehicleLoad()
+{
+    // Work out each process's cost per vehicle update, those that have not updated any vehicles use the average
+    double total_time = 0.0, total_updates = 0.0;
+    for (int i = 0; i < num_vehicle_actors; i++)
+    {
+        total_time += vehicle_actors[i].window_update_time;
+        total_updates += vehicle_actors[i].window_updates;
+    }
+    double average_cost = total_updates > 0 ? total_time / total_updates : 1.0;
+    if (average_cost <= 0.0)
+        average_cost = 1.0;
+    double total_load = 0.0;
+    for (int i = 0; i < num_vehicle_actors; i++)
+    {
+        struct VehicleActor *actor = &vehicle_actors[i];
+        actor->cost = actor->window_updates > 0 && actor->window_update_time > 0.0 ? actor->window_update_time / actor->window_updates : average_cost;
+        actor->window_update_time = 0.0;
+        actor->window_updates = 0;
+        total_load += actor->load * actor->cost;
+    }
+    double target = total_load / num_vehicle_actors;
+
+    // Each process can only send to one other in a tick, so the most overloaded are matched first
+    char *planned = (char *)calloc(num_vehicle_actors, sizeof(char));
+    while (1)
+    {
+        int sender = -1;
+        double sender_excess = 0.0;
+        for (int i = 0; i < num_vehicle_actors; i++)
+        {
+            double excess = vehicle_actors[i].load * vehicle_actors[i].cost - target;
+            if (!planned[i] && excess > target * LOAD_BALANCE_TOLERANCE && excess > sender_excess)
+            {
+                sender = i;
+                sender_excess = excess;
+            }
+        }
+        if (sender == -1)
+            break;
+        planned[sender] = 1;
+
+        int receiver = -1;
+        double receiver_room = 0.0;
+        for (int i = 0; i < num_vehicle_actors; i++)
+        {
+            double room = target - vehicle_actors[i].load * vehicle_actors[i].cost;
+            if (vehicle_actors[i].migrate_to == -1 && room > receiver_room)
+            {
+                receiver = i;
+                receiver_room = room;
+            }
+        }
+        if (receiver == -1)
+            break;
+
+        double moved = sender_excess < receiver_room ? sender_excess : receiver_room;
+        int count = (int)(moved / vehicle_actors[sender].cost);
+        // A slow sender's excess can be more vehicles than the receiver has slots for
+        if (count > MAX_VEHICLES - vehicle_actors[receiver].load)
+            count = MAX_VEHICLES - vehicle_actors[receiver].load;
+        if (count < LOAD_BALANCE_MIN_BATCH)
+            continue;
+        vehicle_actors[sender].migrate_to = vehicle_actors[receiver].rank;
+        vehicle_actors[sender].migrate_count = count;
+        vehicle_actors[receiver].migrate_from++;
+        // Count the vehicles as moved so the next match sees the new loads
+        vehicle_actors[sender].load -= count;
+        vehicle_actors[receiver].load += count;
+        planned[receiver] = 1;
+    }
+    free(planned);
+}
 
-        // Request vehicle status updates
-        for (int i = 3; i < size; i++)
-        {
-            MPI_Send(&elapsed_mins, 1, MPI_INT, i, UPDATE_VEHICLES_TAG, MPI_COMM_WORLD);
-        }
+/**
+ * Looks at the load of the vehicle processes and, if they are overloaded and there is an idle rank in the pool,
+ * starts another vehicle actor and plans for the busiest processes to hand it vehicles. If there is capacity to
+ * spare then instead the least loaded elastic vehicle actor is planned to hand its vehicles over and go back to
+ * sleep. The migrations go out with the next tick's commands. Returns one if an actor was started, minus one
+ * if one is being put back to sleep and zero otherwise
+ **/
+static int scaleVehicleActors(double average_tick_time, int idle_ranks)
+{
+    int total_load = 0, max_load = 0, quietest = -1;
+    for (int i = 0; i < num_vehicle_actors; i++)
+    {
+        total_load += vehicle_actors[i].load;
+        if (vehicle_actors[i].load > max_load)
+            max_load = vehicle_actors[i].load;
+        if (vehicle_actors[i].elastic && (quietest == -1 || vehicle_actors[i].load < vehicle_actors[quietest].load))
+            quietest = i;
+    }
 
-        // Receive updated results from the vehicle processes
-        for (int i = 3; i < size; i++)
+    if (idle_ranks > 0 && (max_load > ELASTIC_HIGH_LOAD || (average_tick_time > ELASTIC_MAX_TICK_TIME && max_load > ELASTIC_LOW_LOAD)))
+    {
+        int new_rank = createActor(ELASTIC_VEHICLE_ACTOR, NULL, 0);
+        addVehicleActor(new_rank, 1);
+        struct VehicleActor *started = &vehicle_actors[num_vehicle_actors - 1];
+        // Every process above the new average hands its excess to the new actor, as far as it has slots for them.
+        // The vehicles are counted as moved so the new vehicles are split by the loads after the migrations
+        int target = total_load / num_vehicle_actors;
+        for (int i = 0; i < num_vehicle_actors - 1; i++)
         {
-            int data[4];              // Buffer to hold received data
-            int finished_Vehicle = 0; // Flag to indicate vehicle status update is finished
-            // Receive the data from vehicle process
-            MPI_Recv(data, 4, MPI_INT, i, UPDATED_RESULTS_TAG, MPI_COMM_WORLD, &status);
-            if (status.MPI_SOURCE == i) // Check the source of the message
+            int count = vehicle_actors[i].load - target;
+            if (count > MAX_VEHICLES - started->load)
+                count = MAX_VEHICLES - started->load;
+            if (count > 0)
             {
-                // Aggregate results from the vehicle processes
-                vehicles_exhausted_fuel += data[0];
-                passengers_stranded += data[1];
-                vehicles_crashed += data[2];
-                passengers_delivered += data[3];
+                vehicle_actors[i].migrate_to = new_rank;
+                vehicle_actors[i].migrate_count = count;
+                vehicle_actors[i].load -= count;
+                started->load += count;
+                started->migrate_from++;
             }
-            // Wait for the completion message from vehicle
-            MPI_Recv(&finished_Vehicle, 1, MPI_INT, i, FINISHED_UPDATED_VEHICLES_TAG, MPI_COMM_WORLD, &status);
         }
+        printf("[Elastic] Started vehicle actor on rank %d (busiest rank has %d vehicles, average time per loop %f seconds)\n",
+               new_rank, max_load, average_tick_time);
+        return 1;
+    }
 
-        // record the end time
-        end_time = MPI_Wtime();
-        // increment the total time
-        total_time += (end_time - start_time);
-        round++;
-
-        // 每隔100轮输出平均时间
-        if (round % 100 == 0 || round % 50 == 0)
+    if (quietest != -1 && total_load / (num_vehicle_actors - 1) < ELASTIC_LOW_LOAD && average_tick_time < ELASTIC_MAX_TICK_TIME)
+    {
+        // Hand everything to the least loaded of the remaining processes, unless it has no slots for them all
+        int receiver = -1;
+        for (int i = 0; i < num_vehicle_actors; i++)
         {
-            printf("After %d loops, average time per loop is: %f seconds\n", round, total_time / round);
+            if (i != quietest && (receiver == -1 || vehicle_actors[i].load < vehicle_actors[receiver].load))
+                receiver = i;
         }
+        if (vehicle_actors[receiver].load + vehicle_actors[quietest].load > MAX_VEHICLES)
+            return 0;
+        vehicle_actors[quietest].retire = 1;
+        vehicle_actors[quietest].migrate_to = vehicle_actors[receiver].rank;
+        vehicle_actors[quietest].migrate_count = vehicle_actors[quietest].load;
+        vehicle_actors[receiver].migrate_from++;
+        vehicle_actors[receiver].load += vehicle_actors[quietest].load;
+        vehicle_actors[quietest].load = 0;
+        printf("[Elastic] Putting vehicle actor on rank %d back to sleep (%d vehicles across %d ranks)\n",
+               vehicle_actors[quietest].rank, total_load, num_vehicle_actors);
+        return -1;
     }
-    // Send a final write command to all vehicle processes
-    for (int i = 3; i < size; i++)
-    {
-        int final_write = 1;
-        MPI_Send(&final_write, 1, MPI_INT, i, FILE_WRITE_TAG, MPI_COMM_WORLD);
-    }
-
-    // Final summary printout
-    printf("Finished after %d mins: %d vehicles, %d passengers delivered, %d passengers stranded, %d crashed vehicles, %d vehicles exhausted fuel\n",
-           elapsed_mins, total_vehicles, passengers_delivered, passengers_stranded, vehicles_crashed, vehicles_exhausted_fuel);
-
-    // Print the total time taken for the simulation
-    printf("Total time for %d loops is: %f seconds\n", round, total_time);
-    printf("Average time per loop is: %f seconds\n", total_time / round);
-
-    // Shut down the MPI worker pool before exiting
-    shutdownPool();
+    return 0;
 }
 
 static void RoadJunction()
 {
     // Load the road map from the file
+    instrumentBegin(INSTR_LOAD_MAP);
+    perfRegionBegin(PERF_LOAD_MAP);
     loadRoadMap(map_filename);
+    perfRegionEnd(PERF_LOAD_MAP, 1);
+    instrumentEnd(INSTR_LOAD_MAP);
+
+    // Persistent requests for the per-tick pattern: the command from control, the road occupancy from each vehicle
+    // process and the completion message. The requests to the vehicle processes are set up once control has said
+    // which ranks they are on. The road speeds and traffic lights published to each vehicle process change length
+    // from tick to tick, so are sent with nonblocking sends
+    int max_vehicle_actors = size - first_vehicle_rank, num_actors = 0;
+    int command[TICK_COMMAND_LEN], finished = 1;
+    int *actor_ranks = (int *)malloc(sizeof(int) * max_vehicle_actors);
+    int *occupancy = (int *)malloc(sizeof(int) * num_roads * max_vehicle_actors);
+    int *published = (int *)malloc(sizeof(int) * (num_roads + num_junctions));
+    MPI_Request command_request, finished_request;
+    MPI_Request *occupancy_requests = (MPI_Request *)malloc(sizeof(MPI_Request) * max_vehicle_actors);
+    MPI_Request *publish_requests = (MPI_Request *)malloc(sizeof(MPI_Request) * max_vehicle_actors);
+    MPI_Recv_init(command, TICK_COMMAND_LEN, MPI_INT, CONTROL_RANK, UPDATE_JUNCTION_TAG, sim_comm, &command_request);
+    MPI_Send_init(&finished, 1, MPI_INT, CONTROL_RANK, FINISHED_UPDATED_JUNCTION_TAG, sim_comm, &finished_request);
+    // The routing actors are there for the whole run and get the same publication as the vehicle processes
+    int num_routing = routing_settings.num_actors;
+    MPI_Request *routing_requests = (MPI_Request *)malloc(sizeof(MPI_Request) * (num_routing + 1));
+    // Only what has changed since the last tick is published, so keep what every actor was last sent. A vehicle actor
+    // that has just been started has the free flow speeds, so the whole table goes out whenever the ranks change
+    int *last_published = (int *)malloc(sizeof(int) * (num_roads + num_junctions));
+    int *publication = (int *)malloc(sizeof(int) * (num_roads + num_junctions + 1));
+    for (int i = 0; i < num_junctions; i++)
+    {
+        last_published[num_roads + i] = roadMap[i].trafficLightsRoadEnabled;
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            last_published[roadMap[i].roads[j].id] = roadMap[i].roads[j].currentSpeed;
+        }
+    }
+    long delta_publications = 0, full_publications = 0, published_ints = 0;
+    // How far the speeds the actors were moving on were from the recomputed ones, summed over the roads
+    long speed_deviation = 0;
+    int max_speed_deviation = 0;
 
     while (1)
     {
-
-        MPI_Status status;
-        int flag1 = 0;
-        // Check if there's a message from control to update junctions
-        MPI_Iprobe(CONTROL_RANK, UPDATE_JUNCTION_TAG, MPI_COMM_WORLD, &flag1, &status);
-        if (flag1)
+        // Wait for the command from control to update junctions
+        MPI_Start(&command_request);
+        MPI_Wait(&command_request, MPI_STATUS_IGNORE);
+        if (command[CMD_STOP])
         {
-            int elapsed_mins = 0;
-            // Receive the elapsed minutes from control
-            MPI_Recv(&elapsed_mins, 1, MPI_INT, CONTROL_RANK, UPDATE_JUNCTION_TAG, MPI_COMM_WORLD, &status);
-            // If the message was from control, proceed to update
+            // Break out of the loop to terminate the road junction process
+            break;
+        }
+        int elapsed_mins = command[CMD_ELAPSED_MINS];
 
-            if (status.MPI_SOURCE == CONTROL_RANK)
+        if (command[CMD_RANKS_CHANGED])
+        {
+            // Vehicle actors have been started or put to sleep, so rebuild the requests for the current set
+            freeRequests(occupancy_requests, num_actors);
+            num_actors = command[CMD_NUM_VEHICLE_RANKS];
+            MPI_Recv(actor_ranks, num_actors, MPI_INT, CONTROL_RANK, VEHICLE_RANKS_TAG, sim_comm, MPI_STATUS_IGNORE);
+            for (int count = 0; count < num_actors; count++)
             {
-                // Inform vehicles to begin road updates
-                for (int count = 3; count < size; count++)
-                {
-                    int begin = 1;
-                    MPI_Send(&begin, 1, MPI_INT, count, BEGIN_ROADS_UPDATE_TAG, MPI_COMM_WORLD);
-                }
-
-                // Loop through all junctions to update their status
-                for (int i = 0; i < num_junctions; i++)
-                {
-                    // Signal the start of a junction update to vehicles
-                    for (int count = 3; count < size; count++)
-                    {
-                        int loop_begin = 1;
-                        MPI_Send(&loop_begin, 1, MPI_INT, count, LOOP_BEGIN_TAG, MPI_COMM_WORLD);
-                    }
-
-                    // Check and update traffic lights if necessary
-                    if (roadMap[i].hasTrafficLights && roadMap[i].num_roads > 0)
-                    {
-                        for (int count = 3; count < size; count++)
-                        {
-                            roadMap[i].trafficLightsRoadEnabled = elapsed_mins % roadMap[i].num_roads;
-                            int data[2] = {i, roadMap[i].trafficLightsRoadEnabled};
-                            MPI_Send(data, 2, MPI_INT, count, TRAFFICLIGHT_ENABLED_TAG, MPI_COMM_WORLD);
-                        }
-                    }
-
-                    // Iterate over each road connected to the current junction
-                    for (int j = 0; j < roadMap[i].num_roads; j++)
-                    {
-                        struct RoadStruct *road = &roadMap[i].roads[j];
-                        int num_vehicles_on_road = 0;
-                        // Request updates for vehicles on this road from all vehicles
-                        for (int count = 3; count < size; count++)
-                        {
-                            for (int k = 0; k < MAX_VEHICLES; k++)
-                            {
-                                // Send road ID to vehicles to get status
-                                MPI_Send(&road->id, 1, MPI_INT, count, VEHICLE_INDEX_TAG, MPI_COMM_WORLD);
-                                int flag = 0;
-                                // Receive vehicle presence confirmation
-                                MPI_Recv(&flag, 1, MPI_INT, count, VEHICLE_INDEX_RETURN_ID_TAG, MPI_COMM_WORLD, &status);
-                                if (flag)
-                                    num_vehicles_on_road++;
-                            }
-                        }
-
-                        // Adjust road speed based on the number of vehicles (congestion)
-                        road->currentSpeed = road->maxSpeed - num_vehicles_on_road;
-                        // Send the updated speed to all vehicles
-                        for (int count = 3; count < size; count++)
-                        {
-                            int data[3] = {i, j, road->currentSpeed};
-                            MPI_Send(data, 3, MPI_INT, count, ROAD_SPEED_TAG, MPI_COMM_WORLD);
-                        }
-
-                        if (road->currentSpeed < 10)
-                        {
-                            road->currentSpeed = 10;
-                            // Send the updated minimum speed to all vehicles
-                            for (int count = 3; count < size; count++)
-                            {
-                                int data[3] = {i, j, road->currentSpeed};
-                                MPI_Send(data, 3, MPI_INT, count, ROAD_SPEED_TAG, MPI_COMM_WORLD);
-                            }
-                        }
-                    }
-
-                    // Signal the end of a junction update to vehicles
-                    for (int i = 3; i < size; i++)
-                    {
-                        int loop_end = 1;
-                        MPI_Send(&loop_end, 1, MPI_INT, i, LOOP_END_TAG, MPI_COMM_WORLD);
-                    }
-                }
-
-                // Signal to control that junction update is completed
-                int finished = 1;
-                MPI_Send(&finished, 1, MPI_INT, CONTROL_RANK, FINISHED_UPDATED_JUNCTION_TAG, MPI_COMM_WORLD);
+                MPI_Recv_init(&occupancy[count * num_roads], num_roads, MPI_INT, actor_ranks[count], ROAD_OCCUPANCY_TAG, sim_comm, &occupancy_requests[count]);
             }
         }
 
-        // Check for break messages from vehicles to exit the loop
-        int flag2 = 0;
-        MPI_Iprobe(3, BREAK_MESSAGE_TAG, MPI_COMM_WORLD, &flag2, &status);
-        if (flag2)
+        // Only on the ticks control picks are the road speeds recomputed and published, in between the vehicle
+        // actors keep moving on the speeds they were last sent
+        if (command[CMD_PUBLISH])
         {
-            int break_msg;
-            // Receive the break message from a vehicle
-            MPI_Recv(&break_msg, 1, MPI_INT, 3, BREAK_MESSAGE_TAG, MPI_COMM_WORLD, &status);
-            if (break_msg)
+            // Collect the number of vehicles each vehicle process has on every road
+            instrumentBegin(INSTR_JUNCTION_EXCHANGE);
+            MPI_Startall(num_actors, occupancy_requests);
+            MPI_Waitall(num_actors, occupancy_requests, MPI_STATUSES_IGNORE);
+            instrumentEnd(INSTR_JUNCTION_EXCHANGE);
+
+            // Loop through all junctions to update their status
+            instrumentBegin(INSTR_JUNCTION_UPDATE);
+            updateJunctions(elapsed_mins, occupancy, num_actors, published);
+            for (int r = 0; r < num_roads; r++)
+            {
+                int deviation = abs(published[r] - last_published[r]);
+                speed_deviation += deviation;
+                max_speed_deviation = deviation > max_speed_deviation ? deviation : max_speed_deviation;
+            }
+            int length = encodePublication(published, last_published, command[CMD_RANKS_CHANGED], publication);
+            instrumentEnd(INSTR_JUNCTION_UPDATE);
+            if (publication[0] == PUBLICATION_FULL)
+            {
+                full_publications++;
+            }
+            else
+            {
+                delta_publications++;
+            }
+            published_ints += length;
+
+            // Send the updated speeds and traffic lights to all vehicles, and to the routing actors first as the
+            // vehicles will soon be asking them for routes. Every actor receives the same publication so the sends
+            // share one buffer
+            instrumentBegin(INSTR_JUNCTION_EXCHANGE);
+            for (int i = 0; i < num_routing; i++)
+            {
+                MPI_Isend(publication, length, MPI_INT, ROADJUNCTION_RANK + 1 + i, ROAD_SPEED_TAG, sim_comm, &routing_requests[i]);
+            }
+            for (int count = 0; count < num_actors; count++)
             {
-                // Break out of the infinite loop to terminate the road junction process
-                break;
+                MPI_Isend(publication, length, MPI_INT, actor_ranks[count], ROAD_SPEED_TAG, sim_comm, &publish_requests[count]);
             }
+            MPI_Waitall(num_actors, publish_requests, MPI_STATUSES_IGNORE);
+            MPI_Waitall(num_routing, routing_requests, MPI_STATUSES_IGNORE);
+            instrumentEnd(INSTR_JUNCTION_EXCHANGE);
+            instrumentMessages(ROAD_SPEED_TAG, num_actors + num_routing, sizeof(int) * length * (num_actors + num_routing));
         }
+
+        // Signal to control that junction update is completed
+        MPI_Start(&finished_request);
+        MPI_Wait(&finished_request, MPI_STATUS_IGNORE);
+        instrumentMessages(FINISHED_UPDATED_JUNCTION_TAG, 1, sizeof(int));
+    }
+
+    MPI_Request_free(&command_request);
+    MPI_Request_free(&finished_request);
+    freeRequests(occupancy_requests, num_actors);
+    free(occupancy_requests);
+    free(publish_requests);
+    free(routing_requests);
+    free(actor_ranks);
+    free(occupancy);
+    free(published);
+    free(last_published);
+    free(publication);
+    freeRoadMap();
+    long publications = delta_publications + full_publications;
+    if (publications > 0)
+    {
+        printf("[Publication] %ld road speed updates: %ld as changes, %ld as the full table, %.1f ints each on average (the full table is %d)\n",
+               publications, delta_publications, full_publications, (double)published_ints / publications,
+               num_roads + num_junctions + 1);
+    }
+    if (publications > 0 && (run_options.sync_every > 1 || run_options.sync_drift > 0))
+    {
+        printf("[Sync] When republished the road speeds were off by %.3f on average and %d at most\n",
+               (double)speed_deviation / ((double)publications * num_roads), max_speed_deviation);
     }
 }
 
-static void Vehicle()
+/**
+ * Runs a vehicle actor, those started by main create their share of the initial vehicles (or when restarting take
+ * their share of the checkpoint's vehicles) whereas elastic ones started by control begin empty and are handed
+ * vehicles by the busier vehicle processes
+ **/
+static void Vehicle(int num_initial, int restart_share, int num_restart_shares)
 {
     // load the road map
+    instrumentBegin(INSTR_LOAD_MAP);
+    perfRegionBegin(PERF_LOAD_MAP);
     loadRoadMap(map_filename);
+    if (routing_settings.num_actors == 0)
+    {
+        routingInit(map_filename);
+    }
+    perfRegionEnd(PERF_LOAD_MAP, 1);
+    instrumentEnd(INSTR_LOAD_MAP);
 
     // init vehicle
     vehicles = (struct VehicleStruct *)malloc(sizeof(struct VehicleStruct) * MAX_VEHICLES);
@@ -353,651 +1264,612 @@ static void Vehicle()
         vehicles[i].currentJunction = NULL;
         vehicles[i].maxSpeed = 0;
     }
-    // Calculate the number of vehicles that should be initialized per process
-    int participating_processes = size - 3;
-    int vehicles_per_process = INITIAL_VEHICLES / participating_processes;
-    int extra_vehicles = INITIAL_VEHICLES % participating_processes;
-    if (rank != size - 1)
-    {
-        // Normal share of vehicles to initialize
-        int count = initVehicles(vehicles_per_process);
-    }
-    else
+    initVehicles(num_initial);
+    if (run_options.restart_filename != NULL && num_restart_shares > 0)
     {
-        // Last rank takes extra vehicles if the division is not even
-        int count = initVehicles(vehicles_per_process + extra_vehicles);
+        restoreVehicles(restart_share, num_restart_shares);
     }
 
+    // The coalescing layer carries the junction and road statistics, both at the end of the run and when this
+    // actor is put back to sleep and hands them over along with its vehicles
+    coalesceInit(COALESCE_FLUSH_THRESHOLD, sim_comm);
+    coalesceRegisterHandler(JUNCTION_STATS_RECORD, handleJunctionStats);
+    coalesceRegisterHandler(ROAD_STATS_RECORD, handleRoadStats);
+
+    // Persistent requests for the per-tick pattern: the commands for this actor's subtree of control's tree from its
+    // parent, this process's road occupancy sent to roadjunction, the road speeds and traffic lights published back
+    // and the subtree's results returned to the parent. This actor's own command and results come first, followed
+    // by each child's subtree. The parent changes with the tree, so the command is received from any source and the
+    // requests to the parent and children are set up once this actor has been told where it sits in the tree
+    int max_vehicle_actors = size - first_vehicle_rank;
+    int *commands = (int *)malloc(sizeof(int) * TICK_COMMAND_LEN * max_vehicle_actors);
+    int *results = (int *)malloc(sizeof(int) * TICK_RESULTS_LEN * max_vehicle_actors);
+    int *command = commands, *data = results;
+    int *occupancy = (int *)malloc(sizeof(int) * num_roads);
+    int *publication = (int *)malloc(sizeof(int) * (num_roads + num_junctions + 1));
+    int *changed_roads = (int *)malloc(sizeof(int) * (num_roads + 1));
+    // The occupancy last reported to roadjunction, which the drift control publishes early on is measured from
+    int *published_occupancy = (int *)calloc(num_roads, sizeof(int));
+    // The routes asked of this actor's routing actor each tick, the tick followed by a source and destination each
+    int *route_batch = (int *)malloc(sizeof(int) * (2 * MAX_VEHICLES + 1));
+    int *route_answers = (int *)malloc(sizeof(int) * MAX_VEHICLES);
+    route_request_vehicles = (int *)malloc(sizeof(int) * MAX_VEHICLES);
+    num_route_requests = 0;
+    struct ControlTreeNode tree;
+    tree.num_children = 0;
+    MPI_Request command_request, results_request = MPI_REQUEST_NULL, road_requests[2];
+    MPI_Request child_command_requests[CONTROL_TREE_MAX_CHILDREN], child_results_requests[CONTROL_TREE_MAX_CHILDREN];
+    MPI_Recv_init(commands, TICK_COMMAND_LEN * max_vehicle_actors, MPI_INT, MPI_ANY_SOURCE, UPDATE_VEHICLES_TAG, sim_comm, &command_request);
+    MPI_Send_init(occupancy, num_roads, MPI_INT, ROADJUNCTION_RANK, ROAD_OCCUPANCY_TAG, sim_comm, &road_requests[0]);
+    MPI_Recv_init(publication, num_roads + num_junctions + 1, MPI_INT, ROADJUNCTION_RANK, ROAD_SPEED_TAG, sim_comm, &road_requests[1]);
+
     while (1)
     {
-        // Accept messages from control for randomly generated vehicles
-        MPI_Status status;
-        int flag1 = 0; // Used to mark whether a message has arrived
-        MPI_Iprobe(CONTROL_RANK, RANDOM_CREATE_TAG, MPI_COMM_WORLD, &flag1, &status);
-        if (flag1)
+        // Accept the commands from control for this tick and pass the children's on down the tree straight away
+        MPI_Start(&command_request);
+        MPI_Wait(&command_request, MPI_STATUS_IGNORE);
+        if (command[CMD_RANKS_CHANGED])
         {
-            int num_new_vehicles = 0;
-            MPI_Recv(&num_new_vehicles, 1, MPI_INT, CONTROL_RANK, RANDOM_CREATE_TAG, MPI_COMM_WORLD, &status);
-            if (status.MPI_SOURCE == CONTROL_RANK)
+            // Vehicle actors have been started or put to sleep, so find out where this actor now sits in the tree
+            if (results_request != MPI_REQUEST_NULL)
             {
-                int count = 0; // Counter for successfully activated vehicles
-                for (int i = 0; i < num_new_vehicles; i++)
-                {
-                    enum VehicleType vehicleType;
-                    vehicleType = activateRandomVehicle();
-                    int res = activateVehicle(vehicleType);
-                    if (res != -1)
-                    {
-                        count++;
-                    }
-                }
-                // Report back the number of vehicles successfully created
-                MPI_Send(&count, 1, MPI_INT, CONTROL_RANK, VEHICLE_CREATED_TAG, MPI_COMM_WORLD);
+                MPI_Request_free(&results_request);
+                freeRequests(child_command_requests, tree.num_children);
+                freeRequests(child_results_requests, tree.num_children);
             }
+            MPI_Recv(&tree, sizeof(struct ControlTreeNode) / sizeof(int), MPI_INT, CONTROL_RANK, VEHICLE_TREE_TAG, sim_comm, MPI_STATUS_IGNORE);
+            initVehicleTreeRequests(&tree, commands, results, child_command_requests, child_results_requests, &results_request);
+        }
+        MPI_Startall(tree.num_children, child_command_requests);
+        instrumentMessages(UPDATE_VEHICLES_TAG, tree.num_children, sizeof(int) * TICK_COMMAND_LEN * (tree.subtree_size - 1));
+        if (command[CMD_STOP])
+        {
+            MPI_Waitall(tree.num_children, child_command_requests, MPI_STATUSES_IGNORE);
+            break;
         }
 
-        // Receive news from raodjunction for road updates
-        int flag2 = 0;
-        MPI_Iprobe(ROADJUNCTION_RANK, BEGIN_ROADS_UPDATE_TAG, MPI_COMM_WORLD, &flag2, &status);
-        if (flag2)
+        // Randomly generate the vehicles control asked for
+        instrumentBegin(INSTR_SPAWN);
+        int count = 0; // Counter for successfully activated vehicles
+        for (int i = 0; i < command[CMD_NEW_VEHICLES]; i++)
         {
-            int begin;
-            MPI_Recv(&begin, 1, MPI_INT, ROADJUNCTION_RANK, BEGIN_ROADS_UPDATE_TAG, MPI_COMM_WORLD, &status);
-            if (status.MPI_SOURCE == ROADJUNCTION_RANK)
+            enum VehicleType vehicleType;
+            vehicleType = activateRandomVehicle();
+            int res = activateVehicle(vehicleType);
+            if (res != -1)
             {
-                for (int i = 0; i < num_junctions; i++)
-                {
-                    int loop_begin;
-                    MPI_Recv(&loop_begin, 1, MPI_INT, ROADJUNCTION_RANK, LOOP_BEGIN_TAG, MPI_COMM_WORLD, &status);
-                    while (1)
-                    {
-                        int end = 0;
-                        MPI_Status status;
-                        int flag = 0;
-                        // Use MPI_Iprobe to check if a message has arrived
-                        MPI_Iprobe(ROADJUNCTION_RANK, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
-                        if (flag)
-                        {
-                            switch (status.MPI_TAG)
-                            {
-                            case TRAFFICLIGHT_ENABLED_TAG: // Handle traffic light enabled state change
-                            {
-                                int data[2];
-                                MPI_Recv(data, 2, MPI_INT, ROADJUNCTION_RANK, TRAFFICLIGHT_ENABLED_TAG, MPI_COMM_WORLD, &status);
-                                roadMap[data[0]].trafficLightsRoadEnabled = data[1];
-                                break;
-                            }
-                            case VEHICLE_INDEX_TAG: // Handle vehicle index update
-                            {
-                                int id;
-                                MPI_Recv(&id, 1, MPI_INT, ROADJUNCTION_RANK, VEHICLE_INDEX_TAG, MPI_COMM_WORLD, &status);
-                                // Traverse the entire vehicle array, find the vehicle, and see if there is a vehicle whose roadOn is this road
-                                int index = 0;
-                                for (int i = 0; i < MAX_VEHICLES; i++)
-                                {
-                                    if (vehicles[i].active && vehicles[i].roadOn != NULL && vehicles[i].roadOn->id == id)
-                                    {
-                                        index = 1;
-                                        break;
-                                    }
-                                }
-                                MPI_Send(&index, 1, MPI_INT, ROADJUNCTION_RANK, VEHICLE_INDEX_RETURN_ID_TAG, MPI_COMM_WORLD);
-                                break;
-                            }
-                            case ROAD_SPEED_TAG: // Handle road speed update
-                            {
-                                int data[3];
-                                MPI_Recv(data, 3, MPI_INT, ROADJUNCTION_RANK, ROAD_SPEED_TAG, MPI_COMM_WORLD, &status);
-
-                                roadMap[data[0]].roads[data[1]].currentSpeed = data[2];
-
-                                break;
-                            }
-                            case LOOP_END_TAG:
-                            {
-                                int loop_end;
-                                MPI_Recv(&loop_end, 1, MPI_INT, ROADJUNCTION_RANK, LOOP_END_TAG, MPI_COMM_WORLD, &status);
-                                if (loop_end)
-                                {
-                                    end = 1;
-                                }
-                                break;
-                            }
-                            }
-                        }
-
-                        if (end)
-                        {
-                            break;
-                        }
-                    }
-                }
+                count++;
             }
         }
 
-        // Accept messages from control to update the vehicle
-        int flag3 = 0;
-        MPI_Iprobe(CONTROL_RANK, UPDATE_VEHICLES_TAG, MPI_COMM_WORLD, &flag3, &status);
-        if (flag3)
-        {
-            int elapsed_mins;
-            MPI_Recv(&elapsed_mins, 1, MPI_INT, CONTROL_RANK, UPDATE_VEHICLES_TAG, MPI_COMM_WORLD, &status);
+        instrumentEnd(INSTR_SPAWN);
 
-            if (status.MPI_SOURCE == CONTROL_RANK)
-            {
-                for (int i = 0; i < MAX_VEHICLES; i++)
-                {
-                    if (vehicles[i].active)
-                    {
-                        handleVehicleUpdate(i);
-                    }
-                }
+        // Hand vehicles to, or take them from, other vehicle processes as control has planned
+        instrumentBegin(INSTR_MIGRATION);
+        migrateVehicles(command);
+        instrumentEnd(INSTR_MIGRATION);
 
-                // Pack and send these four data to control
-                int data[4];
-                data[0] = vehicles_exhausted_fuel;
-                data[1] = passengers_stranded;
-                data[2] = vehicles_crashed;
-                data[3] = passengers_delivered;
-                MPI_Send(data, 4, MPI_INT, CONTROL_RANK, UPDATED_RESULTS_TAG, MPI_COMM_WORLD);
-                // restart the variable
-                vehicles_exhausted_fuel = 0;
-                passengers_stranded = 0;
-                vehicles_crashed = 0;
-                passengers_delivered = 0;
-                // Send to control, task completed
-                int finished = 1;
-                MPI_Send(&finished, 1, MPI_INT, CONTROL_RANK, FINISHED_UPDATED_VEHICLES_TAG, MPI_COMM_WORLD);
+        // On the ticks control asks for it, report how many vehicles are on each road to roadjunction and receive
+        // the road updates back. Otherwise the vehicles move on the speeds they already have
+        int drift = 0;
+        if (command[CMD_PUBLISH])
+        {
+            readOccupancy(occupancy, NULL);
+            instrumentBegin(INSTR_ROAD_EXCHANGE);
+            MPI_Startall(2, road_requests);
+            MPI_Waitall(2, road_requests, MPI_STATUSES_IGNORE);
+            instrumentEnd(INSTR_ROAD_EXCHANGE);
+            instrumentMessages(ROAD_OCCUPANCY_TAG, 1, sizeof(int) * num_roads);
+            int num_changed = applyPublication(publication, changed_roads);
+            if (num_changed > 0 && routing_settings.num_actors == 0)
+            {
+                routingSpeedsChanged(changed_roads, num_changed);
             }
+            memcpy(published_occupancy, occupancy, sizeof(int) * num_roads);
+        }
+        else if (run_options.sync_drift > 0)
+        {
+            drift = readOccupancy(occupancy, published_occupancy);
         }
 
-        int flag4 = 0;
-        MPI_Iprobe(CONTROL_RANK, FILE_WRITE_TAG, MPI_COMM_WORLD, &flag4, &status);
-        if (flag4)
+        // Update the vehicles, timing how long it takes so control can balance the cost across processes
+        int active_vehicles = 0;
+        instrumentBegin(INSTR_VEHICLE_UPDATE);
+        perfRegionBegin(PERF_VEHICLE_UPDATE);
+        double update_start = MPI_Wtime();
+        for (int i = 0; i < MAX_VEHICLES; i++)
         {
-            int final_write;
-            MPI_Recv(&final_write, 1, MPI_INT, CONTROL_RANK, FILE_WRITE_TAG, MPI_COMM_WORLD, &status);
-            if (status.MPI_SOURCE == CONTROL_RANK)
+            if (vehicles[i].active)
             {
-                // Send data information to process 3
-                if (rank != 3)
-                {
-                    for (int i = 0; i < num_junctions; i++)
-                    {
-                        // Send data for each intersection
-                        MPI_Send(&roadMap[i].total_number_vehicles, 1, MPI_INT, 3, 0, MPI_COMM_WORLD);
-                        MPI_Send(&roadMap[i].total_number_crashes, 1, MPI_INT, 3, 0, MPI_COMM_WORLD);
-
-                        for (int j = 0; j < roadMap[i].num_roads; j++)
-                        {
-                            // Send data for each road
-                            int from_id = roadMap[i].roads[j].from->id;
-                            int to_id = roadMap[i].roads[j].to->id;
-                            MPI_Send(&from_id, 1, MPI_INT, 3, 0, MPI_COMM_WORLD);
-                            MPI_Send(&to_id, 1, MPI_INT, 3, 0, MPI_COMM_WORLD);
-                            MPI_Send(&roadMap[i].roads[j].total_number_vehicles, 1, MPI_INT, 3, 0, MPI_COMM_WORLD);
-                            MPI_Send(&roadMap[i].roads[j].max_concurrent_vehicles, 1, MPI_INT, 3, 0, MPI_COMM_WORLD);
-                        }
-                    }
-                }
-                // Statistical information
-                if (rank == 3)
-                {
-
-                    MPI_Status status;
-                    for (int source = 4; source < size; source++)
-                    {
-                        for (int i = 0; i < num_junctions; i++)
-                        {
-                            // Receive data for each intersection
-                            int total_number_vehicles, total_number_crashes;
-                            MPI_Recv(&total_number_vehicles, 1, MPI_INT, source, 0, MPI_COMM_WORLD, &status);
-                            MPI_Recv(&total_number_crashes, 1, MPI_INT, source, 0, MPI_COMM_WORLD, &status);
-                            roadMap[i].total_number_vehicles += total_number_vehicles;
-                            roadMap[i].total_number_crashes += total_number_crashes;
-
-                            for (int j = 0; j < roadMap[i].num_roads; j++)
-                            {
-                                // Receive data for each road
-                                int from_id, to_id, road_vehicles, max_concurrent;
-                                MPI_Recv(&road_vehicles, 1, MPI_INT, source, 0, MPI_COMM_WORLD, &status);
-                                MPI_Recv(&max_concurrent, 1, MPI_INT, source, 0, MPI_COMM_WORLD, &status);
-                                roadMap[i].roads[j].total_number_vehicles += road_vehicles;
-                                roadMap[i].roads[j].max_concurrent_vehicles += max_concurrent;
-                            }
-                        }
-                    }
-                }
-                if (rank == 3)
-                {
-                    // writeDetailedInfo();
-                    // Send a message to roadjunction to ask him to break
-                    int msg = 1;
-                    MPI_Send(&msg, 1, MPI_INT, ROADJUNCTION_RANK, BREAK_MESSAGE_TAG, MPI_COMM_WORLD);
-                    break;
-                }
-                break;
+                handleVehicleUpdate(i);
+                active_vehicles += vehicles[i].active;
             }
         }
-    }
-}
-static void handleVehicleUpdate(int i)
-{
+        double update_time = MPI_Wtime() - update_start;
+        perfRegionEnd(PERF_VEHICLE_UPDATE, active_vehicles);
+        instrumentEnd(INSTR_VEHICLE_UPDATE);
 
-    if (getCurrentSeconds() - vehicles[i].start_t > vehicles[i].fuel)
-    {
-        vehicles_exhausted_fuel++;
-        passengers_stranded += vehicles[i].passengers;
+        // The vehicles that reached a junction wait there for their routes, which are asked for all at once
+        if (num_route_requests > 0)
+        {
+            instrumentBegin(INSTR_ROUTE_EXCHANGE);
+            exchangeRoutes(command[CMD_PUBLICATIONS] + command[CMD_PUBLISH], route_batch, route_answers);
+            instrumentEnd(INSTR_ROUTE_EXCHANGE);
+        }
 
-        vehicles[i].active = 0;
-        return;
+        // Pack and send these results to control
+        data[RES_EXHAUSTED_FUEL] = vehicles_exhausted_fuel;
+        data[RES_PASSENGERS_STRANDED] = passengers_stranded;
+        data[RES_VEHICLES_CRASHED] = vehicles_crashed;
+        data[RES_PASSENGERS_DELIVERED] = passengers_delivered;
+        data[RES_VEHICLES_CREATED] = count;
+        data[RES_ACTIVE_VEHICLES] = active_vehicles;
+        data[RES_UPDATE_USECS] = (int)(update_time * 1e6);
+        data[RES_CHECKPOINT_FAILED] = 0;
+        data[RES_OCCUPANCY_DRIFT] = drift;
+        if (command[CMD_CHECKPOINT])
+        {
+            // Every vehicle has been updated and none are in flight, so this actor's state is consistent with the rest
+            data[RES_CHECKPOINT_FAILED] = !checkpointVehicles(command[CMD_ELAPSED_MINS], command[CMD_CHECKPOINT] - 1, !command[CMD_RETIRE]);
+        }
+        // Gather the children's results behind this actor's and send the lot up the tree
+        instrumentBegin(INSTR_RESULTS);
+        MPI_Startall(tree.num_children, child_results_requests);
+        MPI_Waitall(tree.num_children, child_results_requests, MPI_STATUSES_IGNORE);
+        MPI_Start(&results_request);
+        MPI_Wait(&results_request, MPI_STATUS_IGNORE);
+        MPI_Waitall(tree.num_children, child_command_requests, MPI_STATUSES_IGNORE);
+        instrumentEnd(INSTR_RESULTS);
+        instrumentMessages(UPDATED_RESULTS_TAG, 1, sizeof(int) * TICK_RESULTS_LEN * tree.subtree_size);
+        // restart the variable
+        vehicles_exhausted_fuel = 0;
+        passengers_stranded = 0;
+        vehicles_crashed = 0;
+        passengers_delivered = 0;
+
+        if (command[CMD_RETIRE])
+        {
+            // Everything has been handed over so this actor goes back to sleep in the pool
+            break;
+        }
     }
 
-    // If the vehicle is on a certain road rather than at a certain intersection
-    if (vehicles[i].roadOn != NULL && vehicles[i].currentJunction == NULL)
+    MPI_Request_free(&command_request);
+    if (results_request != MPI_REQUEST_NULL)
     {
-        // Means that the vehicle is currently on a road
-        time_t sec = getCurrentSeconds();
-        int latest_time = sec - vehicles[i].last_distance_check_secs;
-        if (latest_time < 1)
-            return;
-        vehicles[i].last_distance_check_secs = sec;
-        double travelled_length = latest_time * vehicles[i].speed;
-        vehicles[i].remaining_distance -= travelled_length;
-        if (vehicles[i].remaining_distance <= 0)
-        {
-            // Left the road and arrived at the target junction
-            vehicles[i].arrived_road_time = 0;
-            vehicles[i].last_distance_check_secs = 0;
-            vehicles[i].remaining_distance = 0;
-            vehicles[i].speed = 0;
-            vehicles[i].currentJunction = vehicles[i].roadOn->to;
-            vehicles[i].currentJunction->num_vehicles++;
-            vehicles[i].currentJunction->total_number_vehicles++;
-            vehicles[i].roadOn->numVehiclesOnRoad--;
-            vehicles[i].roadOn = NULL;
-        }
+        MPI_Request_free(&results_request);
+        freeRequests(child_command_requests, tree.num_children);
+        freeRequests(child_results_requests, tree.num_children);
     }
-
-    // If the vehicle is at a certain intersection
-
-    if (vehicles[i].currentJunction != NULL)
+    freeRequests(road_requests, 2);
+    free(occupancy);
+    free(publication);
+    free(changed_roads);
+    free(published_occupancy);
+    free(route_batch);
+    free(route_answers);
+    free(route_request_vehicles);
+
+    if (command[CMD_STOP])
     {
-        // If the vehicle is at an intersection and is not on the road
-        if (vehicles[i].roadOn == NULL)
+        // Gather the statistics onto the first vehicle process, every junction and road is a small record so they are
+        // coalesced
+        instrumentBegin(INSTR_STATS);
+        if (rank != first_vehicle_rank)
         {
-            // If the road is NULL then the vehicle is on a junction and not on a road
-            if (vehicles[i].currentJunction->id == vehicles[i].dest)
-            {
-                // Arrived! Job done!
-                passengers_delivered += vehicles[i].passengers;
-                vehicles[i].active = 0;
-            }
-            else
-            {
-                int next_junction_target = planRoute(vehicles[i].currentJunction->id, vehicles[i].dest, roadMap, num_junctions, num_roads);
-                if (next_junction_target != -1)
-                {
-                    int road_to_take = findAppropriateRoad(next_junction_target, vehicles[i].currentJunction);
-                    assert(vehicles[i].currentJunction->roads[road_to_take].to->id == next_junction_target);
-
-                    vehicles[i].roadOn = &(vehicles[i].currentJunction->roads[road_to_take]);
-                    vehicles[i].roadOn->numVehiclesOnRoad++;
-                    vehicles[i].roadOn->total_number_vehicles++;
-                    // If the number of vehicles on the road exceeds the maximum number of vehicles on the road, update the maximum number of vehicles
-                    if (vehicles[i].roadOn->max_concurrent_vehicles < vehicles[i].roadOn->numVehiclesOnRoad)
-                    {
-                        vehicles[i].roadOn->max_concurrent_vehicles = vehicles[i].roadOn->numVehiclesOnRoad;
-                    }
-                    // The remaining distance of the vehicle on this road is the length of the selected road
-                    vehicles[i].remaining_distance = vehicles[i].roadOn->roadLength;
-                    // The vehicle's speed is updated to the minimum of the vehicle's maximum speed and the current speed of the road
-                    vehicles[i].speed = vehicles[i].roadOn->currentSpeed;
-                    if (vehicles[i].speed > vehicles[i].maxSpeed)
-                        vehicles[i].speed = vehicles[i].maxSpeed;
-                }
-                else
-                {
-                    // Report error (this should never happen)
-                    fprintf(stderr, "No longer a viable route\n");
-                    exit(-1);
-                }
-            }
+            sendStatistics(first_vehicle_rank);
         }
-        // Here we have selected a junction, now it's time to determine if the vehicle can be released from the junction
-        char take_road = 0;
-        if (vehicles[i].currentJunction->hasTrafficLights)
+        // Statistical information
+        if (rank == first_vehicle_rank)
         {
-            // Need to check that we can go, otherwise need to wait until road enabled by traffic light
-            take_road = vehicles[i].roadOn == &vehicles[i].currentJunction->roads[vehicles[i].currentJunction->trafficLightsRoadEnabled];
+            coalesceReceivePhase(command[CMD_NUM_VEHICLE_RANKS] - 1);
+            // writeDetailedInfo();
         }
-        else
+        instrumentEnd(INSTR_STATS);
+    }
+    coalesceFinalise();
+    free(commands);
+    free(results);
+    free(vehicles);
+    if (routing_settings.num_actors == 0)
+    {
+        routingFinalise();
+    }
+    freeRoadMap();
+}
+
+/**
+ * Sets up a vehicle actor's persistent requests for its place in control's tree: the commands for each child's
+ * subtree sent down, the results of each child's subtree received back and the results of this actor's whole
+ * subtree sent up to its parent
+ **/
+static void initVehicleTreeRequests(struct ControlTreeNode *tree, int *commands, int *results, MPI_Request *child_command_requests,
+                                    MPI_Request *child_results_requests, MPI_Request *results_request)
+{
+    int offset = 1;
+    for (int c = 0; c < tree->num_children; c++)
+    {
+        MPI_Send_init(&commands[offset * TICK_COMMAND_LEN], TICK_COMMAND_LEN * tree->child_subtree_sizes[c], MPI_INT, tree->children[c],
+                      UPDATE_VEHICLES_TAG, sim_comm, &child_command_requests[c]);
+        MPI_Recv_init(&results[offset * TICK_RESULTS_LEN], TICK_RESULTS_LEN * tree->child_subtree_sizes[c], MPI_INT, tree->children[c],
+                      UPDATED_RESULTS_TAG, sim_comm, &child_results_requests[c]);
+        offset += tree->child_subtree_sizes[c];
+    }
+    MPI_Send_init(results, TICK_RESULTS_LEN * tree->subtree_size, MPI_INT, tree->parent, UPDATED_RESULTS_TAG, sim_comm, results_request);
+}
+
+/**
+ * Carries out the vehicle migration in this tick's command, first sending the requested number of vehicles (all of
+ * them if this actor is going back to sleep, along with its statistics) and then receiving the batches other
+ * vehicle processes have been told to send here
+ **/
+static void migrateVehicles(int *command)
+{
+    MPI_Request request = MPI_REQUEST_NULL;
+    char *outgoing = NULL;
+    if (command[CMD_MIGRATE_TO] >= 0)
+    {
+        int retiring = command[CMD_RETIRE];
+        int count = retiring ? MAX_VEHICLES : command[CMD_MIGRATE_COUNT];
+        outgoing = (char *)malloc(MIGRATION_HEADER_SIZE + sizeof(struct PackedVehicle) * count);
+        count = packVehicles((struct PackedVehicle *)(outgoing + MIGRATION_HEADER_SIZE), count);
+        ((int *)outgoing)[0] = retiring;
+        ((int *)outgoing)[1] = count;
+        MPI_Isend(outgoing, MIGRATION_HEADER_SIZE + sizeof(struct PackedVehicle) * count, MPI_BYTE, command[CMD_MIGRATE_TO],
+                  VEHICLE_MIGRATE_TAG, sim_comm, &request);
+        instrumentMessages(VEHICLE_MIGRATE_TAG, 1, MIGRATION_HEADER_SIZE + sizeof(struct PackedVehicle) * count);
+        if (retiring)
         {
-            // If not traffic light then there is a chance of collision
-            int collision = getRandomInteger(0, 8) * vehicles[i].currentJunction->num_vehicles;
-            if (collision > 20)
-            {
-                // Vehicle has crashed!
-                passengers_stranded += vehicles[i].passengers;
-                vehicles_crashed++;
-                vehicles[i].active = 0;
-                vehicles[i].currentJunction->total_number_crashes++;
-            }
-            take_road = 1;
+            sendStatistics(command[CMD_MIGRATE_TO]);
         }
-        // If take the road then clear the junction
-        if (take_road)
+    }
+
+    for (int i = 0; i < command[CMD_MIGRATE_FROM]; i++)
+    {
+        MPI_Status status;
+        int bytes;
+        MPI_Probe(MPI_ANY_SOURCE, VEHICLE_MIGRATE_TAG, sim_comm, &status);
+        MPI_Get_count(&status, MPI_BYTE, &bytes);
+        char *incoming = (char *)malloc(bytes);
+        MPI_Recv(incoming, bytes, MPI_BYTE, status.MPI_SOURCE, VEHICLE_MIGRATE_TAG, sim_comm, MPI_STATUS_IGNORE);
+        unpackVehicles((struct PackedVehicle *)(incoming + MIGRATION_HEADER_SIZE), ((int *)incoming)[1]);
+        if (((int *)incoming)[0])
         {
-            vehicles[i].last_distance_check_secs = getCurrentSeconds();
-            vehicles[i].currentJunction->num_vehicles--;
-            vehicles[i].currentJunction = NULL;
+            // The sender is going back to sleep, so keep hold of its statistics
+            coalesceReceivePhase(1);
         }
+        free(incoming);
     }
+
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    free(outgoing);
 }
 
-static int initVehicles(int num_initial)
+/**
+ * Writes this actor's part of the checkpoint, its vehicles are packed as for a migration but stay here. An actor
+ * that is going back to sleep has handed its statistics over, so leaves them out. Returns zero if it failed
+ **/
+static int checkpointVehicles(int elapsed_mins, int part, int with_statistics)
 {
+    struct PackedVehicle *packed = (struct PackedVehicle *)malloc(sizeof(struct PackedVehicle) * MAX_VEHICLES);
     int count = 0;
-    for (int i = 0; i < num_initial; i++)
+    for (int i = 0; i < MAX_VEHICLES; i++)
     {
-        enum VehicleType vehicleType;
-        vehicleType = activateRandomVehicle();
-        int res = activateVehicle(vehicleType);
-        if (res != -1)
+        if (vehicles[i].active)
         {
-            count++;
+            packVehicle(i, &packed[count++]);
         }
     }
-
-    return count;
+    int written = writeCheckpointPart(run_options.checkpoint_filename, elapsed_mins, part, packed, count, with_statistics);
+    if (!written)
+    {
+        fprintf(stderr, "Warning: Rank %d can not write its part of the checkpoint '%s'\n", rank, run_options.checkpoint_filename);
+    }
+    free(packed);
+    return written;
 }
 
-static void loadRoadMap(char *filename)
+/**
+ * Takes this actor's share of the vehicles in the checkpoint being restarted from, whatever the number of actors
+ * that wrote it: every num_shares-th vehicle across all the parts, the statistics of every num_shares-th part and
+ * the random number stream of the part with the same number. The vehicles' times are moved on by how long ago the
+ * checkpoint was taken, so they carry on from where they were
+ **/
+static void restoreVehicles(int share, int num_shares)
 {
-    enum ReadMode currentMode = NONE;
-    char buffer[MAX_ROAD_LEN];
-    FILE *f = fopen(filename, "r");
-    if (f == NULL)
+    struct CheckpointHeader header;
+    if (!readCheckpointHeader(run_options.restart_filename, &header))
     {
-        fprintf(stderr, "Error opening roadmap file '%s'\n", filename);
+        fprintf(stderr, "Error: Can not read the checkpoint '%s'\n", run_options.restart_filename);
         exit(-1);
     }
-
-    while (fgets(buffer, MAX_ROAD_LEN, f))
+    time_t shift = getCurrentSeconds() - (time_t)header.saved_seconds;
+    struct PackedVehicle *share_vehicles = (struct PackedVehicle *)malloc(sizeof(struct PackedVehicle) * MAX_VEHICLES);
+    int num_share_vehicles = 0, vehicle_index = 0;
+    for (int part = 0; part < header.num_parts; part++)
     {
-        if (buffer[0] == '%')
-            continue;
-        if (buffer[0] == '#')
+        int count;
+        struct RandomStream random;
+        struct PackedVehicle *packed = readCheckpointPart(run_options.restart_filename, header.elapsed_mins, part,
+                                                          part % num_shares == share, &count, &random);
+        if (packed == NULL)
         {
-            if (strncmp("# Road layout:", buffer, 14) == 0)
-            {
-                char *s = strstr(buffer, ":");
-                num_junctions = atoi(&s[1]);
-                roadMap = (struct JunctionStruct *)malloc(sizeof(struct JunctionStruct) * num_junctions);
-                for (int i = 0; i < num_junctions; i++)
-                {
-                    roadMap[i].id = i;
-                    roadMap[i].num_roads = 0;
-                    roadMap[i].num_vehicles = 0;
-                    roadMap[i].hasTrafficLights = 0;
-                    roadMap[i].total_number_crashes = 0;
-                    roadMap[i].total_number_vehicles = 0;
-                    // Not ideal to allocate all roads size here
-                    roadMap[i].roads = (struct RoadStruct *)malloc(sizeof(struct RoadStruct) * MAX_NUM_ROADS_PER_JUNCTION);
-                }
-                currentMode = ROADMAP;
-            }
-            if (strncmp("# Traffic lights:", buffer, 17) == 0)
-            {
-                currentMode = TRAFFICLIGHTS;
-            }
+            fprintf(stderr, "Error: Part %d of the checkpoint '%s' is missing, damaged or for another map\n", part,
+                    run_options.restart_filename);
+            exit(-1);
         }
-        else
+        if (part == share)
+        {
+            random_stream = random;
+        }
+        for (int k = 0; k < count; k++, vehicle_index++)
         {
-            if (currentMode == ROADMAP)
+            if (vehicle_index % num_shares != share)
+                continue;
+            if (num_share_vehicles == MAX_VEHICLES)
             {
-                char *space = strstr(buffer, " ");
-                *space = '\0';
-                int from_id = atoi(buffer);
-                char *nextspace = strstr(&space[1], " ");
-                *nextspace = '\0';
-                int to_id = atoi(&space[1]);
-                char *nextspace2 = strstr(&nextspace[1], " ");
-                *nextspace = '\0';
-                int roadlength = atoi(&nextspace[1]);
-                int speed = atoi(&nextspace2[1]);
-                if (roadMap[from_id].num_roads >= MAX_NUM_ROADS_PER_JUNCTION)
-                {
-                    fprintf(stderr, "Error: Tried to create road %d at junction %d, but maximum number of roads is %d, increase 'MAX_NUM_ROADS_PER_JUNCTION'",
-                            roadMap[from_id].num_roads, from_id, MAX_NUM_ROADS_PER_JUNCTION);
-                    exit(-1);
-                }
-                roadMap[from_id].roads[roadMap[from_id].num_roads].id = num_roads;
-                roadMap[from_id].roads[roadMap[from_id].num_roads].from = &roadMap[from_id];
-                roadMap[from_id].roads[roadMap[from_id].num_roads].to = &roadMap[to_id];
-                roadMap[from_id].roads[roadMap[from_id].num_roads].roadLength = roadlength;
-                roadMap[from_id].roads[roadMap[from_id].num_roads].maxSpeed = speed;
-                roadMap[from_id].roads[roadMap[from_id].num_roads].numVehiclesOnRoad = 0;
-                roadMap[from_id].roads[roadMap[from_id].num_roads].currentSpeed = speed;
-                roadMap[from_id].roads[roadMap[from_id].num_roads].total_number_vehicles = 0;
-                roadMap[from_id].roads[roadMap[from_id].num_roads].max_concurrent_vehicles = 0;
-                roadMap[from_id].num_roads++;
-                num_roads++;
+                fprintf(stderr, "Rank %d has no free vehicle slots for a vehicle in the checkpoint\n", rank);
+                continue;
             }
-            else if (currentMode == TRAFFICLIGHTS)
+            struct PackedVehicle *p = &share_vehicles[num_share_vehicles++];
+            *p = packed[k];
+            p->start_t += shift;
+            if (p->last_distance_check_secs != 0)
             {
-                int id = atoi(buffer);
-                if (roadMap[id].num_roads > 0)
-                    roadMap[id].hasTrafficLights = 1;
+                p->last_distance_check_secs += shift;
             }
         }
+        free(packed);
     }
-    fclose(f);
+    unpackVehicles(share_vehicles, num_share_vehicles);
+    free(share_vehicles);
 }
 
 /**
- * Activates a vehicle and sets its type and route randomly
+ * Packs a vehicle into a form that can be sent to another vehicle process or written to a checkpoint
  **/
-static int activateRandomVehicle()
+static void packVehicle(int i, struct PackedVehicle *p)
 {
-    int random_vehicle_type = getRandomInteger(0, 5);
-    enum VehicleType vehicleType;
-    if (random_vehicle_type == 0)
-    {
-        vehicleType = BUS;
-    }
-    else if (random_vehicle_type == 1)
-    {
-        vehicleType = CAR;
-    }
-    else if (random_vehicle_type == 2)
-    {
-        vehicleType = MINI_BUS;
-    }
-    else if (random_vehicle_type == 3)
+    p->passengers = vehicles[i].passengers;
+    p->source = vehicles[i].source;
+    p->dest = vehicles[i].dest;
+    p->maxSpeed = vehicles[i].maxSpeed;
+    p->speed = vehicles[i].speed;
+    p->arrived_road_time = vehicles[i].arrived_road_time;
+    p->fuel = vehicles[i].fuel;
+    p->last_distance_check_secs = vehicles[i].last_distance_check_secs;
+    p->start_t = vehicles[i].start_t;
+    p->remaining_distance = vehicles[i].remaining_distance;
+    p->random = vehicles[i].random;
+    p->junction = -1;
+    p->road_from = -1;
+    p->road_index = -1;
+    if (vehicles[i].currentJunction != NULL)
     {
-        vehicleType = COACH;
+        p->junction = vehicles[i].currentJunction->id;
     }
-    else if (random_vehicle_type == 4)
+    if (vehicles[i].roadOn != NULL)
     {
-        vehicleType = MOTORBIKE;
+        p->road_from = vehicles[i].roadOn->from->id;
+        p->road_index = vehicles[i].roadOn - vehicles[i].roadOn->from->roads;
     }
-    else if (random_vehicle_type == 5)
+}
+
+/**
+ * Packs up to count active vehicles into a form that can be sent to another vehicle process, removing them from
+ * this one. Returns the number of vehicles packed
+ **/
+static int packVehicles(struct PackedVehicle *packed, int count)
+{
+    int packed_count = 0;
+    for (int i = 0; i < MAX_VEHICLES && packed_count < count; i++)
     {
-        vehicleType = BIKE;
+        if (!vehicles[i].active)
+            continue;
+        packVehicle(i, &packed[packed_count++]);
+        retireVehicle(i);
     }
-    // 返回激活的车辆的索引
-    return vehicleType;
+    return packed_count;
 }
 
 /**
- * Activates a vehicle with a specific type, will find an idle vehicle data
- * element and then initialise this with a random (but valid) route between
- * two junction. The new vehicle's index is returned,
- * or -1 if there are no free slots.
+ * Activates vehicles handed over from another vehicle process, they carry on from exactly where they were. Control
+ * only plans migrations this process has free slots for, should it somehow have none left the rest are dropped
  **/
-static int activateVehicle(enum VehicleType vehicleType)
-{
-    int id = findFreeVehicle();
-    if (id >= 0)
-    {
-        vehicles[id].id = id;
-        vehicles[id].active = 1;
-        vehicles[id].start_t = getCurrentSeconds();
-        vehicles[id].last_distance_check_secs = 0;
-        vehicles[id].speed = 0;
-        vehicles[id].remaining_distance = 0;
-        vehicles[id].arrived_road_time = 0;
-        vehicles[id].source = vehicles[id].dest = getRandomInteger(0, num_junctions);
-        while (vehicles[id].dest == vehicles[id].source)
-        {
-            // Ensure that the source and destination are different
-            vehicles[id].dest = getRandomInteger(0, num_junctions);
-            if (vehicles[id].dest != vehicles[id].source)
-            {
-                // See if there is a viable route between the source and destination
-                int next_jnct = planRoute(vehicles[id].source, vehicles[id].dest, roadMap, num_junctions, num_roads);
-                if (next_jnct == -1)
-                {
-                    // Regenerate source and dest
-                    vehicles[id].source = vehicles[id].dest = getRandomInteger(0, num_junctions);
-                }
-            }
-        }
-        vehicles[id].currentJunction = &roadMap[vehicles[id].source];
-        vehicles[id].currentJunction->num_vehicles++;
-        vehicles[id].currentJunction->total_number_vehicles++;
-        vehicles[id].roadOn = NULL;
-        if (vehicleType == CAR)
-        {
-            vehicles[id].maxSpeed = CAR_MAX_SPEED;
-            vehicles[id].passengers = getRandomInteger(1, CAR_PASSENGERS);
-            vehicles[id].fuel = getRandomInteger(CAR_MIN_FUEL, CAR_MAX_FUEL);
-        }
-        else if (vehicleType == BUS)
-        {
-            vehicles[id].maxSpeed = BUS_MAX_SPEED;
-            vehicles[id].passengers = getRandomInteger(1, BUS_PASSENGERS);
-            vehicles[id].fuel = getRandomInteger(BUS_MIN_FUEL, BUS_MAX_FUEL);
-        }
-        else if (vehicleType == MINI_BUS)
-        {
-            vehicles[id].maxSpeed = MINI_BUS_MAX_SPEED;
-            vehicles[id].passengers = getRandomInteger(1, MINI_BUS_PASSENGERS);
-            vehicles[id].fuel = getRandomInteger(MINI_BUS_MIN_FUEL, MINI_BUS_MAX_FUEL);
-        }
-        else if (vehicleType == COACH)
-        {
-            vehicles[id].maxSpeed = COACH_MAX_SPEED;
-            vehicles[id].passengers = getRandomInteger(1, COACH_PASSENGERS);
-            vehicles[id].fuel = getRandomInteger(COACH_MIN_FUEL, COACH_MAX_FUEL);
-        }
-        else if (vehicleType == MOTORBIKE)
+static void unpackVehicles(struct PackedVehicle *packed, int count)
+{
+    for (int k = 0; k < count; k++)
+    {
+        int i = findFreeVehicle();
+        if (i < 0)
         {
-            vehicles[id].maxSpeed = MOTOR_BIKE_MAX_SPEED;
-            vehicles[id].passengers = getRandomInteger(1, MOTOR_BIKE_PASSENGERS);
-            vehicles[id].fuel = getRandomInteger(MOTOR_BIKE_MIN_FUEL, MOTOR_BIKE_MAX_FUEL);
+            fprintf(stderr, "No free vehicle slots for %d migrated vehicles\n", count - k);
+            return;
         }
-        else if (vehicleType == BIKE)
+        struct PackedVehicle *p = &packed[k];
+        vehicles[i].id = i;
+        vehicles[i].active = 1;
+        vehicles[i].passengers = p->passengers;
+        vehicles[i].source = p->source;
+        vehicles[i].dest = p->dest;
+        vehicles[i].maxSpeed = p->maxSpeed;
+        vehicles[i].speed = p->speed;
+        vehicles[i].arrived_road_time = p->arrived_road_time;
+        vehicles[i].fuel = p->fuel;
+        vehicles[i].last_distance_check_secs = p->last_distance_check_secs;
+        vehicles[i].start_t = p->start_t;
+        vehicles[i].remaining_distance = p->remaining_distance;
+        vehicles[i].random = p->random;
+        vehicles[i].next_junction = ROUTE_UNKNOWN;
+        vehicles[i].currentJunction = NULL;
+        vehicles[i].roadOn = NULL;
+        // The totals were already counted on the process the vehicle came from, only the current counts move
+        if (p->junction >= 0)
         {
-            vehicles[id].maxSpeed = BIKE_MAX_SPEED;
-            vehicles[id].passengers = getRandomInteger(1, BIKE_PASSENGERS);
-            vehicles[id].fuel = getRandomInteger(BIKE_MIN_FUEL, BIKE_MAX_FUEL);
+            vehicles[i].currentJunction = &roadMap[p->junction];
+            vehicles[i].currentJunction->num_vehicles++;
         }
-        else
+        if (p->road_from >= 0)
         {
-            fprintf(stderr, "Unknown vehicle type\n");
+            vehicles[i].roadOn = &roadMap[p->road_from].roads[p->road_index];
+            vehicles[i].roadOn->numVehiclesOnRoad++;
         }
-        return id;
     }
-    return -1;
 }
 
-static int planRoute(int source_id, int dest_id, struct JunctionStruct *roadMap, int num_junctions, int num_roads)
+/**
+ * Sends the statistics of every junction and road to another vehicle process as coalesced records, marking the
+ * end of the phase so the receiver knows they are complete
+ **/
+static void sendStatistics(int dest)
 {
-    if (VERBOSE_ROUTE_PLANNER)
-        printf("Search for route from %d to %d\n", source_id, dest_id);
-    double *dist = (double *)malloc(sizeof(double) * num_junctions);
-    char *active = (char *)malloc(sizeof(char) * num_junctions);
-    struct JunctionStruct **prev = (struct JunctionStruct **)malloc(sizeof(struct JunctionStruct *) * num_junctions);
-
-    int activeJunctions = num_junctions;
     for (int i = 0; i < num_junctions; i++)
     {
-        active[i] = 1;
-        prev[i] = NULL;
-        if (i != source_id)
+        // Send data for each intersection
+        int junction_data[3] = {i, roadMap[i].total_number_vehicles, roadMap[i].total_number_crashes};
+        coalescePut(dest, JUNCTION_STATS_RECORD, junction_data, 3);
+
+        for (int j = 0; j < roadMap[i].num_roads; j++)
         {
-            dist[i] = LARGE_NUM;
+            // Send data for each road
+            int road_data[4] = {i, j, roadMap[i].roads[j].total_number_vehicles, roadMap[i].roads[j].max_concurrent_vehicles};
+            coalescePut(dest, ROAD_STATS_RECORD, road_data, 4);
         }
     }
-    dist[source_id] = 0;
-    while (activeJunctions > 0)
+    coalesceFlush(dest);
+}
+
+/**
+ * Adds the statistics of a junction received from another vehicle process to this process's totals
+ **/
+static void handleJunctionStats(int source, int record_tag, int *payload, int len)
+{
+    roadMap[payload[0]].total_number_vehicles += payload[1];
+    roadMap[payload[0]].total_number_crashes += payload[2];
+}
+
+/**
+ * Adds the statistics of a road received from another vehicle process to this process's totals
+ **/
+static void handleRoadStats(int source, int record_tag, int *payload, int len)
+{
+    roadMap[payload[0]].roads[payload[1]].total_number_vehicles += payload[2];
+    roadMap[payload[0]].roads[payload[1]].max_concurrent_vehicles += payload[3];
+}
+
+/**
+ * Asks this vehicle actor's routing actor for the next junction of every vehicle waiting at a junction, in a single
+ * message for the tick, and hands each vehicle its answer. The batch carries how many publications of the road
+ * speeds this actor has applied, so the routing actor can answer on the same speeds
+ **/
+static void exchangeRoutes(int publications, int *batch, int *answers)
+{
+    int routing_rank = ROADJUNCTION_RANK + 1 + (rank - first_vehicle_rank) % routing_settings.num_actors;
+    batch[0] = publications;
+    for (int k = 0; k < num_route_requests; k++)
     {
-        int v_idx = findIndexOfMinimum(dist, active, num_junctions);
-        if (v_idx == dest_id)
-            break;
-        struct JunctionStruct *v = &roadMap[v_idx];
-        active[v_idx] = 0;
-        activeJunctions--;
+        struct VehicleStruct *vehicle = &vehicles[route_request_vehicles[k]];
+        batch[2 * k + 1] = vehicle->currentJunction->id;
+        batch[2 * k + 2] = vehicle->dest;
+    }
+    MPI_Sendrecv(batch, 2 * num_route_requests + 1, MPI_INT, routing_rank, PLAN_ROUTE_TAG, answers, num_route_requests, MPI_INT,
+                 routing_rank, ROUTE_ANSWER_TAG, sim_comm, MPI_STATUS_IGNORE);
+    instrumentMessages(PLAN_ROUTE_TAG, 1, sizeof(int) * (2 * num_route_requests + 1));
+    for (int k = 0; k < num_route_requests; k++)
+    {
+        vehicles[route_request_vehicles[k]].next_junction = answers[k];
+    }
+    num_route_requests = 0;
+}
 
-        for (int i = 0; i < v->num_roads; i++)
+/**
+ * Runs a routing actor, which holds the routing mode's preprocessing so the vehicle actors need not and answers
+ * their batches of route queries. It is sent every publication of the road speeds by roadjunction, and a batch is
+ * only answered once the publications its vehicle actor had applied have been applied here too (the messages from
+ * roadjunction and the vehicle actors can arrive in either order). Control says how many publications there were
+ * once the run is over
+ **/
+static void RouteService()
+{
+    instrumentBegin(INSTR_LOAD_MAP);
+    perfRegionBegin(PERF_LOAD_MAP);
+    loadRoadMap(map_filename);
+    routingInit(map_filename);
+    perfRegionEnd(PERF_LOAD_MAP, 1);
+    instrumentEnd(INSTR_LOAD_MAP);
+
+    int *publication = (int *)malloc(sizeof(int) * (num_roads + num_junctions + 1));
+    int *changed_roads = (int *)malloc(sizeof(int) * (num_roads + 1));
+    int *batch = (int *)malloc(sizeof(int) * (2 * MAX_VEHICLES + 1));
+    int *answers = (int *)malloc(sizeof(int) * MAX_VEHICLES);
+    int applied = 0, num_publications = -1;
+    while (num_publications < 0 || applied < num_publications)
+    {
+        MPI_Status status;
+        MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, sim_comm, &status);
+        if (status.MPI_TAG == ROUTE_STOP_TAG)
+        {
+            MPI_Recv(&num_publications, 1, MPI_INT, status.MPI_SOURCE, ROUTE_STOP_TAG, sim_comm, MPI_STATUS_IGNORE);
+        }
+        else if (status.MPI_TAG == ROAD_SPEED_TAG)
         {
-            if (active[v->roads[i].to->id] && dist[v_idx] != LARGE_NUM)
+            receiveRoutingSpeeds(publication, changed_roads);
+            applied++;
+        }
+        else if (status.MPI_TAG == PLAN_ROUTE_TAG)
+        {
+            int length;
+            MPI_Get_count(&status, MPI_INT, &length);
+            MPI_Recv(batch, length, MPI_INT, status.MPI_SOURCE, PLAN_ROUTE_TAG, sim_comm, MPI_STATUS_IGNORE);
+            // Catch up with the speeds the batch was asked on
+            while (applied < batch[0])
             {
-                double alt = dist[v_idx] + v->roads[i].roadLength / (v->id == source_id ? v->roads[i].currentSpeed : v->roads[i].maxSpeed);
-                if (alt < dist[v->roads[i].to->id])
-                {
-                    dist[v->roads[i].to->id] = alt;
-                    prev[v->roads[i].to->id] = v;
-                }
+                receiveRoutingSpeeds(publication, changed_roads);
+                applied++;
             }
+            int num_queries = (length - 1) / 2;
+            for (int k = 0; k < num_queries; k++)
+            {
+                answers[k] = planRoute(batch[2 * k + 1], batch[2 * k + 2], roadMap, num_junctions, num_roads);
+            }
+            MPI_Send(answers, num_queries, MPI_INT, status.MPI_SOURCE, ROUTE_ANSWER_TAG, sim_comm);
+            instrumentMessages(ROUTE_ANSWER_TAG, 1, sizeof(int) * num_queries);
+            routing_counters.batches++;
         }
-    }
-    free(dist);
-    free(active);
-    int u_idx = dest_id;
-    int *route = (int *)malloc(sizeof(int) * num_junctions);
-    int route_len = 0;
-    if (prev[u_idx] != NULL || u_idx == source_id)
-    {
-        if (VERBOSE_ROUTE_PLANNER)
-            printf("Start at %d\n", u_idx);
-        while (prev[u_idx] != NULL)
+        else
         {
-            route[route_len] = u_idx;
-            u_idx = prev[u_idx]->id;
-            if (VERBOSE_ROUTE_PLANNER)
-                printf("Route %d\n", u_idx);
-            route_len++;
+            fprintf(stderr, "Error: Routing actor got a message with unexpected tag %d\n", status.MPI_TAG);
+            exit(-1);
         }
     }
-    free(prev);
-    if (route_len > 0)
+    free(publication);
+    free(changed_roads);
+    free(batch);
+    free(answers);
+    routingFinalise();
+    freeRoadMap();
+}
+
+/**
+ * Receives a publication of the road speeds from roadjunction on a routing actor and brings the routing up to date with them
+ **/
+static void receiveRoutingSpeeds(int *publication, int *changed_roads)
+{
+    MPI_Recv(publication, num_roads + num_junctions + 1, MPI_INT, ROADJUNCTION_RANK, ROAD_SPEED_TAG, sim_comm, MPI_STATUS_IGNORE);
+    int num_changed = applyPublication(publication, changed_roads);
+    if (num_changed > 0)
     {
-        int next_jnct = route[route_len - 1];
-        if (VERBOSE_ROUTE_PLANNER)
-            printf("Found next junction is %d\n", next_jnct);
-        free(route);
-        return next_jnct;
+        routingSpeedsChanged(changed_roads, num_changed);
     }
-    if (VERBOSE_ROUTE_PLANNER)
-        printf("Failed to find route between %d and %d\n", source_id, dest_id);
-    free(route);
-    return -1;
 }
 
-void writeDetailedInfo()
+/**
+ * Frees a set of persistent requests once an actor has finished with them
+ **/
+static void freeRequests(MPI_Request *requests, int num_requests)
 {
-    FILE *f = fopen("../result/results", "w");
-    for (int i = 0; i < num_junctions; i++)
+    for (int i = 0; i < num_requests; i++)
     {
-        fprintf(f, "Junction %d: %d total vehicles and %d crashes\n", i, roadMap[i].total_number_vehicles, roadMap[i].total_number_crashes);
-        for (int j = 0; j < roadMap[i].num_roads; j++)
-        {
-            fprintf(f, "--> Road from %d to %d: Total vehicles %d and %d maximum concurrently\n", roadMap[i].roads[j].from->id,
-                    roadMap[i].roads[j].to->id, roadMap[i].roads[j].total_number_vehicles, roadMap[i].roads[j].max_concurrent_vehicles);
-        }
+        MPI_Request_free(&requests[i]);
     }
-    fclose(f);
 }
@@ -0,0 +1,186 @@
+// src/checkpoint.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../include/data_structures.h"
+#include "../include/checkpoint.h"
+
+static void partFilename(char *, char *, int, int);
+
+/**
+ * The name of a part of the checkpoint taken after elapsed_mins minutes, parts of different checkpoints never share
+ * a name so a checkpoint is not disturbed while a newer one is being written
+ **/
+static void partFilename(char *buffer, char *filename, int elapsed_mins, int part)
+{
+    snprintf(buffer, CHECKPOINT_MAX_FILENAME, "%s.%d.%d", filename, elapsed_mins, part);
+}
+
+/**
+ * Writes the header to a temporary file and renames it over the checkpoint, so the checkpoint always names a
+ * complete set of parts even if the job is killed part way through
+ **/
+int writeCheckpointHeader(char *filename, struct CheckpointHeader *header)
+{
+    char temporary[CHECKPOINT_MAX_FILENAME];
+    snprintf(temporary, CHECKPOINT_MAX_FILENAME, "%s.tmp", filename);
+    memcpy(header->magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN);
+    FILE *f = fopen(temporary, "wb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    int written = fwrite(header, sizeof(struct CheckpointHeader), 1, f) == 1;
+    if (fclose(f) != 0 || !written)
+    {
+        return 0;
+    }
+    return rename(temporary, filename) == 0;
+}
+
+int readCheckpointHeader(char *filename, struct CheckpointHeader *header)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    int read = fread(header, sizeof(struct CheckpointHeader), 1, f) == 1;
+    fclose(f);
+    return read && memcmp(header->magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) == 0;
+}
+
+/**
+ * Writes a vehicle actor's part of the checkpoint: its vehicles, its random number stream and (unless they have
+ * been handed to another actor) the statistics it has counted at each junction and road
+ **/
+int writeCheckpointPart(char *filename, int elapsed_mins, int part, struct PackedVehicle *packed, int count, int with_statistics)
+{
+    char name[CHECKPOINT_MAX_FILENAME];
+    partFilename(name, filename, elapsed_mins, part);
+    struct CheckpointPart header;
+    memcpy(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN);
+    header.elapsed_mins = elapsed_mins;
+    header.num_vehicles = count;
+    header.num_junctions = num_junctions;
+    header.num_roads = num_roads;
+    header.random = random_stream;
+
+    int *junction_stats = (int *)calloc(2 * num_junctions, sizeof(int));
+    int *road_stats = (int *)calloc(2 * num_roads, sizeof(int));
+    for (int i = 0; i < num_junctions && with_statistics; i++)
+    {
+        junction_stats[2 * i] = roadMap[i].total_number_vehicles;
+        junction_stats[2 * i + 1] = roadMap[i].total_number_crashes;
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[i].roads[j];
+            road_stats[2 * road->id] = road->total_number_vehicles;
+            road_stats[2 * road->id + 1] = road->max_concurrent_vehicles;
+        }
+    }
+
+    int written = 0;
+    FILE *f = fopen(name, "wb");
+    if (f != NULL)
+    {
+        written = fwrite(&header, sizeof(struct CheckpointPart), 1, f) == 1 &&
+                  fwrite(packed, sizeof(struct PackedVehicle), count, f) == (size_t)count &&
+                  fwrite(junction_stats, sizeof(int), 2 * num_junctions, f) == (size_t)(2 * num_junctions) &&
+                  fwrite(road_stats, sizeof(int), 2 * num_roads, f) == (size_t)(2 * num_roads);
+        written = fclose(f) == 0 && written;
+    }
+    free(junction_stats);
+    free(road_stats);
+    return written;
+}
+
+/**
+ * Reads a part of the checkpoint taken after elapsed_mins minutes, the map must be the one it was taken with. The
+ * part's statistics are added to the road map's if add_statistics is set, so that every part's statistics can be
+ * picked up by exactly one actor however many there are now
+ **/
+struct PackedVehicle *readCheckpointPart(char *filename, int elapsed_mins, int part, int add_statistics, int *count,
+                                         struct RandomStream *random)
+{
+    char name[CHECKPOINT_MAX_FILENAME];
+    partFilename(name, filename, elapsed_mins, part);
+    FILE *f = fopen(name, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    struct CheckpointPart header;
+    if (fread(&header, sizeof(struct CheckpointPart), 1, f) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) != 0 ||
+        header.elapsed_mins != elapsed_mins || header.num_junctions != num_junctions || header.num_roads != num_roads)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    struct PackedVehicle *packed = (struct PackedVehicle *)malloc(sizeof(struct PackedVehicle) * (header.num_vehicles + 1));
+    int *junction_stats = (int *)malloc(sizeof(int) * 2 * num_junctions);
+    int *road_stats = (int *)malloc(sizeof(int) * 2 * num_roads);
+    int read = fread(packed, sizeof(struct PackedVehicle), header.num_vehicles, f) == (size_t)header.num_vehicles &&
+               fread(junction_stats, sizeof(int), 2 * num_junctions, f) == (size_t)(2 * num_junctions) &&
+               fread(road_stats, sizeof(int), 2 * num_roads, f) == (size_t)(2 * num_roads);
+    fclose(f);
+    if (read && add_statistics)
+    {
+        for (int i = 0; i < num_junctions; i++)
+        {
+            roadMap[i].total_number_vehicles += junction_stats[2 * i];
+            roadMap[i].total_number_crashes += junction_stats[2 * i + 1];
+            for (int j = 0; j < roadMap[i].num_roads; j++)
+            {
+                struct RoadStruct *road = &roadMap[i].roads[j];
+                road->total_number_vehicles += road_stats[2 * road->id];
+                road->max_concurrent_vehicles += road_stats[2 * road->id + 1];
+            }
+        }
+    }
+    free(junction_stats);
+    free(road_stats);
+    if (!read)
+    {
+        free(packed);
+        return NULL;
+    }
+    *count = header.num_vehicles;
+    *random = header.random;
+    return packed;
+}
+
+int countCheckpointVehicles(char *filename, int elapsed_mins, int num_parts)
+{
+    char name[CHECKPOINT_MAX_FILENAME];
+    int total = 0;
+    for (int part = 0; part < num_parts; part++)
+    {
+        partFilename(name, filename, elapsed_mins, part);
+        FILE *f = fopen(name, "rb");
+        if (f == NULL)
+        {
+            return -1;
+        }
+        struct CheckpointPart header;
+        int read = fread(&header, sizeof(struct CheckpointPart), 1, f) == 1 && memcmp(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) == 0;
+        fclose(f);
+        if (!read)
+        {
+            return -1;
+        }
+        total += header.num_vehicles;
+    }
+    return total;
+}
+
+void removeCheckpointParts(char *filename, int elapsed_mins, int num_parts)
+{
+    char name[CHECKPOINT_MAX_FILENAME];
+    for (int part = 0; part < num_parts; part++)
+    {
+        partFilename(name, filename, elapsed_mins, part);
+        remove(name);
+    }
+}
@@ -0,0 +1,191 @@
+// src/coalesce.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "mpi.h"
+#include "../include/coalesce.h"
+
+// MPI P2P tag to use for coalesced messages, it is important not to reuse this
+#define COALESCE_TAG 16382
+
+// Each coalesced message starts with a header saying whether it ends the sender's phase, followed by the
+// records which are each laid out as the record tag, the payload length and then the payload
+#define COALESCE_HEADER_LEN 1
+#define COALESCE_RECORD_HEADER_LEN 2
+
+// Per destination buffers, one is filled while the other may still be in flight
+struct CoalesceDestination
+{
+    int *filling, *in_flight;
+    int used, capacity;
+    MPI_Request request;
+};
+
+static struct CoalesceDestination *destinations = NULL;
+static CoalesceHandler handlers[COALESCE_MAX_RECORD_TAGS];
+static MPI_Comm coalesce_comm;
+static int num_destinations;
+static int flush_threshold;
+
+static void ensureCapacity(struct CoalesceDestination *, int);
+static void flushDestination(int, int);
+static void errorMessage(char *);
+
+/**
+ * Initialises the coalescing layer over the ranks of the communicator, buffers are only allocated for a destination
+ * once a record is put to it
+ **/
+void coalesceInit(int threshold, MPI_Comm comm)
+{
+    coalesce_comm = comm;
+    MPI_Comm_size(coalesce_comm, &num_destinations);
+    flush_threshold = threshold;
+    destinations = (struct CoalesceDestination *)malloc(sizeof(struct CoalesceDestination) * num_destinations);
+    for (int i = 0; i < num_destinations; i++)
+    {
+        destinations[i].filling = NULL;
+        destinations[i].in_flight = NULL;
+        destinations[i].used = COALESCE_HEADER_LEN;
+        destinations[i].capacity = 0;
+        destinations[i].request = MPI_REQUEST_NULL;
+    }
+    for (int i = 0; i < COALESCE_MAX_RECORD_TAGS; i++)
+        handlers[i] = NULL;
+}
+
+/**
+ * Waits for outstanding sends to complete and frees the buffers, anything not yet flushed is discarded
+ **/
+void coalesceFinalise()
+{
+    for (int i = 0; i < num_destinations; i++)
+    {
+        MPI_Wait(&destinations[i].request, MPI_STATUS_IGNORE);
+        free(destinations[i].filling);
+        free(destinations[i].in_flight);
+    }
+    free(destinations);
+    destinations = NULL;
+}
+
+void coalesceRegisterHandler(int record_tag, CoalesceHandler handler)
+{
+    if (record_tag < 0 || record_tag >= COALESCE_MAX_RECORD_TAGS)
+        errorMessage("Record tag out of range");
+    handlers[record_tag] = handler;
+}
+
+/**
+ * Appends a record to the destination's buffer, if the buffer then holds at least the threshold number of
+ * ints it is sent straight away (without marking the end of the phase)
+ **/
+void coalescePut(int dest, int record_tag, int *payload, int len)
+{
+    struct CoalesceDestination *d = &destinations[dest];
+    ensureCapacity(d, d->used + COALESCE_RECORD_HEADER_LEN + len);
+    d->filling[d->used++] = record_tag;
+    d->filling[d->used++] = len;
+    memcpy(&d->filling[d->used], payload, sizeof(int) * len);
+    d->used += len;
+    if (d->used - COALESCE_HEADER_LEN >= flush_threshold)
+        flushDestination(dest, 0);
+}
+
+/**
+ * Sends whatever is buffered for the destination along with the end of phase marker, this is how a sender that
+ * has no records for a destination still lets it know the phase is over
+ **/
+void coalesceFlush(int dest)
+{
+    ensureCapacity(&destinations[dest], COALESCE_HEADER_LEN);
+    flushDestination(dest, 1);
+}
+
+/**
+ * Marks a phase boundary, every destination that has been written to is sent its remaining records along with
+ * the end of phase marker (even if there are no records left)
+ **/
+void coalesceFlushAll()
+{
+    for (int i = 0; i < num_destinations; i++)
+    {
+        if (destinations[i].capacity > 0)
+            flushDestination(i, 1);
+    }
+}
+
+/**
+ * Receives coalesced messages from any source and calls the registered handler for every record, returning
+ * once num_senders end of phase markers have been received
+ **/
+void coalesceReceivePhase(int num_senders)
+{
+    int *buffer = NULL, capacity = 0;
+    while (num_senders > 0)
+    {
+        MPI_Status status;
+        int count;
+        MPI_Probe(MPI_ANY_SOURCE, COALESCE_TAG, coalesce_comm, &status);
+        MPI_Get_count(&status, MPI_INT, &count);
+        if (count > capacity)
+        {
+            capacity = count;
+            buffer = (int *)realloc(buffer, sizeof(int) * capacity);
+        }
+        MPI_Recv(buffer, count, MPI_INT, status.MPI_SOURCE, COALESCE_TAG, coalesce_comm, MPI_STATUS_IGNORE);
+        int position = COALESCE_HEADER_LEN;
+        while (position < count)
+        {
+            int record_tag = buffer[position], len = buffer[position + 1];
+            if (record_tag < 0 || record_tag >= COALESCE_MAX_RECORD_TAGS || handlers[record_tag] == NULL)
+                errorMessage("No handler registered for record");
+            handlers[record_tag](status.MPI_SOURCE, record_tag, &buffer[position + COALESCE_RECORD_HEADER_LEN], len);
+            position += COALESCE_RECORD_HEADER_LEN + len;
+        }
+        if (buffer[0])
+            num_senders--;
+    }
+    free(buffer);
+}
+
+/**
+ * Grows both of a destination's buffers together (so they can always be swapped) to hold at least needed ints
+ **/
+static void ensureCapacity(struct CoalesceDestination *d, int needed)
+{
+    if (needed > d->capacity)
+    {
+        int capacity = needed > flush_threshold + COALESCE_HEADER_LEN ? needed : flush_threshold + COALESCE_HEADER_LEN;
+        MPI_Wait(&d->request, MPI_STATUS_IGNORE);
+        d->filling = (int *)realloc(d->filling, sizeof(int) * capacity);
+        d->in_flight = (int *)realloc(d->in_flight, sizeof(int) * capacity);
+        d->capacity = capacity;
+    }
+}
+
+/**
+ * Sends the records buffered for a destination, the previous send to this destination must have completed
+ * before its buffer can be reused to fill
+ **/
+static void flushDestination(int dest, int end_of_phase)
+{
+    struct CoalesceDestination *d = &destinations[dest];
+    MPI_Wait(&d->request, MPI_STATUS_IGNORE);
+    int *sending = d->filling;
+    d->filling = d->in_flight;
+    d->in_flight = sending;
+    sending[0] = end_of_phase;
+    MPI_Isend(sending, d->used, MPI_INT, dest, COALESCE_TAG, coalesce_comm, &d->request);
+    d->used = COALESCE_HEADER_LEN;
+}
+
+/**
+ * Writes an error message to stderr and MPI Aborts
+ **/
+static void errorMessage(char *message)
+{
+    int rank;
+    MPI_Comm_rank(coalesce_comm, &rank);
+    fprintf(stderr, "%4d: [Coalesce] %s\n", rank, message);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
@@ -0,0 +1,159 @@
+// src/ensemble.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "mpi.h"
+#include "../include/data_structures.h"
+#include "../include/simulation.h"
+#include "../include/ensemble.h"
+
+static int num_members = 1;
+static MPI_Comm node_comm = MPI_COMM_NULL;
+static MPI_Win map_window = MPI_WIN_NULL;
+
+static int memberOfRank(int);
+static int firstRankOfMember(int);
+
+/**
+ * The member a world rank belongs to, each member is a contiguous block of ranks and their sizes differ by at most one
+ **/
+static int memberOfRank(int r)
+{
+    return (int)((long)r * num_members / world_size);
+}
+
+/**
+ * The lowest world rank in a member, the inverse of memberOfRank
+ **/
+static int firstRankOfMember(int member)
+{
+    return (int)(((long)member * world_size + num_members - 1) / num_members);
+}
+
+/**
+ * Splits MPI_COMM_WORLD into the members, with a single member the simulation simply runs over MPI_COMM_WORLD. This is
+ * collective over MPI_COMM_WORLD
+ **/
+void ensembleInit(int members)
+{
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    num_members = members;
+    ensemble_member = memberOfRank(world_rank);
+    memset(ensemble_totals, 0, sizeof(ensemble_totals));
+    if (num_members == 1)
+    {
+        sim_comm = MPI_COMM_WORLD;
+        return;
+    }
+    MPI_Comm_split(MPI_COMM_WORLD, ensemble_member, world_rank, &sim_comm);
+}
+
+/**
+ * The lowest rank on each node parses the road map into an image in a shared memory window, which every actor on the
+ * node then builds its road map from rather than parsing the file again. This is collective over MPI_COMM_WORLD
+ **/
+void ensembleShareMap(char *filename)
+{
+    int node_rank, length = 0, *image = NULL, *shared;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    if (node_rank == 0)
+    {
+        image = readRoadMapImage(filename);
+        length = roadMapImageLength(image);
+    }
+    MPI_Bcast(&length, 1, MPI_INT, 0, node_comm);
+    MPI_Win_allocate_shared(node_rank == 0 ? sizeof(int) * length : 0, sizeof(int), MPI_INFO_NULL, node_comm, &shared,
+                            &map_window);
+    if (node_rank == 0)
+    {
+        memcpy(shared, image, sizeof(int) * length);
+        free(image);
+    }
+    // The image is only read from here on, so one fence makes the leader's copy visible to the whole node
+    MPI_Win_fence(0, map_window);
+    MPI_Aint bytes;
+    int disp_unit;
+    MPI_Win_shared_query(map_window, 0, &bytes, &disp_unit, &shared_map_image);
+}
+
+/**
+ * Gathers the totals kept by every member's control onto world rank 0, which prints each member followed by the
+ * mean, minimum and maximum over the members. This is collective over MPI_COMM_WORLD and prints nothing for a single
+ * member, whose control has already printed its totals
+ **/
+void ensembleReport(unsigned long long seed)
+{
+    int *all = NULL;
+    if (world_rank == 0)
+    {
+        all = (int *)malloc(sizeof(int) * ENSEMBLE_TOTALS_LEN * world_size);
+    }
+    MPI_Gather(ensemble_totals, ENSEMBLE_TOTALS_LEN, MPI_INT, all, ENSEMBLE_TOTALS_LEN, MPI_INT, 0, MPI_COMM_WORLD);
+    if (world_rank != 0)
+    {
+        return;
+    }
+    if (num_members > 1)
+    {
+        static const char *names[ENSEMBLE_TOTALS_LEN] = {NULL, "mins", "vehicles", "passengers delivered",
+                                                         "passengers stranded", "crashed vehicles",
+                                                         "vehicles exhausted fuel"};
+        double sum[ENSEMBLE_TOTALS_LEN] = {0};
+        int min[ENSEMBLE_TOTALS_LEN], max[ENSEMBLE_TOTALS_LEN], reported = 0;
+        for (int r = 0; r < world_size; r++)
+        {
+            int *totals = &all[r * ENSEMBLE_TOTALS_LEN];
+            if (!totals[ENS_RAN_CONTROL])
+            {
+                continue;
+            }
+            int member = memberOfRank(r);
+            printf("[Ensemble] Member %d (seed %llu, ranks %d-%d): %d mins, %d vehicles, %d passengers delivered, "
+                   "%d passengers stranded, %d crashed vehicles, %d vehicles exhausted fuel\n",
+                   member, seed + member, firstRankOfMember(member), firstRankOfMember(member + 1) - 1,
+                   totals[ENS_ELAPSED_MINS], totals[ENS_VEHICLES], totals[ENS_DELIVERED], totals[ENS_STRANDED],
+                   totals[ENS_CRASHED], totals[ENS_EXHAUSTED]);
+            for (int i = ENS_ELAPSED_MINS; i < ENSEMBLE_TOTALS_LEN; i++)
+            {
+                sum[i] += totals[i];
+                min[i] = reported == 0 || totals[i] < min[i] ? totals[i] : min[i];
+                max[i] = reported == 0 || totals[i] > max[i] ? totals[i] : max[i];
+            }
+            reported++;
+        }
+        if (reported > 0)
+        {
+            printf("[Ensemble] Over %d members:", reported);
+            for (int i = ENS_VEHICLES; i < ENSEMBLE_TOTALS_LEN; i++)
+            {
+                printf("%s %s mean %.1f (min %d, max %d)", i == ENS_VEHICLES ? "" : ",", names[i], sum[i] / reported,
+                       min[i], max[i]);
+            }
+            printf("\n");
+        }
+        if (reported < num_members)
+        {
+            fprintf(stderr, "Warning: Only %d of the %d ensemble members reported their totals\n", reported, num_members);
+        }
+    }
+    free(all);
+}
+
+/**
+ * Frees the shared road map and the member's communicator, collective over MPI_COMM_WORLD
+ **/
+void ensembleFinalise()
+{
+    if (map_window != MPI_WIN_NULL)
+    {
+        shared_map_image = NULL;
+        MPI_Win_free(&map_window);
+        MPI_Comm_free(&node_comm);
+    }
+    if (sim_comm != MPI_COMM_WORLD)
+    {
+        MPI_Comm_free(&sim_comm);
+    }
+}
@@ -0,0 +1,430 @@
+// src/instrument.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "mpi.h"
+#include "../include/instrument.h"
+
+// Names of the phases as printed and written to JSON, in the order of enum InstrumentPhase
+static const char *phase_names[INSTR_NUM_PHASES] = {"load_map", "control_tick", "control_wait", "junction_exchange",
+                                                    "junction_update", "spawn", "migration", "road_exchange",
+                                                    "vehicle_update", "results", "stats", "routing",
+                                                    "route_exchange"};
+
+// Each thread of the threaded engine measures itself, and the vehicle threads add theirs to the process's totals
+// below as they finish so the rank reports them along with the main thread's
+static _Thread_local double phase_start[INSTR_NUM_PHASES];
+static _Thread_local double phase_seconds[INSTR_NUM_PHASES];
+static _Thread_local long phase_calls[INSTR_NUM_PHASES];
+static _Thread_local long tag_messages[INSTRUMENT_MAX_TAGS + 1];
+static _Thread_local long tag_bytes[INSTRUMENT_MAX_TAGS + 1];
+static _Thread_local int actor = -1;
+
+// A phase that has ended, recorded when tracing with the times relative to when tracing started
+struct TraceEvent
+{
+    int phase;
+    double start, duration;
+};
+
+static _Thread_local struct TraceEvent *trace = NULL;
+static _Thread_local long trace_count = 0;
+static _Thread_local int trace_capacity = 0;
+static double trace_origin = 0;
+
+// What the finished threads of the threaded engine measured, added to the rank's own measurements when reporting
+static pthread_mutex_t merged_lock = PTHREAD_MUTEX_INITIALIZER;
+static double merged_seconds[INSTR_NUM_PHASES];
+static long merged_calls[INSTR_NUM_PHASES];
+static long merged_messages[INSTRUMENT_MAX_TAGS + 1];
+static long merged_bytes[INSTRUMENT_MAX_TAGS + 1];
+static int merged_threads = 0;
+
+// The measurements of a rank are flattened into one array of doubles for the gather, laid out as below
+#define REPORT_ACTOR 0
+#define REPORT_CALLS 1
+#define REPORT_SECONDS (REPORT_CALLS + INSTR_NUM_PHASES)
+#define REPORT_MESSAGES (REPORT_SECONDS + INSTR_NUM_PHASES)
+#define REPORT_BYTES (REPORT_MESSAGES + INSTRUMENT_MAX_TAGS + 1)
+#define REPORT_LEN (REPORT_BYTES + INSTRUMENT_MAX_TAGS + 1)
+
+static void printSummaryLine(double *, int, int, int, int, const char *, int);
+static void writeJson(char *, double *, int, const char *const *, int);
+static const char *actorName(int, const char *const *, int);
+static double instrumentClock();
+
+#if INSTRUMENT_ENABLED
+void instrumentBegin(enum InstrumentPhase phase)
+{
+    phase_start[phase] = instrumentClock();
+}
+
+void instrumentEnd(enum InstrumentPhase phase)
+{
+    double end = instrumentClock();
+    phase_seconds[phase] += end - phase_start[phase];
+    phase_calls[phase]++;
+    if (trace != NULL)
+    {
+        struct TraceEvent *event = &trace[trace_count++ % trace_capacity];
+        event->phase = phase;
+        event->start = phase_start[phase] - trace_origin;
+        event->duration = end - phase_start[phase];
+    }
+}
+
+void instrumentMessages(int tag, int count, long bytes)
+{
+    if (tag < 0 || tag > INSTRUMENT_MAX_TAGS)
+        tag = INSTRUMENT_MAX_TAGS;
+    tag_messages[tag] += count;
+    tag_bytes[tag] += bytes;
+}
+
+/**
+ * Adds the calling thread's measurements to the rank's, for a thread of the threaded engine that is about to finish.
+ * Its trace events (the vehicle threads never start tracing) are not kept
+ **/
+void instrumentMergeThread()
+{
+    pthread_mutex_lock(&merged_lock);
+    for (int i = 0; i < INSTR_NUM_PHASES; i++)
+    {
+        merged_seconds[i] += phase_seconds[i];
+        merged_calls[i] += phase_calls[i];
+    }
+    for (int i = 0; i <= INSTRUMENT_MAX_TAGS; i++)
+    {
+        merged_messages[i] += tag_messages[i];
+        merged_bytes[i] += tag_bytes[i];
+    }
+    merged_threads++;
+    pthread_mutex_unlock(&merged_lock);
+}
+#endif
+
+void instrumentSetActor(int actor_type)
+{
+    actor = actor_type;
+}
+
+/**
+ * Starts tracing, the ranks synchronise first so that their event times share a common origin
+ **/
+void instrumentStartTrace(int capacity)
+{
+#if INSTRUMENT_ENABLED
+    trace_capacity = capacity;
+    trace = (struct TraceEvent *)malloc(sizeof(struct TraceEvent) * trace_capacity);
+    MPI_Barrier(MPI_COMM_WORLD);
+    trace_origin = instrumentClock();
+#endif
+}
+
+/**
+ * Gathers the trace events of every rank to rank 0, which writes them in the Chrome trace event format with each rank
+ * as a process named after the actor it ran. Every phase is a complete event, so the waits show up as gaps in the
+ * ranks doing the work and as long blocks in the waiting ones. Must be called by all ranks
+ **/
+void instrumentWriteTrace(const char *const *actor_names, int num_actors, char *filename)
+{
+#if INSTRUMENT_ENABLED
+    if (trace == NULL)
+        return;
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // Unroll the ring buffer oldest first, each event travels as its phase, start and duration
+    int kept = trace_count < trace_capacity ? (int)trace_count : trace_capacity;
+    double *local = (double *)malloc(sizeof(double) * 3 * (kept > 0 ? kept : 1));
+    for (int i = 0; i < kept; i++)
+    {
+        struct TraceEvent *event = &trace[(trace_count - kept + i) % trace_capacity];
+        local[i * 3] = event->phase;
+        local[i * 3 + 1] = event->start;
+        local[i * 3 + 2] = event->duration;
+    }
+    int header[3] = {kept * 3, actor, (int)(trace_count - kept)};
+    int *headers = NULL, *displs = NULL, *counts = NULL;
+    double *all = NULL;
+    if (rank == 0)
+        headers = (int *)malloc(sizeof(int) * 3 * size);
+    MPI_Gather(header, 3, MPI_INT, headers, 3, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        displs = (int *)malloc(sizeof(int) * size);
+        counts = (int *)malloc(sizeof(int) * size);
+        int total = 0;
+        for (int r = 0; r < size; r++)
+        {
+            counts[r] = headers[r * 3];
+            displs[r] = total;
+            total += counts[r];
+        }
+        all = (double *)malloc(sizeof(double) * (total > 0 ? total : 1));
+    }
+    MPI_Gatherv(local, kept * 3, MPI_DOUBLE, all, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    free(local);
+    free(trace);
+    trace = NULL;
+    if (rank != 0)
+        return;
+
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: Can not open '%s' to write the trace\n", filename);
+    }
+    else
+    {
+        long dropped = 0;
+        fprintf(f, "{\"traceEvents\": [\n");
+        for (int r = 0; r < size; r++)
+        {
+            const char *name = actorName(headers[r * 3 + 1], actor_names, num_actors);
+            dropped += headers[r * 3 + 2];
+            fprintf(f, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"rank %d (%s)\"}}",
+                    r == 0 ? "" : ",\n", r, r, name);
+            fprintf(f, ",\n{\"name\": \"process_sort_index\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"sort_index\": %d}}", r, r);
+            for (int i = 0; i < counts[r]; i += 3)
+            {
+                double *event = &all[displs[r] + i];
+                fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": 0}",
+                        phase_names[(int)event[0]], name, event[1] * 1e6, event[2] * 1e6, r);
+            }
+        }
+        fprintf(f, "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": %ld}}\n", dropped);
+        fclose(f);
+    }
+    free(headers);
+    free(displs);
+    free(counts);
+    free(all);
+#endif
+}
+
+/**
+ * Gathers the measurements of every rank to rank 0, which prints the min, mean and max of each one across the ranks
+ * that ran the same actor. If a filename is given then the per rank measurements and the summary are also written
+ * there as JSON. Must be called by all ranks
+ **/
+void instrumentReport(const char *const *actor_names, int num_actors, char *json_filename)
+{
+#if INSTRUMENT_ENABLED
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    double local[REPORT_LEN];
+    local[REPORT_ACTOR] = actor;
+    for (int i = 0; i < INSTR_NUM_PHASES; i++)
+    {
+        local[REPORT_CALLS + i] = phase_calls[i] + merged_calls[i];
+        local[REPORT_SECONDS + i] = phase_seconds[i] + merged_seconds[i];
+    }
+    for (int i = 0; i <= INSTRUMENT_MAX_TAGS; i++)
+    {
+        local[REPORT_MESSAGES + i] = tag_messages[i] + merged_messages[i];
+        local[REPORT_BYTES + i] = tag_bytes[i] + merged_bytes[i];
+    }
+
+    double *all = NULL;
+    if (rank == 0)
+        all = (double *)malloc(sizeof(double) * REPORT_LEN * size);
+    MPI_Gather(local, REPORT_LEN, MPI_DOUBLE, all, REPORT_LEN, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank != 0)
+        return;
+
+    printf("[Instrument] Per rank min/mean/max, grouped by actor\n");
+    if (merged_threads > 0)
+    {
+        printf("[Instrument] Rank 0 includes the measurements of its %d vehicle threads\n", merged_threads);
+    }
+    for (int a = -1; a < num_actors; a++)
+    {
+        int ranks = 0;
+        for (int r = 0; r < size; r++)
+        {
+            if ((int)all[r * REPORT_LEN + REPORT_ACTOR] == a)
+                ranks++;
+        }
+        if (ranks == 0)
+            continue;
+        printf("[Instrument] %s (%d ranks)\n", actorName(a, actor_names, num_actors), ranks);
+        for (int i = 0; i < INSTR_NUM_PHASES; i++)
+            printSummaryLine(all, size, a, REPORT_CALLS + i, REPORT_SECONDS + i, phase_names[i], 0);
+        for (int i = 0; i <= INSTRUMENT_MAX_TAGS; i++)
+            printSummaryLine(all, size, a, REPORT_MESSAGES + i, REPORT_BYTES + i, NULL, i);
+    }
+    if (json_filename != NULL)
+        writeJson(json_filename, all, size, actor_names, num_actors);
+    free(all);
+#endif
+}
+
+/**
+ * Computes the min, mean and max of two measurements across the ranks running an actor, returned as
+ * {min, mean, max} for the first followed by the second
+ **/
+static void summarise(double *all, int size, int actor_type, int first, int second, double *out)
+{
+    int ranks = 0;
+    for (int j = 0; j < 2; j++)
+    {
+        out[j * 3] = -1;
+        out[j * 3 + 1] = 0;
+        out[j * 3 + 2] = 0;
+    }
+    for (int r = 0; r < size; r++)
+    {
+        double *values = &all[r * REPORT_LEN];
+        if ((int)values[REPORT_ACTOR] != actor_type)
+            continue;
+        ranks++;
+        for (int j = 0; j < 2; j++)
+        {
+            double value = values[j == 0 ? first : second];
+            if (out[j * 3] < 0 || value < out[j * 3])
+                out[j * 3] = value;
+            out[j * 3 + 1] += value;
+            if (value > out[j * 3 + 2])
+                out[j * 3 + 2] = value;
+        }
+    }
+    for (int j = 0; j < 2; j++)
+        out[j * 3 + 1] = ranks > 0 ? out[j * 3 + 1] / ranks : 0;
+}
+
+/**
+ * Prints one line of the summary, a phase if name is given or otherwise a message tag. Nothing is printed when no
+ * rank running the actor recorded anything
+ **/
+static void printSummaryLine(double *all, int size, int actor_type, int first, int second, const char *name, int tag)
+{
+    double s[6];
+    summarise(all, size, actor_type, first, second, s);
+    if (s[2] == 0)
+        return;
+    if (name != NULL)
+    {
+        printf("[Instrument]   %-18s calls %.0f/%.1f/%.0f  seconds %.4f/%.4f/%.4f\n", name, s[0], s[1], s[2], s[3],
+               s[4], s[5]);
+    }
+    else if (tag == INSTRUMENT_MAX_TAGS)
+    {
+        printf("[Instrument]   tag other          sent %.0f/%.1f/%.0f  bytes %.0f/%.1f/%.0f\n", s[0], s[1], s[2], s[3],
+               s[4], s[5]);
+    }
+    else
+    {
+        printf("[Instrument]   tag %-14d sent %.0f/%.1f/%.0f  bytes %.0f/%.1f/%.0f\n", tag, s[0], s[1], s[2], s[3],
+               s[4], s[5]);
+    }
+}
+
+/**
+ * Writes the measurements of every rank, followed by the per actor summary, as JSON
+ **/
+static void writeJson(char *filename, double *all, int size, const char *const *actor_names, int num_actors)
+{
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: Can not open '%s' to write the instrumentation\n", filename);
+        return;
+    }
+    fprintf(f, "{\n  \"ranks\": [\n");
+    for (int r = 0; r < size; r++)
+    {
+        double *values = &all[r * REPORT_LEN];
+        fprintf(f, "    {\"rank\": %d, \"actor\": \"%s\", \"phases\": {", r,
+                actorName((int)values[REPORT_ACTOR], actor_names, num_actors));
+        int first = 1;
+        for (int i = 0; i < INSTR_NUM_PHASES; i++)
+        {
+            if (values[REPORT_CALLS + i] == 0)
+                continue;
+            fprintf(f, "%s\"%s\": {\"calls\": %.0f, \"seconds\": %.6f}", first ? "" : ", ", phase_names[i],
+                    values[REPORT_CALLS + i], values[REPORT_SECONDS + i]);
+            first = 0;
+        }
+        fprintf(f, "}, \"messages\": {");
+        first = 1;
+        for (int i = 0; i <= INSTRUMENT_MAX_TAGS; i++)
+        {
+            if (values[REPORT_MESSAGES + i] == 0)
+                continue;
+            if (i == INSTRUMENT_MAX_TAGS)
+                fprintf(f, "%s\"other\": ", first ? "" : ", ");
+            else
+                fprintf(f, "%s\"%d\": ", first ? "" : ", ", i);
+            fprintf(f, "{\"count\": %.0f, \"bytes\": %.0f}", values[REPORT_MESSAGES + i], values[REPORT_BYTES + i]);
+            first = 0;
+        }
+        fprintf(f, "}}%s\n", r < size - 1 ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"summary\": {");
+    int first_actor = 1;
+    for (int a = -1; a < num_actors; a++)
+    {
+        double s[6];
+        int present = 0;
+        for (int r = 0; r < size; r++)
+            present |= (int)all[r * REPORT_LEN + REPORT_ACTOR] == a;
+        if (!present)
+            continue;
+        fprintf(f, "%s\n    \"%s\": {\"phases\": {", first_actor ? "" : ",", actorName(a, actor_names, num_actors));
+        first_actor = 0;
+        int first = 1;
+        for (int i = 0; i < INSTR_NUM_PHASES; i++)
+        {
+            summarise(all, size, a, REPORT_CALLS + i, REPORT_SECONDS + i, s);
+            if (s[2] == 0)
+                continue;
+            fprintf(f,
+                    "%s\"%s\": {\"calls\": {\"min\": %.0f, \"mean\": %.3f, \"max\": %.0f}, "
+                    "\"seconds\": {\"min\": %.6f, \"mean\": %.6f, \"max\": %.6f}}",
+                    first ? "" : ", ", phase_names[i], s[0], s[1], s[2], s[3], s[4], s[5]);
+            first = 0;
+        }
+        fprintf(f, "}, \"messages\": {");
+        first = 1;
+        for (int i = 0; i <= INSTRUMENT_MAX_TAGS; i++)
+        {
+            summarise(all, size, a, REPORT_MESSAGES + i, REPORT_BYTES + i, s);
+            if (s[2] == 0)
+                continue;
+            if (i == INSTRUMENT_MAX_TAGS)
+                fprintf(f, "%s\"other\": ", first ? "" : ", ");
+            else
+                fprintf(f, "%s\"%d\": ", first ? "" : ", ", i);
+            fprintf(f,
+                    "{\"count\": {\"min\": %.0f, \"mean\": %.3f, \"max\": %.0f}, "
+                    "\"bytes\": {\"min\": %.0f, \"mean\": %.3f, \"max\": %.0f}}",
+                    s[0], s[1], s[2], s[3], s[4], s[5]);
+            first = 0;
+        }
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n  }\n}\n");
+    fclose(f);
+}
+
+static const char *actorName(int actor_type, const char *const *actor_names, int num_actors)
+{
+    if (actor_type >= 0 && actor_type < num_actors)
+        return actor_names[actor_type];
+    return actor_type == -1 ? "pool" : "unknown";
+}
+
+/**
+ * Seconds from an arbitrary point, read without MPI so that any thread of the threaded engine can time its phases
+ **/
+static double instrumentClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -0,0 +1,128 @@
+// src/live_metrics.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../include/live_metrics.h"
+
+// Control's mapping of the segment, NULL when the metrics are not being published
+static struct LiveMetrics *metrics = NULL;
+
+/**
+ * Creates (or replaces) the shared memory segment and maps it, so that control can publish the run's progress to any
+ * process on the node that maps it too. A run carries on without the metrics if the segment can not be created
+ **/
+int liveMetricsOpen(char *name, unsigned long long seed, int member)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Warning: Can not create the live metrics segment '%s', carrying on without it\n", name);
+        return 0;
+    }
+    if (ftruncate(fd, sizeof(struct LiveMetrics)) != 0)
+    {
+        fprintf(stderr, "Warning: Can not size the live metrics segment '%s', carrying on without it\n", name);
+        close(fd);
+        return 0;
+    }
+    void *segment = mmap(NULL, sizeof(struct LiveMetrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        fprintf(stderr, "Warning: Can not map the live metrics segment '%s', carrying on without it\n", name);
+        return 0;
+    }
+    metrics = (struct LiveMetrics *)segment;
+    memset(metrics, 0, sizeof(struct LiveMetrics));
+    metrics->seed = seed;
+    metrics->member = member;
+    metrics->running = 1;
+    // A reader that sees the version sees everything before it
+    atomic_thread_fence(memory_order_release);
+    metrics->version = LIVE_METRICS_VERSION;
+    return 1;
+}
+
+/**
+ * Makes the sequence odd, so readers throw away any copy taken while the caller fills in the metrics
+ **/
+struct LiveMetrics *liveMetricsBegin()
+{
+    if (metrics == NULL)
+    {
+        return NULL;
+    }
+    unsigned long long sequence = atomic_load_explicit(&metrics->sequence, memory_order_relaxed);
+    atomic_store_explicit(&metrics->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return metrics;
+}
+
+/**
+ * Adds the tick's time to the histogram and the percentiles taken from it, then makes the sequence even again
+ **/
+void liveMetricsEnd(struct LiveMetrics *m, double tick_seconds)
+{
+    m->last_tick_seconds = tick_seconds;
+    m->tick_histogram[liveMetricsBucket(tick_seconds)]++;
+    m->tick_percentiles[0] = liveMetricsPercentile(m->tick_histogram, 0.5);
+    m->tick_percentiles[1] = liveMetricsPercentile(m->tick_histogram, 0.9);
+    m->tick_percentiles[2] = liveMetricsPercentile(m->tick_histogram, 0.99);
+    unsigned long long sequence = atomic_load_explicit(&m->sequence, memory_order_relaxed);
+    atomic_store_explicit(&m->sequence, sequence + 1, memory_order_release);
+}
+
+void liveMetricsClose()
+{
+    struct LiveMetrics *m = liveMetricsBegin();
+    if (m == NULL)
+    {
+        return;
+    }
+    m->running = 0;
+    unsigned long long sequence = atomic_load_explicit(&m->sequence, memory_order_relaxed);
+    atomic_store_explicit(&m->sequence, sequence + 1, memory_order_release);
+    munmap(metrics, sizeof(struct LiveMetrics));
+    metrics = NULL;
+}
+
+/**
+ * Bucket zero holds the ticks under a microsecond, and bucket b those under 2^(b / LIVE_METRICS_BUCKETS_PER_DOUBLING)
+ * microseconds that are not in an earlier one. The last bucket also holds anything longer
+ **/
+int liveMetricsBucket(double seconds)
+{
+    double usecs = seconds * 1e6;
+    if (usecs < 1.0)
+    {
+        return 0;
+    }
+    int bucket = (int)(LIVE_METRICS_BUCKETS_PER_DOUBLING * log2(usecs)) + 1;
+    return bucket < LIVE_METRICS_BUCKETS ? bucket : LIVE_METRICS_BUCKETS - 1;
+}
+
+double liveMetricsPercentile(unsigned long long *histogram, double fraction)
+{
+    unsigned long long total = 0, seen = 0;
+    for (int b = 0; b < LIVE_METRICS_BUCKETS; b++)
+    {
+        total += histogram[b];
+    }
+    if (total == 0)
+    {
+        return 0.0;
+    }
+    for (int b = 0; b < LIVE_METRICS_BUCKETS; b++)
+    {
+        seen += histogram[b];
+        if (seen >= fraction * total)
+        {
+            return pow(2.0, (double)b / LIVE_METRICS_BUCKETS_PER_DOUBLING) / 1e6;
+        }
+    }
+    return pow(2.0, (double)(LIVE_METRICS_BUCKETS - 1) / LIVE_METRICS_BUCKETS_PER_DOUBLING) / 1e6;
+}
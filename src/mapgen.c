@@ -0,0 +1,464 @@
+// src/mapgen.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../include/data_structures.h"
+#include "../include/mapgen.h"
+
+// Names of the families as given on the command line, in the order of enum MapFamily
+static const char *family_names[] = {"grid", "geometric", "scalefree"};
+
+// State of the splitmix64 generator, so that a seed always gives the same map
+static unsigned long long random_state;
+
+/**
+ * Generates a road map in the format read by the simulation (a `# Road layout:` section of roads given as
+ * `from to length speed` followed by a `# Traffic lights:` section of junction ids) from a family of graphs, so that
+ * maps of any size can be made for scaling studies
+ **/
+int main(int argc, char *argv[])
+{
+    struct MapParameters params;
+    if (!parseParameters(argc, argv, &params))
+    {
+        printUsage(argv[0]);
+        return -1;
+    }
+    random_state = params.seed;
+
+    struct MapGraph graph;
+    initGraph(&graph, params.junctions);
+    if (params.family == GRID_MAP)
+    {
+        generateGrid(&graph, &params);
+    }
+    else if (params.family == GEOMETRIC_MAP)
+    {
+        generateGeometric(&graph, &params);
+    }
+    else
+    {
+        generateScaleFree(&graph, &params);
+    }
+    // Every vehicle must be able to find a route, so join up anything left disconnected
+    connectComponents(&graph, &params);
+
+    FILE *f = params.output == NULL ? stdout : fopen(params.output, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error opening '%s' to write the map\n", params.output);
+        return -1;
+    }
+    writeMap(f, &graph, &params);
+    if (f != stdout)
+        fclose(f);
+    freeGraph(&graph);
+    return 0;
+}
+
+/**
+ * Parses the command line, returns zero if it is not valid
+ **/
+static int parseParameters(int argc, char *argv[], struct MapParameters *params)
+{
+    params->family = GRID_MAP;
+    params->junctions = MAPGEN_DEFAULT_JUNCTIONS;
+    params->degree = MAPGEN_DEFAULT_DEGREE;
+    params->min_length = MAPGEN_DEFAULT_MIN_LENGTH;
+    params->max_length = MAPGEN_DEFAULT_MAX_LENGTH;
+    params->min_speed = MAPGEN_DEFAULT_MIN_SPEED;
+    params->max_speed = MAPGEN_DEFAULT_MAX_SPEED;
+    params->lights = MAPGEN_DEFAULT_LIGHTS;
+    params->seed = 1;
+    params->output = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "Error: Option '%s' needs a value\n", argv[i]);
+            return 0;
+        }
+        char *value = argv[++i];
+        if (strcmp(argv[i - 1], "--family") == 0)
+        {
+            int found = 0;
+            for (int j = 0; j < 3; j++)
+            {
+                if (strcmp(value, family_names[j]) == 0)
+                {
+                    params->family = (enum MapFamily)j;
+                    found = 1;
+                }
+            }
+            if (!found)
+            {
+                fprintf(stderr, "Error: Unknown family '%s'\n", value);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i - 1], "--junctions") == 0)
+            params->junctions = atoi(value);
+        else if (strcmp(argv[i - 1], "--degree") == 0)
+            params->degree = atoi(value);
+        else if (strcmp(argv[i - 1], "--min-length") == 0)
+            params->min_length = atoi(value);
+        else if (strcmp(argv[i - 1], "--max-length") == 0)
+            params->max_length = atoi(value);
+        else if (strcmp(argv[i - 1], "--min-speed") == 0)
+            params->min_speed = atoi(value);
+        else if (strcmp(argv[i - 1], "--max-speed") == 0)
+            params->max_speed = atoi(value);
+        else if (strcmp(argv[i - 1], "--lights") == 0)
+            params->lights = atof(value);
+        else if (strcmp(argv[i - 1], "--seed") == 0)
+            params->seed = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i - 1], "-o") == 0)
+            params->output = value;
+        else
+        {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i - 1]);
+            return 0;
+        }
+    }
+    if (params->junctions < 2 || params->degree < 1 || params->degree > MAX_NUM_ROADS_PER_JUNCTION ||
+        params->min_length < 1 || params->max_length < params->min_length || params->min_speed < 1 ||
+        params->max_speed < params->min_speed || params->lights < 0 || params->lights > 1)
+    {
+        fprintf(stderr, "Error: Invalid map parameters\n");
+        return 0;
+    }
+    return 1;
+}
+
+static void printUsage(char *program)
+{
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --family grid|geometric|scalefree  shape of the road network (default grid)\n");
+    fprintf(stderr, "  --junctions <n>                    number of junctions (default %d)\n", MAPGEN_DEFAULT_JUNCTIONS);
+    fprintf(stderr, "  --degree <d>                       average roads per junction, at most %d (default %d)\n",
+            MAX_NUM_ROADS_PER_JUNCTION, MAPGEN_DEFAULT_DEGREE);
+    fprintf(stderr, "  --min-length <l> --max-length <l>  road lengths (default %d to %d)\n", MAPGEN_DEFAULT_MIN_LENGTH,
+            MAPGEN_DEFAULT_MAX_LENGTH);
+    fprintf(stderr, "  --min-speed <s> --max-speed <s>    road speed limits (default %d to %d)\n", MAPGEN_DEFAULT_MIN_SPEED,
+            MAPGEN_DEFAULT_MAX_SPEED);
+    fprintf(stderr, "  --lights <fraction>                fraction of junctions with traffic lights (default %.2f)\n",
+            MAPGEN_DEFAULT_LIGHTS);
+    fprintf(stderr, "  --seed <n>                         seed, the same seed always gives the same map (default 1)\n");
+    fprintf(stderr, "  -o <file>                          where to write the map (default stdout)\n");
+}
+
+/**
+ * splitmix64, small and fast with good enough statistics for laying out maps
+ **/
+static unsigned long long nextRandom()
+{
+    unsigned long long z = (random_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double uniformRandom()
+{
+    return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int randomBetween(int min, int max)
+{
+    return min + (int)(nextRandom() % (unsigned long long)(max - min + 1));
+}
+
+static void initGraph(struct MapGraph *graph, int num_junctions)
+{
+    graph->num_junctions = num_junctions;
+    graph->degree = (int *)calloc(num_junctions, sizeof(int));
+    graph->neighbours = (int *)malloc(sizeof(int) * num_junctions * MAX_NUM_ROADS_PER_JUNCTION);
+    graph->lengths = (int *)malloc(sizeof(int) * num_junctions * MAX_NUM_ROADS_PER_JUNCTION);
+    graph->x = NULL;
+    graph->y = NULL;
+}
+
+static void freeGraph(struct MapGraph *graph)
+{
+    free(graph->degree);
+    free(graph->neighbours);
+    free(graph->lengths);
+    free(graph->x);
+    free(graph->y);
+}
+
+/**
+ * Adds a road between two junctions, returns zero if they are the same junction, are already joined or either has
+ * no room for another road
+ **/
+static int addRoad(struct MapGraph *graph, int a, int b, int length)
+{
+    if (a == b || graph->degree[a] >= MAX_NUM_ROADS_PER_JUNCTION || graph->degree[b] >= MAX_NUM_ROADS_PER_JUNCTION)
+        return 0;
+    for (int i = 0; i < graph->degree[a]; i++)
+    {
+        if (graph->neighbours[a * MAX_NUM_ROADS_PER_JUNCTION + i] == b)
+            return 0;
+    }
+    graph->neighbours[a * MAX_NUM_ROADS_PER_JUNCTION + graph->degree[a]] = b;
+    graph->lengths[a * MAX_NUM_ROADS_PER_JUNCTION + graph->degree[a]++] = length;
+    graph->neighbours[b * MAX_NUM_ROADS_PER_JUNCTION + graph->degree[b]] = a;
+    graph->lengths[b * MAX_NUM_ROADS_PER_JUNCTION + graph->degree[b]++] = length;
+    return 1;
+}
+
+/**
+ * A city block layout, the junctions fill a near square grid row by row with each one joined to the next along its
+ * row and column. Degrees above four add diagonal roads, and below four roads are removed at random (keeping the
+ * row roads so the grid stays connected)
+ **/
+static void generateGrid(struct MapGraph *graph, struct MapParameters *params)
+{
+    int width = (int)ceil(sqrt((double)params->junctions));
+    for (int i = 0; i < params->junctions; i++)
+    {
+        int column = i % width;
+        if (column + 1 < width && i + 1 < params->junctions)
+            addRoad(graph, i, i + 1, randomBetween(params->min_length, params->max_length));
+        if (i + width < params->junctions && (params->degree >= 4 || uniformRandom() < (params->degree - 2) / 2.0))
+            addRoad(graph, i, i + width, randomBetween(params->min_length, params->max_length));
+        if (params->degree > 4 && column + 1 < width && i + width + 1 < params->junctions &&
+            uniformRandom() < (params->degree - 4) / 4.0)
+            addRoad(graph, i, i + width + 1, randomBetween(params->min_length, params->max_length));
+        if (params->degree > 4 && column > 0 && i + width - 1 < params->junctions && uniformRandom() < (params->degree - 4) / 4.0)
+            addRoad(graph, i, i + width - 1, randomBetween(params->min_length, params->max_length));
+    }
+}
+
+/**
+ * Junctions scattered uniformly over a square, each joined to its nearest neighbours until it has the requested
+ * degree. The square is sized so that neighbouring junctions are around the mean road length apart and a
+ * road's length is the distance it covers, kept within the length limits. Junctions are bucketed into cells so
+ * that the nearest neighbours are found by searching outwards from a junction's own cell
+ **/
+static void generateGeometric(struct MapGraph *graph, struct MapParameters *params)
+{
+    int n = params->junctions;
+    double side = sqrt((double)n) * (params->min_length + params->max_length) / 2.0;
+    graph->x = (double *)malloc(sizeof(double) * n);
+    graph->y = (double *)malloc(sizeof(double) * n);
+    for (int i = 0; i < n; i++)
+    {
+        graph->x[i] = uniformRandom() * side;
+        graph->y[i] = uniformRandom() * side;
+    }
+
+    // About two junctions per cell, held as a counting sort of the junctions by cell
+    int cells = (int)ceil(sqrt(n / 2.0));
+    double cell_size = side / cells;
+    int *cell_start = (int *)calloc(cells * cells + 1, sizeof(int));
+    int *cell_junctions = (int *)malloc(sizeof(int) * n);
+    int *cell_of = (int *)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++)
+    {
+        int cx = (int)(graph->x[i] / cell_size), cy = (int)(graph->y[i] / cell_size);
+        cx = cx < cells ? cx : cells - 1;
+        cy = cy < cells ? cy : cells - 1;
+        cell_of[i] = cy * cells + cx;
+        cell_start[cell_of[i] + 1]++;
+    }
+    for (int c = 0; c < cells * cells; c++)
+        cell_start[c + 1] += cell_start[c];
+    int *fill = (int *)malloc(sizeof(int) * cells * cells);
+    memcpy(fill, cell_start, sizeof(int) * cells * cells);
+    for (int i = 0; i < n; i++)
+        cell_junctions[fill[cell_of[i]]++] = i;
+
+    // Each junction finds its nearest junctions and is joined to them until it has the requested degree, counting
+    // the roads it already has from the junctions that picked it earlier
+    int wanted = params->degree;
+    int *nearest = (int *)malloc(sizeof(int) * wanted);
+    double *nearest_distance = (double *)malloc(sizeof(double) * wanted);
+    for (int i = 0; i < n; i++)
+    {
+        int found = 0, cx = cell_of[i] % cells, cy = cell_of[i] / cells;
+        // Search rings of cells until the nearest found are closer than anything outside the rings searched
+        for (int ring = 0; ring < cells; ring++)
+        {
+            for (int y = cy - ring; y <= cy + ring; y++)
+            {
+                for (int x = cx - ring; x <= cx + ring; x++)
+                {
+                    if (x < 0 || y < 0 || x >= cells || y >= cells || (abs(x - cx) != ring && abs(y - cy) != ring))
+                        continue;
+                    for (int k = cell_start[y * cells + x]; k < cell_start[y * cells + x + 1]; k++)
+                    {
+                        int j = cell_junctions[k];
+                        if (j == i)
+                            continue;
+                        double d = hypot(graph->x[i] - graph->x[j], graph->y[i] - graph->y[j]);
+                        // Insertion into the sorted list of the nearest so far
+                        int pos = found < wanted ? found++ : wanted;
+                        while (pos > 0 && nearest_distance[pos - 1] > d)
+                        {
+                            if (pos < wanted)
+                            {
+                                nearest[pos] = nearest[pos - 1];
+                                nearest_distance[pos] = nearest_distance[pos - 1];
+                            }
+                            pos--;
+                        }
+                        if (pos < wanted)
+                        {
+                            nearest[pos] = j;
+                            nearest_distance[pos] = d;
+                        }
+                    }
+                }
+            }
+            if (found == wanted && nearest_distance[wanted - 1] <= ring * cell_size)
+                break;
+        }
+        for (int k = 0; k < found && graph->degree[i] < params->degree; k++)
+        {
+            int length = (int)nearest_distance[k];
+            length = length < params->min_length ? params->min_length : length;
+            length = length > params->max_length ? params->max_length : length;
+            addRoad(graph, i, nearest[k], length);
+        }
+    }
+    free(nearest);
+    free(nearest_distance);
+    free(fill);
+    free(cell_of);
+    free(cell_junctions);
+    free(cell_start);
+}
+
+/**
+ * Barabasi-Albert preferential attachment, each new junction joins half the degree of existing junctions picked in
+ * proportion to how many roads they already have, so a few hub junctions end up with many roads. Hubs stop
+ * attracting roads once they are full
+ **/
+static void generateScaleFree(struct MapGraph *graph, struct MapParameters *params)
+{
+    int n = params->junctions, m = (params->degree + 1) / 2;
+    // Every road end, picking uniformly from these picks junctions in proportion to their degree
+    int *ends = (int *)malloc(sizeof(int) * 2 * (long)n * m);
+    long num_ends = 0;
+    int initial = m + 1 < n ? m + 1 : n;
+    for (int i = 1; i < initial; i++)
+    {
+        if (addRoad(graph, i - 1, i, randomBetween(params->min_length, params->max_length)))
+        {
+            ends[num_ends++] = i - 1;
+            ends[num_ends++] = i;
+        }
+    }
+    for (int i = initial; i < n; i++)
+    {
+        int added = 0;
+        for (int attempt = 0; added < m && attempt < 10 * m; attempt++)
+        {
+            int target = ends[nextRandom() % num_ends];
+            if (addRoad(graph, i, target, randomBetween(params->min_length, params->max_length)))
+            {
+                ends[num_ends++] = i;
+                ends[num_ends++] = target;
+                added++;
+            }
+        }
+    }
+    free(ends);
+}
+
+static int findRoot(int *parent, int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * Joins any disconnected parts of the map, found with union-find, by a road from a junction with room in each part
+ * to one in the part before it
+ **/
+static void connectComponents(struct MapGraph *graph, struct MapParameters *params)
+{
+    int n = graph->num_junctions;
+    int *parent = (int *)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++)
+        parent[i] = i;
+    for (int i = 0; i < n; i++)
+    {
+        for (int k = 0; k < graph->degree[i]; k++)
+            parent[findRoot(parent, i)] = findRoot(parent, graph->neighbours[i * MAX_NUM_ROADS_PER_JUNCTION + k]);
+    }
+    int previous = -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (findRoot(parent, i) != i)
+            continue;
+        // Find a junction in this part with room for another road, the root itself if it has room
+        int from = i;
+        for (int j = 0; j < n && graph->degree[from] >= MAX_NUM_ROADS_PER_JUNCTION; j++)
+        {
+            if (findRoot(parent, j) == i)
+                from = j;
+        }
+        if (previous >= 0)
+            addRoad(graph, from, previous, randomBetween(params->min_length, params->max_length));
+        previous = from;
+    }
+    free(parent);
+}
+
+/**
+ * Writes the map, each road in both directions with the same length and speed limit, followed by the junctions
+ * picked at random to have traffic lights
+ **/
+static void writeMap(FILE *f, struct MapGraph *graph, struct MapParameters *params)
+{
+    int n = graph->num_junctions;
+    fprintf(f, "%%MatrixMarket matrix coordinate pattern symmetric\n");
+    fprintf(f, "%% mapgen --family %s --junctions %d --degree %d --min-length %d --max-length %d --min-speed %d "
+               "--max-speed %d --lights %g --seed %llu\n",
+            family_names[params->family], params->junctions, params->degree, params->min_length, params->max_length,
+            params->min_speed, params->max_speed, params->lights, params->seed);
+    fprintf(f, "# Road layout:%d\n", n);
+    for (int i = 0; i < n; i++)
+    {
+        for (int k = 0; k < graph->degree[i]; k++)
+        {
+            int j = graph->neighbours[i * MAX_NUM_ROADS_PER_JUNCTION + k];
+            if (j < i)
+                continue;
+            int length = graph->lengths[i * MAX_NUM_ROADS_PER_JUNCTION + k];
+            int speed = randomBetween(params->min_speed, params->max_speed);
+            fprintf(f, "%d %d %d %d\n", j, i, length, speed);
+            fprintf(f, "%d %d %d %d\n", i, j, length, speed);
+        }
+    }
+
+    // Pick the junctions with traffic lights by a partial shuffle, then list them in order
+    int num_lights = (int)(params->lights * n + 0.5);
+    int *order = (int *)malloc(sizeof(int) * n);
+    char *has_lights = (char *)calloc(n, sizeof(char));
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+    for (int i = 0; i < num_lights; i++)
+    {
+        int j = i + (int)(nextRandom() % (unsigned long long)(n - i));
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+        has_lights[order[i]] = 1;
+    }
+    fprintf(f, "# Traffic lights:%d\n", num_lights);
+    for (int i = 0; i < n; i++)
+    {
+        if (has_lights[i])
+            fprintf(f, "%d\n", i);
+    }
+    free(order);
+    free(has_lights);
+}
@@ -0,0 +1,192 @@
+// src/metrics_tail.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/live_metrics.h"
+
+static void readMetrics(struct LiveMetrics *, struct LiveMetrics *);
+static void printMetrics(struct LiveMetrics *, struct LiveMetrics *, double, int);
+static void sleepMillis(int);
+
+/**
+ * Tails the live metrics a run publishes with --live-metrics, printing a line whenever it has moved on. The tick rate
+ * and percentiles on each line are over the ticks since the line before, and over the whole run on the first line.
+ * It stops once the run has finished
+ **/
+int main(int argc, char *argv[])
+{
+    char *name = NULL;
+    int interval_ms = LIVE_METRICS_TAIL_INTERVAL_MS, show_ranks = 0, once = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+        {
+            interval_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ranks") == 0)
+        {
+            show_ranks = 1;
+        }
+        else if (strcmp(argv[i], "--once") == 0)
+        {
+            once = 1;
+        }
+        else if (argv[i][0] != '-' && name == NULL)
+        {
+            name = argv[i];
+        }
+        else
+        {
+            name = NULL;
+            break;
+        }
+    }
+    if (name == NULL || interval_ms < 1)
+    {
+        fprintf(stderr, "Usage: %s <segment name> [--interval <ms>] [--ranks] [--once]\n", argv[0]);
+        fprintf(stderr, "  --interval <ms>  how often to read the segment (default %d)\n", LIVE_METRICS_TAIL_INTERVAL_MS);
+        fprintf(stderr, "  --ranks          print the load of every vehicle actor as well\n");
+        fprintf(stderr, "  --once           print the current metrics and stop\n");
+        return -1;
+    }
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(struct LiveMetrics))
+    {
+        fprintf(stderr, "Error: Can not open the live metrics segment '%s'\n", name);
+        return -1;
+    }
+    struct LiveMetrics *segment = (struct LiveMetrics *)mmap(NULL, sizeof(struct LiveMetrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ((void *)segment == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Can not map the live metrics segment '%s'\n", name);
+        return -1;
+    }
+    if (segment->version != LIVE_METRICS_VERSION)
+    {
+        fprintf(stderr, "Error: '%s' holds version %u of the live metrics, this reads version %d\n", name,
+                segment->version, LIVE_METRICS_VERSION);
+        return -1;
+    }
+
+    struct LiveMetrics *current = (struct LiveMetrics *)malloc(sizeof(struct LiveMetrics));
+    struct LiveMetrics *previous = (struct LiveMetrics *)malloc(sizeof(struct LiveMetrics));
+    struct timespec now;
+    double previous_time = 0.0;
+    int first = 1;
+    while (1)
+    {
+        readMetrics(segment, current);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double current_time = now.tv_sec + now.tv_nsec / 1e9;
+        if (first || current->ticks != previous->ticks || !current->running)
+        {
+            printMetrics(current, first ? NULL : previous, current_time - previous_time, show_ranks);
+            first = 0;
+            struct LiveMetrics *swap = previous;
+            previous = current;
+            current = swap;
+            previous_time = current_time;
+        }
+        if (!previous->running || once)
+        {
+            break;
+        }
+        sleepMillis(interval_ms);
+    }
+    if (!previous->running)
+    {
+        printf("Run finished\n");
+    }
+    munmap(segment, sizeof(struct LiveMetrics));
+    free(current);
+    free(previous);
+    return 0;
+}
+
+/**
+ * Copies the segment, trying again until the copy was not taken while control was writing it
+ **/
+static void readMetrics(struct LiveMetrics *segment, struct LiveMetrics *copy)
+{
+    while (1)
+    {
+        unsigned long long before = atomic_load_explicit(&segment->sequence, memory_order_acquire);
+        if (before % 2 == 0)
+        {
+            memcpy(copy, segment, sizeof(struct LiveMetrics));
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&segment->sequence, memory_order_relaxed) == before)
+            {
+                return;
+            }
+        }
+        sleepMillis(0);
+    }
+}
+
+/**
+ * Prints the totals, the tick rate and tick time percentiles since the previous copy (or over the whole run if there
+ * is none) and the spread of the vehicle actors' loads
+ **/
+static void printMetrics(struct LiveMetrics *current, struct LiveMetrics *previous, double seconds, int show_ranks)
+{
+    printf("[Member %d, %d mins, tick %d] %d vehicles, %d passengers delivered, %d passengers stranded, %d crashed vehicles, "
+           "%d vehicles exhausted fuel",
+           current->member, current->elapsed_mins, current->ticks, current->total_vehicles,
+           current->passengers_delivered, current->passengers_stranded, current->vehicles_crashed,
+           current->vehicles_exhausted_fuel);
+    if (previous == NULL)
+    {
+        printf(" | over the run p50 %.6f p90 %.6f p99 %.6f seconds", current->tick_percentiles[0],
+               current->tick_percentiles[1], current->tick_percentiles[2]);
+    }
+    else
+    {
+        unsigned long long interval[LIVE_METRICS_BUCKETS];
+        for (int b = 0; b < LIVE_METRICS_BUCKETS; b++)
+        {
+            interval[b] = current->tick_histogram[b] - previous->tick_histogram[b];
+        }
+        printf(" | %.1f ticks per second, p50 %.6f p90 %.6f p99 %.6f seconds",
+               (current->ticks - previous->ticks) / seconds, liveMetricsPercentile(interval, 0.5),
+               liveMetricsPercentile(interval, 0.9), liveMetricsPercentile(interval, 0.99));
+    }
+    if (current->num_actors > 0)
+    {
+        int min = current->actors[0].vehicles, max = min;
+        long total = 0;
+        for (int i = 0; i < current->num_actors; i++)
+        {
+            int vehicles = current->actors[i].vehicles;
+            min = vehicles < min ? vehicles : min;
+            max = vehicles > max ? vehicles : max;
+            total += vehicles;
+        }
+        printf(" | %d vehicle actors, vehicles min/mean/max %d/%.1f/%d", current->num_actors, min,
+               (double)total / current->num_actors, max);
+    }
+    printf("\n");
+    if (show_ranks)
+    {
+        for (int i = 0; i < current->num_actors; i++)
+        {
+            printf("    rank %d: %d vehicles, %d usecs updating them\n", current->actors[i].rank,
+                   current->actors[i].vehicles, current->actors[i].update_usecs);
+        }
+    }
+    fflush(stdout);
+}
+
+static void sleepMillis(int millis)
+{
+    struct timespec delay = {millis / 1000, (millis % 1000) * 1000000L};
+    nanosleep(&delay, NULL);
+}
@@ -0,0 +1,400 @@
+// src/microbench.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../include/data_structures.h"
+#include "../include/utils.h"
+#include "../include/simulation.h"
+#include "../include/routing.h"
+#include "../include/microbench.h"
+
+// Stops the compiler from optimising away the results of the functions being timed
+static volatile long sink;
+
+/**
+ * Times the hot functions of the simulation on their own, without MPI, using the road maps under problem_size/ as
+ * realistic inputs. Each benchmark is repeated and reported in nanoseconds per operation with its variation
+ **/
+int main(int argc, char *argv[])
+{
+    char *map = MICROBENCH_DEFAULT_MAP;
+    int repeats = MICROBENCH_DEFAULT_REPEATS, route_queries = MICROBENCH_DEFAULT_ROUTE_QUERIES;
+    long ops = MICROBENCH_DEFAULT_OPS;
+    unsigned int seed = 1;
+    routingDefaults();
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--map") == 0 && i + 1 < argc)
+            map = argv[++i];
+        else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc)
+            repeats = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--route-queries") == 0 && i + 1 < argc)
+            route_queries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc)
+            ops = atol(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--routing") == 0 && i + 1 < argc && routingModeFromName(argv[i + 1]) >= 0)
+            routing_settings.mode = routingModeFromName(argv[++i]);
+        else if (strcmp(argv[i], "--landmarks") == 0 && i + 1 < argc)
+            routing_settings.num_landmarks = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--tree-memory") == 0 && i + 1 < argc)
+            routing_settings.tree_memory_mb = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--live-trees") == 0)
+            routing_settings.live_trees = 1;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--map <file>] [--repeats <n>] [--route-queries <n>] [--ops <n>] [--seed <n>] [--routing <mode>] [--landmarks <n>] [--tree-memory <MB>] [--live-trees]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+    if (repeats < 1 || repeats > 64)
+    {
+        fprintf(stderr, "Error: --repeats must be between 1 and 64\n");
+        return -1;
+    }
+    random_stream.key = randomKey(seed, 0, 0);
+    random_stream.counter = 0;
+
+    printf("%-34s %10s %14s %12s %14s %14s\n", "benchmark", "ops", "mean ns/op", "stddev", "min ns/op", "max ns/op");
+    benchLoadRoadMap(map, repeats);
+    loadRoadMap(map);
+    benchRoutingInit(map, repeats);
+    routingInit(map);
+    vehicles = (struct VehicleStruct *)malloc(sizeof(struct VehicleStruct) * MAX_VEHICLES);
+    clearVehicles();
+    benchPlanRoute(repeats, route_queries);
+    if (routing_settings.mode == ROUTING_TREES)
+        benchSpeedChanges(repeats);
+    benchFindIndexOfMinimum(repeats, num_junctions / 4 < MICROBENCH_MAX_SCANS ? num_junctions / 4 + 1 : MICROBENCH_MAX_SCANS);
+    benchFindAppropriateRoad(repeats, ops);
+    // Spawning and retiring vehicles at a range of fill levels of the vehicle pool
+    int fills[] = {10, 50, 90, 99};
+    for (int i = 0; i < 4; i++)
+        benchFindFreeVehicle(repeats, ops, fills[i]);
+    benchHandleVehicleUpdate(repeats, MAX_VEHICLES, 1);
+    benchHandleVehicleUpdate(repeats, route_queries < MAX_VEHICLES ? route_queries : MAX_VEHICLES, 0);
+    free(vehicles);
+    routingFinalise();
+    freeRoadMap();
+    return 0;
+}
+
+static double nowNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Prints the mean, standard deviation, minimum and maximum time per operation over the repeats
+ **/
+static void report(struct BenchResult *result)
+{
+    double mean = 0, variance = 0, min = result->ns_per_op[0], max = result->ns_per_op[0];
+    for (int r = 0; r < result->repeats; r++)
+    {
+        mean += result->ns_per_op[r];
+        min = result->ns_per_op[r] < min ? result->ns_per_op[r] : min;
+        max = result->ns_per_op[r] > max ? result->ns_per_op[r] : max;
+    }
+    mean /= result->repeats;
+    for (int r = 0; r < result->repeats; r++)
+        variance += (result->ns_per_op[r] - mean) * (result->ns_per_op[r] - mean);
+    double stddev = result->repeats > 1 ? sqrt(variance / (result->repeats - 1)) : 0;
+    printf("%-34s %10ld %14.1f %12.1f %14.1f %14.1f\n", result->name, result->ops, mean, stddev, min, max);
+}
+
+static void benchLoadRoadMap(char *map, int repeats)
+{
+    struct BenchResult result = {"loadRoadMap", 1, repeats};
+    for (int r = 0; r < repeats; r++)
+    {
+        double start = nowNanoseconds();
+        loadRoadMap(map);
+        result.ns_per_op[r] = nowNanoseconds() - start;
+        freeRoadMap();
+    }
+    report(&result);
+}
+
+/**
+ * The preprocessing the routing mode does once the road map has been loaded
+ **/
+static void benchRoutingInit(char *map, int repeats)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "routingInit (%s)", routing_mode_names[routing_settings.mode]);
+    struct BenchResult result = {name, 1, repeats};
+    for (int r = 0; r < repeats; r++)
+    {
+        double start = nowNanoseconds();
+        routingInit(map);
+        result.ns_per_op[r] = nowNanoseconds() - start;
+        routingFinalise();
+    }
+    report(&result);
+}
+
+/**
+ * Route queries between random pairs of junctions, as made when vehicles are spawned and at every junction, along
+ * with how many junctions each query settles
+ **/
+static void benchPlanRoute(int repeats, int queries)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "planRoute (%s, random pairs)", routing_mode_names[routing_settings.mode]);
+    struct BenchResult result = {name, queries, repeats};
+    routing_counters.queries = 0;
+    routing_counters.settled = 0;
+    int *sources = (int *)malloc(sizeof(int) * queries), *dests = (int *)malloc(sizeof(int) * queries);
+    for (int r = 0; r < repeats; r++)
+    {
+        for (int q = 0; q < queries; q++)
+        {
+            sources[q] = getRandomInteger(0, num_junctions);
+            dests[q] = getRandomInteger(0, num_junctions);
+        }
+        double start = nowNanoseconds();
+        for (int q = 0; q < queries; q++)
+            sink += planRoute(sources[q], dests[q], roadMap, num_junctions, num_roads);
+        result.ns_per_op[r] = (nowNanoseconds() - start) / queries;
+    }
+    free(sources);
+    free(dests);
+    report(&result);
+    printf("%-34s %10ld %14.1f\n", "  junctions settled per query", routing_counters.queries,
+           (double)routing_counters.settled / routing_counters.queries);
+    if (routing_settings.mode == ROUTING_TREES)
+        printf("%-34s %10ld %14ld\n", "  trees built, evicted", routing_counters.tree_builds, routing_counters.tree_evictions);
+    if (routing_settings.mode == ROUTING_CH || routing_settings.mode == ROUTING_TREES)
+        printf("%-34s %10ld\n", "  fell back to Dijkstra", routing_counters.fallback_queries);
+}
+
+/**
+ * Changes the speeds of a random few of the roads, as the junction actor publishes every tick, and tells the routing
+ * so the destination trees that planRoute built are brought up to date
+ **/
+static void benchSpeedChanges(int repeats)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "routingSpeedsChanged (%d%% of roads)", MICROBENCH_CHANGED_ROADS_PERCENT);
+    struct BenchResult result = {name, MICROBENCH_SPEED_CHANGES, repeats};
+    int count = num_roads * MICROBENCH_CHANGED_ROADS_PERCENT / 100 + 1;
+    int *roads = (int *)malloc(sizeof(int) * count);
+    struct RoadStruct **road_of = (struct RoadStruct **)malloc(sizeof(struct RoadStruct *) * num_roads);
+    for (int i = 0; i < num_junctions; i++)
+    {
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+            road_of[roadMap[i].roads[j].id] = &roadMap[i].roads[j];
+    }
+    routing_counters.tree_repairs = 0;
+    routing_counters.tree_rebuilds = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        double elapsed = 0;
+        for (int c = 0; c < MICROBENCH_SPEED_CHANGES; c++)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                roads[i] = getRandomInteger(0, num_roads);
+                struct RoadStruct *road = road_of[roads[i]];
+                road->currentSpeed = road->maxSpeed > 10 ? getRandomInteger(10, road->maxSpeed + 1) : road->maxSpeed;
+            }
+            double start = nowNanoseconds();
+            routingSpeedsChanged(roads, count);
+            elapsed += nowNanoseconds() - start;
+        }
+        result.ns_per_op[r] = elapsed / MICROBENCH_SPEED_CHANGES;
+    }
+    free(roads);
+    free(road_of);
+    report(&result);
+    if (routing_settings.live_trees)
+        printf("%-34s %10ld %14ld\n", "  trees repaired, rebuilt", routing_counters.tree_repairs, routing_counters.tree_rebuilds);
+}
+
+/**
+ * The scan for the closest unvisited junction that every step of planRoute makes, over the whole map starting with
+ * half of the junctions unvisited
+ **/
+static void benchFindIndexOfMinimum(int repeats, int calls)
+{
+    struct BenchResult result = {"findIndexOfMinimum", calls, repeats};
+    double *dist = (double *)malloc(sizeof(double) * num_junctions);
+    char *active = (char *)malloc(sizeof(char) * num_junctions);
+    for (int i = 0; i < num_junctions; i++)
+    {
+        dist[i] = getRandomInteger(0, 1000000);
+    }
+    for (int r = 0; r < repeats; r++)
+    {
+        for (int i = 0; i < num_junctions; i++)
+            active[i] = getRandomInteger(0, 2);
+        double start = nowNanoseconds();
+        for (int c = 0; c < calls; c++)
+        {
+            int index = findIndexOfMinimum(dist, active, num_junctions);
+            sink += index;
+            // Visit the junction found, as planRoute would, so each call has a different answer
+            if (index >= 0)
+                active[index] = 0;
+        }
+        result.ns_per_op[r] = (nowNanoseconds() - start) / calls;
+    }
+    free(dist);
+    free(active);
+    report(&result);
+}
+
+static void benchFindAppropriateRoad(int repeats, long ops)
+{
+    struct BenchResult result = {"findAppropriateRoad", ops, repeats};
+    int lookups = 4096;
+    int *junctions = (int *)malloc(sizeof(int) * lookups), *targets = (int *)malloc(sizeof(int) * lookups);
+    for (int i = 0; i < lookups; i++)
+    {
+        do
+        {
+            junctions[i] = getRandomInteger(0, num_junctions);
+        } while (roadMap[junctions[i]].num_roads == 0);
+        targets[i] = roadMap[junctions[i]].roads[getRandomInteger(0, roadMap[junctions[i]].num_roads)].to->id;
+    }
+    for (int r = 0; r < repeats; r++)
+    {
+        double start = nowNanoseconds();
+        for (long o = 0; o < ops; o++)
+            sink += findAppropriateRoad(targets[o % lookups], &roadMap[junctions[o % lookups]]);
+        result.ns_per_op[r] = (nowNanoseconds() - start) / ops;
+    }
+    free(junctions);
+    free(targets);
+    report(&result);
+}
+
+/**
+ * Spawn and retire churn with the vehicle pool held at a fill level: each operation finds a free vehicle with
+ * findFreeVehicle, activates it and retires a random active vehicle
+ **/
+static void benchFindFreeVehicle(int repeats, long ops, int fill_percent)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "findFreeVehicle (%d%% full)", fill_percent);
+    struct BenchResult result = {name, ops, repeats};
+    int *active_ids = (int *)malloc(sizeof(int) * MAX_VEHICLES);
+    for (int r = 0; r < repeats; r++)
+    {
+        clearVehicles();
+        int num_active = MAX_VEHICLES * fill_percent / 100;
+        for (int i = 0; i < num_active; i++)
+        {
+            int id;
+            do
+            {
+                id = getRandomInteger(0, MAX_VEHICLES);
+            } while (vehicles[id].active);
+            vehicles[id].active = 1;
+            active_ids[i] = id;
+        }
+        double start = nowNanoseconds();
+        for (long o = 0; o < ops; o++)
+        {
+            int id = findFreeVehicle();
+            vehicles[id].active = 1;
+            int retire = getRandomInteger(0, num_active + 1);
+            int retired = retire == num_active ? id : active_ids[retire];
+            vehicles[retired].active = 0;
+            if (retire != num_active)
+                active_ids[retire] = id;
+        }
+        result.ns_per_op[r] = (nowNanoseconds() - start) / ops;
+    }
+    free(active_ids);
+    clearVehicles();
+    report(&result);
+}
+
+/**
+ * One pass of the vehicle update loop over vehicles placed at random, reported per vehicle updated. Vehicles on a
+ * road a second after their last distance check just move along it, whereas vehicles at a junction plan their next
+ * road (so are dominated by planRoute) and then may cross the junction
+ **/
+static void benchHandleVehicleUpdate(int repeats, int num_vehicles, int on_road)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "handleVehicleUpdate (%s)", on_road ? "on road" : "at junction");
+    struct BenchResult result = {name, num_vehicles, repeats};
+    for (int r = 0; r < repeats; r++)
+    {
+        clearVehicles();
+        time_t now = getCurrentSeconds();
+        for (int i = 0; i < num_vehicles; i++)
+        {
+            struct JunctionStruct *junction;
+            do
+            {
+                junction = &roadMap[getRandomInteger(0, num_junctions)];
+            } while (junction->num_roads == 0);
+            vehicles[i].id = i;
+            vehicles[i].active = 1;
+            vehicles[i].start_t = now;
+            vehicles[i].fuel = CAR_MAX_FUEL;
+            vehicles[i].maxSpeed = CAR_MAX_SPEED;
+            vehicles[i].passengers = 1;
+            vehicles[i].source = junction->id;
+            // Vehicles at a junction need a destination they can reach, as activateVehicle makes sure of
+            do
+            {
+                vehicles[i].dest = getRandomInteger(0, num_junctions);
+            } while (vehicles[i].dest == junction->id ||
+                     (!on_road && planRoute(junction->id, vehicles[i].dest, roadMap, num_junctions, num_roads) == -1));
+            if (on_road)
+            {
+                vehicles[i].roadOn = &junction->roads[getRandomInteger(0, junction->num_roads)];
+                vehicles[i].roadOn->numVehiclesOnRoad++;
+                vehicles[i].speed = vehicles[i].roadOn->currentSpeed;
+                // Far enough along that the vehicle is still on the road after this update
+                vehicles[i].remaining_distance = vehicles[i].roadOn->roadLength + 2 * vehicles[i].speed;
+                vehicles[i].last_distance_check_secs = now - 1;
+            }
+            else
+            {
+                vehicles[i].currentJunction = junction;
+                junction->num_vehicles++;
+            }
+        }
+        double start = nowNanoseconds();
+        for (int i = 0; i < MAX_VEHICLES; i++)
+        {
+            if (vehicles[i].active)
+                handleVehicleUpdate(i);
+        }
+        result.ns_per_op[r] = (nowNanoseconds() - start) / num_vehicles;
+    }
+    clearVehicles();
+    report(&result);
+}
+
+/**
+ * Empties the vehicle pool, taking any vehicles that were at junctions or on roads off them
+ **/
+static void clearVehicles()
+{
+    for (int i = 0; i < MAX_VEHICLES; i++)
+    {
+        vehicles[i].active = 0;
+        vehicles[i].roadOn = NULL;
+        vehicles[i].currentJunction = NULL;
+        vehicles[i].maxSpeed = 0;
+    }
+    for (int i = 0; i < num_junctions; i++)
+    {
+        roadMap[i].num_vehicles = 0;
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+            roadMap[i].roads[j].numVehiclesOnRoad = 0;
+    }
+}
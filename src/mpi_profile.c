@@ -0,0 +1,480 @@
+// src/mpi_profile.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "mpi.h"
+#include "../include/mpi_profile.h"
+
+#define PROFILE_TAGS (MPI_PROFILE_MAX_TAGS + 1)
+#define PROFILE_SENT 0
+#define PROFILE_RECEIVED 1
+
+// Counts for one direction of traffic between this rank and a peer on a tag
+struct ProfileCounts
+{
+    double messages, bytes, wait_seconds;
+};
+
+// A nonblocking or persistent request, remembered so its peer, tag and size are known when it is waited on
+struct TrackedRequest
+{
+    MPI_Request request;
+    char state; // 0 empty, 1 in use, 2 removed
+    char persistent, is_send, active;
+    MPI_Comm comm; // Receives from any source are translated to the world rank that matched through this
+    int peer, tag;
+    double bytes;
+};
+
+static struct ProfileCounts *sent = NULL, *received = NULL; // Indexed by peer * PROFILE_TAGS + tag
+static double probe_calls[PROFILE_TAGS], probe_seconds[PROFILE_TAGS];
+static struct TrackedRequest tracked[MPI_PROFILE_MAX_REQUESTS];
+static MPI_Status *status_buffer = NULL;
+static int status_buffer_len = 0;
+static int profile_size = 0;
+// The world rank of every rank of the last communicator (other than MPI_COMM_WORLD) that traffic went over
+static MPI_Comm translated_comm = MPI_COMM_NULL;
+static int *translated_ranks = NULL, translated_size = 0;
+
+static int tagIndex(int);
+static int worldPeer(MPI_Comm, int);
+static void record(int, int, int, double, double, double);
+static struct TrackedRequest *findRequest(MPI_Request);
+static void trackRequest(MPI_Request, int, int, MPI_Comm, int, int, MPI_Datatype, int);
+static void completeRequest(struct TrackedRequest *, MPI_Status *, double);
+static MPI_Status *statusesFor(int, MPI_Status *);
+static void writeProfile();
+
+/**
+ * The counts are allocated on the first call, by which point MPI has been initialised
+ **/
+static void ensureProfile()
+{
+    if (sent != NULL)
+        return;
+    PMPI_Comm_size(MPI_COMM_WORLD, &profile_size);
+    sent = (struct ProfileCounts *)calloc(profile_size * PROFILE_TAGS, sizeof(struct ProfileCounts));
+    received = (struct ProfileCounts *)calloc(profile_size * PROFILE_TAGS, sizeof(struct ProfileCounts));
+}
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    int type_size;
+    double start = PMPI_Wtime();
+    int ret = PMPI_Send(buf, count, datatype, dest, tag, comm);
+    PMPI_Type_size(datatype, &type_size);
+    record(PROFILE_SENT, worldPeer(comm, dest), tag, 1, (double)count * type_size, PMPI_Wtime() - start);
+    return ret;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    MPI_Status own_status;
+    if (status == MPI_STATUS_IGNORE)
+        status = &own_status;
+    double start = PMPI_Wtime();
+    int ret = PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+    int bytes;
+    PMPI_Get_count(status, MPI_BYTE, &bytes);
+    record(PROFILE_RECEIVED, worldPeer(comm, status->MPI_SOURCE), status->MPI_TAG, 1, bytes, PMPI_Wtime() - start);
+    return ret;
+}
+
+/**
+ * Records both halves of the exchange, the time blocked is counted against the receive as it is for MPI_Recv
+ **/
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag, void *recvbuf,
+                 int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status)
+{
+    MPI_Status own_status;
+    if (status == MPI_STATUS_IGNORE)
+        status = &own_status;
+    int type_size;
+    double start = PMPI_Wtime();
+    int ret = PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source, recvtag,
+                            comm, status);
+    double elapsed = PMPI_Wtime() - start;
+    PMPI_Type_size(sendtype, &type_size);
+    record(PROFILE_SENT, worldPeer(comm, dest), sendtag, 1, (double)sendcount * type_size, 0);
+    int bytes;
+    PMPI_Get_count(status, MPI_BYTE, &bytes);
+    record(PROFILE_RECEIVED, worldPeer(comm, status->MPI_SOURCE), status->MPI_TAG, 1, bytes, elapsed);
+    return ret;
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request)
+{
+    int ret = PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+    trackRequest(*request, 0, 1, comm, dest, tag, datatype, count);
+    return ret;
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request)
+{
+    int ret = PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+    trackRequest(*request, 0, 0, comm, source, tag, datatype, count);
+    return ret;
+}
+
+int MPI_Send_init(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request)
+{
+    int ret = PMPI_Send_init(buf, count, datatype, dest, tag, comm, request);
+    trackRequest(*request, 1, 1, comm, dest, tag, datatype, count);
+    return ret;
+}
+
+int MPI_Recv_init(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request)
+{
+    int ret = PMPI_Recv_init(buf, count, datatype, source, tag, comm, request);
+    trackRequest(*request, 1, 0, comm, source, tag, datatype, count);
+    return ret;
+}
+
+int MPI_Start(MPI_Request *request)
+{
+    struct TrackedRequest *t = findRequest(*request);
+    if (t != NULL)
+    {
+        // Sends are counted when they are started, receives once they complete and their source and size are known
+        t->active = 1;
+        if (t->is_send)
+            record(PROFILE_SENT, t->peer, t->tag, 1, t->bytes, 0);
+    }
+    return PMPI_Start(request);
+}
+
+int MPI_Startall(int count, MPI_Request array_of_requests[])
+{
+    for (int i = 0; i < count; i++)
+    {
+        struct TrackedRequest *t = findRequest(array_of_requests[i]);
+        if (t != NULL)
+        {
+            t->active = 1;
+            if (t->is_send)
+                record(PROFILE_SENT, t->peer, t->tag, 1, t->bytes, 0);
+        }
+    }
+    return PMPI_Startall(count, array_of_requests);
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status)
+{
+    MPI_Status own_status;
+    if (status == MPI_STATUS_IGNORE)
+        status = &own_status;
+    struct TrackedRequest *t = findRequest(*request);
+    double start = PMPI_Wtime();
+    int ret = PMPI_Wait(request, status);
+    completeRequest(t, status, PMPI_Wtime() - start);
+    return ret;
+}
+
+/**
+ * The time spent in a Waitall is split evenly over the tracked requests it was waiting on
+ **/
+int MPI_Waitall(int count, MPI_Request array_of_requests[], MPI_Status array_of_statuses[])
+{
+    struct TrackedRequest *requests_tracked[count > 0 ? count : 1];
+    int waiting = 0;
+    for (int i = 0; i < count; i++)
+    {
+        requests_tracked[i] = findRequest(array_of_requests[i]);
+        if (requests_tracked[i] != NULL && requests_tracked[i]->active)
+            waiting++;
+    }
+    MPI_Status *statuses = statusesFor(count, array_of_statuses);
+    double start = PMPI_Wtime();
+    int ret = PMPI_Waitall(count, array_of_requests, statuses);
+    double share = waiting > 0 ? (PMPI_Wtime() - start) / waiting : 0;
+    for (int i = 0; i < count; i++)
+        completeRequest(requests_tracked[i], &statuses[i], share);
+    return ret;
+}
+
+int MPI_Test(MPI_Request *request, int *flag, MPI_Status *status)
+{
+    MPI_Status own_status;
+    if (status == MPI_STATUS_IGNORE)
+        status = &own_status;
+    struct TrackedRequest *t = findRequest(*request);
+    int ret = PMPI_Test(request, flag, status);
+    if (*flag)
+        completeRequest(t, status, 0);
+    return ret;
+}
+
+int MPI_Request_free(MPI_Request *request)
+{
+    struct TrackedRequest *t = findRequest(*request);
+    if (t != NULL)
+        t->state = 2;
+    return PMPI_Request_free(request);
+}
+
+int MPI_Probe(int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    MPI_Status own_status;
+    if (status == MPI_STATUS_IGNORE)
+        status = &own_status;
+    double start = PMPI_Wtime();
+    int ret = PMPI_Probe(source, tag, comm, status);
+    int index = tagIndex(status->MPI_TAG);
+    probe_calls[index]++;
+    probe_seconds[index] += PMPI_Wtime() - start;
+    return ret;
+}
+
+int MPI_Iprobe(int source, int tag, MPI_Comm comm, int *flag, MPI_Status *status)
+{
+    MPI_Status own_status;
+    if (status == MPI_STATUS_IGNORE)
+        status = &own_status;
+    double start = PMPI_Wtime();
+    int ret = PMPI_Iprobe(source, tag, comm, flag, status);
+    int index = tagIndex(*flag ? status->MPI_TAG : tag);
+    probe_calls[index]++;
+    probe_seconds[index] += PMPI_Wtime() - start;
+    return ret;
+}
+
+/**
+ * A freed communicator's handle may be reused for a different group, so its translation is forgotten
+ **/
+int MPI_Comm_free(MPI_Comm *comm)
+{
+    if (*comm == translated_comm)
+        translated_comm = MPI_COMM_NULL;
+    return PMPI_Comm_free(comm);
+}
+
+int MPI_Finalize()
+{
+    writeProfile();
+    free(translated_ranks);
+    free(sent);
+    free(received);
+    free(status_buffer);
+    return PMPI_Finalize();
+}
+
+static int tagIndex(int tag)
+{
+    return (tag < 0 || tag >= MPI_PROFILE_MAX_TAGS) ? MPI_PROFILE_MAX_TAGS : tag;
+}
+
+/**
+ * Adds to the counts for a peer and tag, traffic with an unknown peer (such as a receive that never matched) is not
+ * recorded. Peers are ranks in MPI_COMM_WORLD, whichever communicator the traffic went over
+ **/
+static void record(int direction, int peer, int tag, double messages, double bytes, double wait)
+{
+    ensureProfile();
+    if (peer < 0 || peer >= profile_size)
+        return;
+    struct ProfileCounts *counts = direction == PROFILE_SENT ? sent : received;
+    struct ProfileCounts *c = &counts[peer * PROFILE_TAGS + tagIndex(tag)];
+    c->messages += messages;
+    c->bytes += bytes;
+    c->wait_seconds += wait;
+}
+
+/**
+ * Translates a rank in the communicator to its rank in MPI_COMM_WORLD, so the members of an ensemble (which each
+ * communicate over their own communicator) fill in their own block of the matrix. Wildcards and MPI_PROC_NULL are
+ * negative and are passed straight through
+ **/
+static int worldPeer(MPI_Comm comm, int peer)
+{
+    if (comm == MPI_COMM_WORLD || peer < 0)
+        return peer;
+    if (comm != translated_comm)
+    {
+        MPI_Group group, world_group;
+        PMPI_Comm_size(comm, &translated_size);
+        int *ranks = (int *)malloc(sizeof(int) * translated_size);
+        for (int i = 0; i < translated_size; i++)
+            ranks[i] = i;
+        translated_ranks = (int *)realloc(translated_ranks, sizeof(int) * translated_size);
+        PMPI_Comm_group(comm, &group);
+        PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
+        PMPI_Group_translate_ranks(group, translated_size, ranks, world_group, translated_ranks);
+        PMPI_Group_free(&group);
+        PMPI_Group_free(&world_group);
+        free(ranks);
+        translated_comm = comm;
+    }
+    return peer < translated_size ? translated_ranks[peer] : -1;
+}
+
+static size_t requestHash(MPI_Request request)
+{
+    return ((size_t)(uintptr_t)request >> 3) % MPI_PROFILE_MAX_REQUESTS;
+}
+
+/**
+ * Looks up a tracked request by its handle with linear probing, returns NULL if it is not being tracked
+ **/
+static struct TrackedRequest *findRequest(MPI_Request request)
+{
+    if (request == MPI_REQUEST_NULL)
+        return NULL;
+    size_t slot = requestHash(request);
+    for (int i = 0; i < MPI_PROFILE_MAX_REQUESTS; i++)
+    {
+        struct TrackedRequest *t = &tracked[(slot + i) % MPI_PROFILE_MAX_REQUESTS];
+        if (t->state == 0)
+            return NULL;
+        if (t->state == 1 && t->request == request)
+            return t;
+    }
+    return NULL;
+}
+
+static void trackRequest(MPI_Request request, int persistent, int is_send, MPI_Comm comm, int peer, int tag, MPI_Datatype datatype,
+                         int count)
+{
+    if (request == MPI_REQUEST_NULL)
+        return;
+    int type_size;
+    PMPI_Type_size(datatype, &type_size);
+    // A handle may be reused by MPI once the request it named has gone, so replace any stale entry for it
+    struct TrackedRequest *t = findRequest(request);
+    size_t slot = requestHash(request);
+    for (int i = 0; t == NULL && i < MPI_PROFILE_MAX_REQUESTS; i++)
+    {
+        struct TrackedRequest *candidate = &tracked[(slot + i) % MPI_PROFILE_MAX_REQUESTS];
+        if (candidate->state != 1)
+            t = candidate;
+    }
+    if (t == NULL)
+        return;
+    t->request = request;
+    t->state = 1;
+    t->persistent = persistent;
+    t->is_send = is_send;
+    // Nonblocking requests are active straight away, persistent ones once they are started
+    t->active = !persistent;
+    t->comm = comm;
+    t->peer = worldPeer(comm, peer);
+    t->tag = tag;
+    t->bytes = (double)count * type_size;
+    if (is_send && !persistent)
+        record(PROFILE_SENT, t->peer, tag, 1, t->bytes, 0);
+}
+
+/**
+ * Records a request that has completed, receives are counted against the source and tag that actually matched. A
+ * nonblocking request is no longer tracked afterwards whereas a persistent one stays until it is freed
+ **/
+static void completeRequest(struct TrackedRequest *t, MPI_Status *status, double wait)
+{
+    if (t == NULL || !t->active)
+        return;
+    t->active = 0;
+    if (t->is_send)
+    {
+        record(PROFILE_SENT, t->peer, t->tag, 0, 0, wait);
+    }
+    else
+    {
+        int bytes;
+        PMPI_Get_count(status, MPI_BYTE, &bytes);
+        record(PROFILE_RECEIVED, worldPeer(t->comm, status->MPI_SOURCE), status->MPI_TAG, 1, bytes, wait);
+    }
+    if (!t->persistent)
+        t->state = 2;
+}
+
+/**
+ * Returns somewhere for Waitall to put its statuses, the caller's array if it gave one
+ **/
+static MPI_Status *statusesFor(int count, MPI_Status *array_of_statuses)
+{
+    if (array_of_statuses != MPI_STATUSES_IGNORE)
+        return array_of_statuses;
+    if (count > status_buffer_len)
+    {
+        free(status_buffer);
+        status_buffer_len = count;
+        status_buffer = (MPI_Status *)malloc(sizeof(MPI_Status) * status_buffer_len);
+    }
+    return status_buffer;
+}
+
+/**
+ * Gathers every rank's counts onto rank 0, which writes the communication matrix (messages and bytes from each
+ * sender row to each receiver column) followed by the counts and blocking wait times of every rank per peer and tag
+ **/
+static void writeProfile()
+{
+    ensureProfile();
+    int rank;
+    PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    int per_rank = 2 * profile_size * PROFILE_TAGS * 3 + 2 * PROFILE_TAGS;
+    double *local = (double *)malloc(sizeof(double) * per_rank);
+    memcpy(local, sent, sizeof(struct ProfileCounts) * profile_size * PROFILE_TAGS);
+    memcpy(&local[profile_size * PROFILE_TAGS * 3], received, sizeof(struct ProfileCounts) * profile_size * PROFILE_TAGS);
+    memcpy(&local[2 * profile_size * PROFILE_TAGS * 3], probe_calls, sizeof(double) * PROFILE_TAGS);
+    memcpy(&local[2 * profile_size * PROFILE_TAGS * 3 + PROFILE_TAGS], probe_seconds, sizeof(double) * PROFILE_TAGS);
+    double *all = NULL;
+    if (rank == 0)
+        all = (double *)malloc(sizeof(double) * per_rank * profile_size);
+    PMPI_Gather(local, per_rank, MPI_DOUBLE, all, per_rank, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    free(local);
+    if (rank != 0)
+        return;
+
+    char *filename = getenv(MPI_PROFILE_FILE_ENV);
+    if (filename == NULL)
+        filename = MPI_PROFILE_DEFAULT_FILE;
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: Can not open '%s' to write the MPI profile\n", filename);
+        free(all);
+        return;
+    }
+    for (int field = 0; field < 2; field++)
+    {
+        fprintf(f, "# %s sent, row is the sender and column the receiver\n", field == 0 ? "Messages" : "Bytes");
+        for (int r = 0; r < profile_size; r++)
+        {
+            struct ProfileCounts *counts = (struct ProfileCounts *)&all[r * per_rank];
+            for (int peer = 0; peer < profile_size; peer++)
+            {
+                double total = 0;
+                for (int tag = 0; tag < PROFILE_TAGS; tag++)
+                    total += field == 0 ? counts[peer * PROFILE_TAGS + tag].messages : counts[peer * PROFILE_TAGS + tag].bytes;
+                fprintf(f, "%s%.0f", peer == 0 ? "" : " ", total);
+            }
+            fprintf(f, "\n");
+        }
+    }
+    fprintf(f, "# rank,direction,peer,tag,messages,bytes,wait_seconds (tag %d counts all tags from %d up)\n",
+            MPI_PROFILE_MAX_TAGS, MPI_PROFILE_MAX_TAGS);
+    for (int r = 0; r < profile_size; r++)
+    {
+        for (int direction = 0; direction < 2; direction++)
+        {
+            struct ProfileCounts *counts = (struct ProfileCounts *)&all[r * per_rank + direction * profile_size * PROFILE_TAGS * 3];
+            for (int i = 0; i < profile_size * PROFILE_TAGS; i++)
+            {
+                if (counts[i].messages == 0 && counts[i].wait_seconds == 0)
+                    continue;
+                fprintf(f, "%d,%s,%d,%d,%.0f,%.0f,%.6f\n", r, direction == 0 ? "send" : "recv", i / PROFILE_TAGS,
+                        i % PROFILE_TAGS, counts[i].messages, counts[i].bytes, counts[i].wait_seconds);
+            }
+        }
+        double *calls = &all[r * per_rank + 2 * profile_size * PROFILE_TAGS * 3];
+        for (int tag = 0; tag < PROFILE_TAGS; tag++)
+        {
+            if (calls[tag] > 0)
+                fprintf(f, "%d,probe,-1,%d,%.0f,0,%.6f\n", r, tag, calls[tag], calls[PROFILE_TAGS + tag]);
+        }
+    }
+    fclose(f);
+    printf("MPI profile written to %s\n", filename);
+    free(all);
+}
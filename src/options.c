@@ -0,0 +1,229 @@
+// src/options.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include "../include/data_structures.h"
+#include "../include/options.h"
+#include "../include/routing.h"
+#include "../include/threaded.h"
+
+static void optionError(const char *, ...);
+
+// Whether this process prints what is wrong with the arguments, every rank parses them but only one need say so
+static int report_errors = 1;
+
+/**
+ * Parses the command line, the roadmap file is the first argument and is followed by any options. Returns zero if
+ * the arguments are not valid, after printing what is wrong with them if report is set
+ **/
+int parseOptions(int argc, char *argv[], int report)
+{
+    report_errors = report;
+    run_options.map_filename = NULL;
+    run_options.max_mins = MAX_MINS;
+    run_options.initial_vehicles = INITIAL_VEHICLES;
+    run_options.stats_json_filename = NULL;
+    run_options.trace_filename = NULL;
+    run_options.perf_counters = 0;
+    run_options.seed = (unsigned long long)time(NULL);
+    run_options.seed_given = 0;
+    run_options.checkpoint_filename = NULL;
+    run_options.checkpoint_every = CHECKPOINT_INTERVAL_MINS;
+    run_options.restart_filename = NULL;
+    run_options.ensemble_members = 1;
+    run_options.vehicle_threads = 0;
+    run_options.sync_every = 1;
+    run_options.sync_drift = 0;
+    run_options.live_metrics_name = NULL;
+    run_options.elastic = 0;
+    routingDefaults();
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        optionError("Error: You need to provide the roadmap file as the first argument\n");
+        return 0;
+    }
+    run_options.map_filename = argv[1];
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--max-mins") == 0 && i + 1 < argc)
+        {
+            run_options.max_mins = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--initial-vehicles") == 0 && i + 1 < argc)
+        {
+            run_options.initial_vehicles = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc)
+        {
+            run_options.stats_json_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            run_options.trace_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            run_options.seed = strtoull(argv[++i], NULL, 10);
+            run_options.seed_given = 1;
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+        {
+            run_options.checkpoint_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc)
+        {
+            run_options.checkpoint_every = atoi(argv[++i]);
+            if (run_options.checkpoint_every < 1)
+            {
+                optionError("Error: --checkpoint-every must be at least one minute\n");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--restart") == 0 && i + 1 < argc)
+        {
+            run_options.restart_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--routing") == 0 && i + 1 < argc)
+        {
+            int mode = routingModeFromName(argv[++i]);
+            if (mode < 0)
+            {
+                optionError("Error: Unknown routing mode '%s'\n", argv[i]);
+                return 0;
+            }
+            routing_settings.mode = mode;
+        }
+        else if (strcmp(argv[i], "--landmarks") == 0 && i + 1 < argc)
+        {
+            routing_settings.num_landmarks = atoi(argv[++i]);
+            if (routing_settings.num_landmarks < 1 || routing_settings.num_landmarks > ROUTING_MAX_LANDMARKS)
+            {
+                optionError("Error: --landmarks must be between 1 and %d\n", ROUTING_MAX_LANDMARKS);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--tree-memory") == 0 && i + 1 < argc)
+        {
+            routing_settings.tree_memory_mb = atoi(argv[++i]);
+            if (routing_settings.tree_memory_mb < 1)
+            {
+                optionError("Error: --tree-memory must be at least 1 MB\n");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--live-trees") == 0)
+        {
+            routing_settings.live_trees = 1;
+        }
+        else if (strcmp(argv[i], "--routing-actors") == 0 && i + 1 < argc)
+        {
+            routing_settings.num_actors = atoi(argv[++i]);
+            if (routing_settings.num_actors < 0)
+            {
+                optionError("Error: --routing-actors can not be negative\n");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc)
+        {
+            run_options.ensemble_members = atoi(argv[++i]);
+            if (run_options.ensemble_members < 1)
+            {
+                optionError("Error: --ensemble must be at least one member\n");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            run_options.vehicle_threads = atoi(argv[++i]);
+            if (run_options.vehicle_threads < 1 || run_options.vehicle_threads > THREADED_MAX_VEHICLE_THREADS)
+            {
+                optionError("Error: --threads must be between 1 and %d\n", THREADED_MAX_VEHICLE_THREADS);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--sync-every") == 0 && i + 1 < argc)
+        {
+            run_options.sync_every = atoi(argv[++i]);
+            if (run_options.sync_every < 1)
+            {
+                optionError("Error: --sync-every must be at least one tick\n");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--sync-drift") == 0 && i + 1 < argc)
+        {
+            run_options.sync_drift = atoi(argv[++i]);
+            if (run_options.sync_drift < 1)
+            {
+                optionError("Error: --sync-drift must be at least one vehicle\n");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--live-metrics") == 0 && i + 1 < argc)
+        {
+            run_options.live_metrics_name = argv[++i];
+            if (run_options.live_metrics_name[0] != '/' || strchr(run_options.live_metrics_name + 1, '/') != NULL)
+            {
+                optionError("Error: --live-metrics must be a shared memory name, a '/' followed by no others\n");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "--elastic") == 0)
+        {
+            run_options.elastic = 1;
+        }
+        else if (strcmp(argv[i], "--perf-counters") == 0)
+        {
+            run_options.perf_counters = 1;
+        }
+        else
+        {
+            optionError("Error: Unknown or incomplete option '%s'\n", argv[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Prints an error in the arguments to stderr, unless this process leaves that to another
+ **/
+static void optionError(const char *format, ...)
+{
+    if (!report_errors)
+        return;
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void printUsage(char *program)
+{
+    fprintf(stderr, "Usage: %s <roadmap file> [options]\n", program);
+    fprintf(stderr, "  --max-mins <n>        simulated minutes to run for (default %d)\n", MAX_MINS);
+    fprintf(stderr, "  --initial-vehicles <n> vehicles created at the start (default %d)\n", INITIAL_VEHICLES);
+    fprintf(stderr, "  --stats-json <file>   write per-rank timings and message counts as JSON\n");
+    fprintf(stderr, "  --trace <file>        write a Chrome/Perfetto trace of every rank's phases\n");
+    fprintf(stderr, "  --perf-counters       count cycles, instructions, cache and branch misses in the hot regions\n");
+    fprintf(stderr, "  --seed <n>            seed of the random number streams (default the current time, or the checkpoint's on a restart)\n");
+    fprintf(stderr, "  --routing <mode>      route planner, dijkstra, alt, ch or trees (default dijkstra)\n");
+    fprintf(stderr, "  --landmarks <n>       landmarks for alt routing (default %d)\n", ROUTING_DEFAULT_LANDMARKS);
+    fprintf(stderr, "  --tree-memory <MB>    memory for the destination trees of trees routing (default %d)\n", ROUTING_TREE_MEMORY_MB);
+    fprintf(stderr, "  --live-trees          trees routing costs every road at its current speed, repairing the trees\n");
+    fprintf(stderr, "  --routing-actors <n>  ranks that plan the routes for the vehicle actors in batches (default 0)\n");
+    fprintf(stderr, "  --checkpoint <file>   checkpoint the whole simulation to this file\n");
+    fprintf(stderr, "  --checkpoint-every <n> simulated minutes between checkpoints (default %d)\n", CHECKPOINT_INTERVAL_MINS);
+    fprintf(stderr, "  --restart <file>      carry on from a checkpoint, on any number of ranks\n");
+    fprintf(stderr, "  --threads <n>         run on one process, with n vehicle threads instead of vehicle ranks\n");
+    fprintf(stderr, "  --sync-every <k>      ticks between publications of the road speeds (default 1)\n");
+    fprintf(stderr, "  --sync-drift <n>      publish early once the road occupancy has changed by n vehicles\n");
+    fprintf(stderr, "  --live-metrics </name> publish the run's progress every tick to this shared memory segment\n");
+    fprintf(stderr, "  --elastic             start %d%% of the vehicle ranks and start or stop the rest with the load\n",
+            INITIAL_VEHICLE_ACTORS_PERCENT);
+    fprintf(stderr, "  --ensemble <n>        split the ranks into n independent simulations seeded seed, seed+1, ...\n");
+}
@@ -0,0 +1,178 @@
+// src/perf_counters.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "mpi.h"
+#include "../include/perf_counters.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char *region_names[PERF_NUM_REGIONS] = {"load_map", "vehicle_update", "route_query"};
+static const char *counter_names[PERF_NUM_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+
+// The counters are opened for the thread that calls perfCountersInit, the other threads of the threaded engine are
+// not counted
+static _Thread_local int enabled = 0;
+static _Thread_local int group_fd = -1;
+static _Thread_local int fds[PERF_NUM_COUNTERS];
+static _Thread_local int slot[PERF_NUM_COUNTERS]; // Position of each counter in a group read, -1 if it could not be opened
+static _Thread_local int num_open = 0;
+static _Thread_local double region_calls[PERF_NUM_REGIONS], region_units[PERF_NUM_REGIONS];
+static _Thread_local double region_counts[PERF_NUM_REGIONS][PERF_NUM_COUNTERS];
+static _Thread_local unsigned long long region_start[PERF_NUM_REGIONS][PERF_NUM_COUNTERS];
+
+static int readCounters(unsigned long long *);
+
+/**
+ * Opens the hardware counters as one group so they are read together. The first event that can be opened leads the
+ * group, events the hardware or kernel does not offer are left out, and if none can be opened (no PMU in a virtual
+ * machine, a restrictive perf_event_paranoid or not Linux) the regions are not measured
+ **/
+void perfCountersInit()
+{
+#ifdef __linux__
+    unsigned long long configs[PERF_NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                     PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    num_open = 0;
+    group_fd = -1;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = group_fd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+        slot[i] = fds[i] >= 0 ? num_open++ : -1;
+        if (fds[i] >= 0 && group_fd == -1)
+            group_fd = fds[i];
+    }
+    if (group_fd == -1)
+        return;
+    ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    enabled = 1;
+#endif
+}
+
+#if PERF_COUNTERS_ENABLED
+void perfRegionBegin(enum PerfRegion region)
+{
+    if (enabled)
+        readCounters(region_start[region]);
+}
+
+void perfRegionEnd(enum PerfRegion region, long units)
+{
+    if (!enabled)
+        return;
+    unsigned long long now[PERF_NUM_COUNTERS];
+    if (!readCounters(now))
+        return;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        region_counts[region][i] += (double)(now[i] - region_start[region][i]);
+    region_calls[region]++;
+    region_units[region] += units;
+}
+#endif
+
+/**
+ * Reads the whole group, filling in each counter by its place in the group. Returns zero if the read failed
+ **/
+static int readCounters(unsigned long long *values)
+{
+#ifdef __linux__
+    unsigned long long buffer[1 + PERF_NUM_COUNTERS];
+    if (read(group_fd, buffer, sizeof(unsigned long long) * (1 + num_open)) <= 0)
+        return 0;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        values[i] = slot[i] >= 0 ? buffer[1 + slot[i]] : 0;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Gathers the counts of every rank to rank 0, which prints each region a rank ran normalised per unit. Counters that
+ * could not be opened on a rank are shown as n/a, and if no rank could open any then that is all that is printed
+ **/
+void perfCountersReport()
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int per_rank = 1 + PERF_NUM_COUNTERS + PERF_NUM_REGIONS * (2 + PERF_NUM_COUNTERS);
+    double local[1 + PERF_NUM_COUNTERS + PERF_NUM_REGIONS * (2 + PERF_NUM_COUNTERS)];
+    local[0] = enabled;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        local[1 + i] = enabled && slot[i] >= 0;
+    for (int r = 0; r < PERF_NUM_REGIONS; r++)
+    {
+        double *values = &local[1 + PERF_NUM_COUNTERS + r * (2 + PERF_NUM_COUNTERS)];
+        values[0] = region_calls[r];
+        values[1] = region_units[r];
+        memcpy(&values[2], region_counts[r], sizeof(double) * PERF_NUM_COUNTERS);
+    }
+    double *all = NULL;
+    if (rank == 0)
+        all = (double *)malloc(sizeof(double) * per_rank * size);
+    MPI_Gather(local, per_rank, MPI_DOUBLE, all, per_rank, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank != 0)
+        return;
+
+    int any_enabled = 0;
+    for (int p = 0; p < size; p++)
+        any_enabled |= all[p * per_rank] != 0;
+    if (!any_enabled)
+    {
+        printf("[Perf] Hardware counters are not available on this system, check perf_event_paranoid\n");
+        free(all);
+        return;
+    }
+    for (int p = 0; p < size; p++)
+    {
+        double *rank_values = &all[p * per_rank];
+        double *available = &rank_values[1];
+        for (int r = 0; r < PERF_NUM_REGIONS; r++)
+        {
+            double *values = &rank_values[1 + PERF_NUM_COUNTERS + r * (2 + PERF_NUM_COUNTERS)];
+            if (values[0] == 0)
+                continue;
+            double units = values[1] > 0 ? values[1] : values[0];
+            printf("[Perf] rank %d %s: %.0f calls, %.0f units", p, region_names[r], values[0], values[1]);
+            if (available[PERF_CYCLES] && available[PERF_INSTRUCTIONS] && values[2 + PERF_CYCLES] > 0)
+                printf(", IPC %.2f", values[2 + PERF_INSTRUCTIONS] / values[2 + PERF_CYCLES]);
+            printf(", per unit:");
+            for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+            {
+                if (available[i])
+                    printf(" %s %.1f", counter_names[i], values[2 + i] / units);
+                else
+                    printf(" %s n/a", counter_names[i]);
+            }
+            printf("\n");
+        }
+    }
+    free(all);
+}
+
+void perfCountersFinalise()
+{
+#ifdef __linux__
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    {
+        if (slot[i] >= 0 && enabled)
+            close(fds[i]);
+    }
+#endif
+    enabled = 0;
+}
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "mpi.h"
 #include "../include/pool.h"
 
@@ -16,30 +17,39 @@
 static MPI_Datatype PP_COMMAND_TYPE;
 
 // Internal pool global state
+static MPI_Comm PP_comm;
 static int PP_myRank;
 static int PP_numProcs;
 static char *PP_active = NULL;
+static int *PP_freeRanks = NULL;
+static int PP_numFree;
+// Start requests waiting for a free rank, oldest first, each keeping its own actor type, payload and parent (in data)
+static struct PP_Control_Package *PP_awaitingStarts = NULL;
 static int PP_processesAwaitingStart;
+static int PP_awaitingCapacity;
 static struct PP_Control_Package in_command;
 static MPI_Request PP_pollRecvCommandRequest = MPI_REQUEST_NULL;
 
 // Internal pool functions
 static void errorMessage(char *);
-static int startAwaitingProcessesIfNeeded(int, int);
+static int startAwaitingProcessesIfNeeded(struct PP_Control_Package *, int);
 static int handleRecievedCommand();
 static void initialiseType();
 static struct PP_Control_Package createCommandPackage(enum PP_Control_Command);
+static struct PP_Control_Package createStartPackage(enum PP_Control_Command, int, int *, int);
 
 /**
  * Initialises the processes pool. Note that a worker will not return from this until it has been instructed to do some work
  * or quit. The return code zero indicates quit, one indicates loop and work for the worker and two indicates that this is the
- * master and it should loop and call master pool.
+ * master and it should loop and call master pool. The pool is made up of the processes of the communicator, rank zero of
+ * which is the master.
  */
-int processPoolInit()
+int processPoolInit(MPI_Comm comm)
 {
 	initialiseType();
-	MPI_Comm_rank(MPI_COMM_WORLD, &PP_myRank);
-	MPI_Comm_size(MPI_COMM_WORLD, &PP_numProcs);
+	PP_comm = comm;
+	MPI_Comm_rank(PP_comm, &PP_myRank);
+	MPI_Comm_size(PP_comm, &PP_numProcs);
 	if (PP_myRank == 0)
 	{
 		if (PP_numProcs < 2)
@@ -47,17 +57,24 @@ int processPoolInit()
 			errorMessage("No worker processes available for pool, run with more than one MPI process");
 		}
 		PP_active = (char *)malloc(PP_numProcs);
+		PP_freeRanks = (int *)malloc(sizeof(int) * PP_numProcs);
 		int i;
 		for (i = 0; i < PP_numProcs - 1; i++)
+		{
 			PP_active[i] = 0;
+			// Stack the free ranks so the lowest is popped first, workers are then started on ranks in order
+			PP_freeRanks[i] = PP_numProcs - 1 - i;
+		}
+		PP_numFree = PP_numProcs - 1;
 		PP_processesAwaitingStart = 0;
+		PP_awaitingCapacity = 0;
 		if (PP_DEBUG)
 			printf("[Master] Initialised Master\n");
 		return 2;
 	}
 	else
 	{
-		MPI_Recv(&in_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		MPI_Recv(&in_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, PP_comm, MPI_STATUS_IGNORE);
 		return handleRecievedCommand();
 	}
 }
@@ -71,16 +88,20 @@ void processPoolFinalise()
 	{
 		if (PP_active != NULL)
 			free(PP_active);
+		if (PP_freeRanks != NULL)
+			free(PP_freeRanks);
+		if (PP_awaitingStarts != NULL)
+			free(PP_awaitingStarts);
 		int i;
 		for (i = 0; i < PP_numProcs - 1; i++)
 		{
 			if (PP_DEBUG)
 				printf("[Master] Shutting down process %d\n", i);
 			struct PP_Control_Package out_command = createCommandPackage(PP_STOP);
-			MPI_Send(&out_command, 1, PP_COMMAND_TYPE, i + 1, PP_CONTROL_TAG, MPI_COMM_WORLD);
+			MPI_Send(&out_command, 1, PP_COMMAND_TYPE, i + 1, PP_CONTROL_TAG, PP_comm);
 		}
 	}
-	MPI_Barrier(MPI_COMM_WORLD);
+	MPI_Barrier(PP_comm);
 	MPI_Type_free(&PP_COMMAND_TYPE);
 }
 
@@ -93,13 +114,17 @@ int masterPoll()
 	if (PP_myRank == 0)
 	{
 		MPI_Status status;
-		MPI_Recv(&in_command, 1, PP_COMMAND_TYPE, MPI_ANY_SOURCE, PP_CONTROL_TAG, MPI_COMM_WORLD, &status);
+		MPI_Recv(&in_command, 1, PP_COMMAND_TYPE, MPI_ANY_SOURCE, PP_CONTROL_TAG, PP_comm, &status);
 
 		if (in_command.command == PP_SLEEPING)
 		{
 			if (PP_DEBUG)
 				printf("[Master] Received sleep command from %d\n", status.MPI_SOURCE);
-			PP_active[status.MPI_SOURCE - 1] = 0;
+			if (PP_active[status.MPI_SOURCE - 1])
+			{
+				PP_active[status.MPI_SOURCE - 1] = 0;
+				PP_freeRanks[PP_numFree++] = status.MPI_SOURCE;
+			}
 		}
 
 		if (in_command.command == PP_RUNCOMPLETE)
@@ -109,17 +134,15 @@ int masterPoll()
 			return 0;
 		}
 
-		if (in_command.command == PP_STARTPROCESS)
-		{
-			PP_processesAwaitingStart++;
-		}
-
-		int returnRank = startAwaitingProcessesIfNeeded(PP_processesAwaitingStart, status.MPI_SOURCE);
+		// A start request carries the actor type and payload which are passed straight on to the started worker, any
+		// other command may have freed a rank for a start that is waiting
+		int returnRank = startAwaitingProcessesIfNeeded(in_command.command == PP_STARTPROCESS ? &in_command : NULL,
+														 status.MPI_SOURCE);
 
 		if (in_command.command == PP_STARTPROCESS)
 		{
 			// If the master was to start a worker then send back the process rank that this worker is now on
-			MPI_Send(&returnRank, 1, MPI_INT, status.MPI_SOURCE, PP_PID_TAG, MPI_COMM_WORLD);
+			MPI_Send(&returnRank, 1, MPI_INT, status.MPI_SOURCE, PP_PID_TAG, PP_comm);
 		}
 		return 1;
 	}
@@ -131,23 +154,28 @@ int masterPoll()
 }
 
 /**
- * A worker or the master can instruct to start another worker process
+ * A worker or the master can instruct to start another worker process, the actor type and payload (of at most
+ * PP_MAX_PAYLOAD ints) travel with the command so the started worker has everything it needs without another message
  */
-int startWorkerProcess()
+int startWorkerProcess(int actorType, int *payload, int payloadLength)
 {
+	if (payloadLength > PP_MAX_PAYLOAD)
+	{
+		errorMessage("Payload too large for the command package");
+	}
+	struct PP_Control_Package start_command = createStartPackage(PP_STARTPROCESS, actorType, payload, payloadLength);
 	if (PP_myRank == 0)
 	{
-		PP_processesAwaitingStart++;
-		return startAwaitingProcessesIfNeeded(PP_processesAwaitingStart, 0);
+		return startAwaitingProcessesIfNeeded(&start_command, 0);
 	}
 	else
 	{
 		int workerRank;
-		struct PP_Control_Package out_command = createCommandPackage(PP_STARTPROCESS);
-		MPI_Send(&out_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, MPI_COMM_WORLD);
+		struct PP_Control_Package out_command = start_command;
+		MPI_Send(&out_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, PP_comm);
 		// Receive the rank that this worker has been placed on - if you change the default option from aborting when
 		// there are not enough MPI processes then this may be -1
-		MPI_Recv(&workerRank, 1, MPI_INT, 0, PP_PID_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		MPI_Recv(&workerRank, 1, MPI_INT, 0, PP_PID_TAG, PP_comm, MPI_STATUS_IGNORE);
 		return workerRank;
 	}
 }
@@ -163,7 +191,7 @@ void shutdownPool()
 		if (PP_DEBUG)
 			printf("[Worker] Commanding a pool shutdown\n");
 		struct PP_Control_Package out_command = createCommandPackage(PP_RUNCOMPLETE);
-		MPI_Send(&out_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, MPI_COMM_WORLD);
+		MPI_Send(&out_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, PP_comm);
 	}
 }
 
@@ -180,7 +208,7 @@ int workerSleep()
 		{
 			// The command was to wake up, it has done the work and now it needs to switch to sleeping mode
 			struct PP_Control_Package out_command = createCommandPackage(PP_SLEEPING);
-			MPI_Send(&out_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, MPI_COMM_WORLD);
+			MPI_Send(&out_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, PP_comm);
 			if (PP_pollRecvCommandRequest != MPI_REQUEST_NULL)
 				MPI_Wait(&PP_pollRecvCommandRequest, MPI_STATUS_IGNORE);
 		}
@@ -202,6 +230,26 @@ int getCommandData()
 	return in_command.data;
 }
 
+/**
+ * Retrieves the actor type that the latest start command asked this worker to run
+ */
+int getActorType()
+{
+	return in_command.actorType;
+}
+
+/**
+ * Copies the payload associated with the latest start command into the buffer (which must hold PP_MAX_PAYLOAD ints)
+ * and returns the number of ints copied
+ */
+int getCommandPayload(int *payload)
+{
+	int i;
+	for (i = 0; i < in_command.payloadLength; i++)
+		payload[i] = in_command.payload[i];
+	return in_command.payloadLength;
+}
+
 /**
  * Determines whether or not the worker should stop (i.e. the master has send the STOP command to all workers)
  */
@@ -224,50 +272,62 @@ int shouldWorkerStop()
  * Called by the master and will start awaiting processes (signal to them to start) if required.
  * By default this works as a process pool, so if there are not enough processes to workers then it will quit
  * but this can be changed by modifying options in the pool.
- * It takes in the awaiting worker number to send rank data to/from, the parent rank of the process to start
- * and returns the process rank that this awaiting worker was on. In the default case of #workers > pool capacity
- * causing an abort, then this will only be called to start single workers and as such the parent ID and return rank
- * will match perfectly. If you change the options to allow for workers to queue up if there is not enough MPI
- * capacity then the parent and return rank will be -1 for all workers started which do not match the provided awaiting Id
+ * It takes in the start package holding the actor type and payload of a newly requested worker (or NULL if there is
+ * none, when a rank may just have been freed for the waiting ones) and the parent rank of that worker, and returns
+ * the process rank the new worker was started on. Free ranks are kept on a stack so finding one does not depend on
+ * the size of the pool. In the default case of #workers > pool capacity causing an abort, then this will only be
+ * called to start single workers. If you change the options to allow for workers to queue up if there is not enough
+ * MPI capacity then each waiting start keeps its own package and parent, and the oldest are started first as ranks
+ * become free. The return rank is -1 if the new worker has to wait
  */
-static int startAwaitingProcessesIfNeeded(int awaitingId, int parent)
+static int startAwaitingProcessesIfNeeded(struct PP_Control_Package *start, int parent)
 {
 	int awaitingProcessMPIRank = -1;
-	if (PP_processesAwaitingStart)
+	if (start != NULL)
 	{
-		int i;
-		for (i = 0; i < PP_numProcs - 1; i++)
+		if (PP_processesAwaitingStart == PP_awaitingCapacity)
+		{
+			PP_awaitingCapacity = PP_awaitingCapacity > 0 ? 2 * PP_awaitingCapacity : 4;
+			PP_awaitingStarts = (struct PP_Control_Package *)realloc(PP_awaitingStarts,
+																	  sizeof(struct PP_Control_Package) * PP_awaitingCapacity);
+		}
+		PP_awaitingStarts[PP_processesAwaitingStart] = *start;
+		PP_awaitingStarts[PP_processesAwaitingStart].data = parent;
+		PP_processesAwaitingStart++;
+	}
+	while (PP_processesAwaitingStart)
+	{
+		if (PP_numFree == 0)
 		{
-			if (!PP_active[i])
+			// There are no available processes
+			if (PP_QuitOnNoProcs)
 			{
-				PP_active[i] = 1;
-				struct PP_Control_Package out_command = createCommandPackage(PP_WAKE);
-				out_command.data = awaitingId == PP_processesAwaitingStart ? parent : -1;
-				if (PP_DEBUG)
-					printf("[Master] Starting process %d\n", i + 1);
-				MPI_Send(&out_command, 1, PP_COMMAND_TYPE, i + 1, PP_CONTROL_TAG, MPI_COMM_WORLD);
-				if (awaitingId == PP_processesAwaitingStart)
-					awaitingProcessMPIRank = i + 1; // Will return this rank to the caller
-				PP_processesAwaitingStart--;
-				if (PP_processesAwaitingStart == 0)
-					break;
+				errorMessage("No more processes available");
 			}
-			if (i == PP_numProcs - 2)
-			{
-				// If I reach this point, I must have looped through the whole array and found no available processes
-				if (PP_QuitOnNoProcs)
-				{
-					errorMessage("No more processes available");
-				}
 
-				if (PP_IgnoreOnNoProcs)
-				{
-					fprintf(stderr, "[ProcessPool] Warning. No processes available. Ignoring launch request.\n");
-					PP_processesAwaitingStart--;
-				}
-				// otherwise, do nothing; a process may become available on the next iteration of the loop
+			if (PP_IgnoreOnNoProcs)
+			{
+				fprintf(stderr, "[ProcessPool] Warning. No processes available. Ignoring launch request.\n");
+				PP_processesAwaitingStart--;
+				memmove(PP_awaitingStarts, PP_awaitingStarts + 1, sizeof(struct PP_Control_Package) * PP_processesAwaitingStart);
+				continue;
 			}
+			// otherwise, do nothing; a process may become available on the next call
+			break;
 		}
+		// The oldest waiting start is the next to go
+		int workerRank = PP_freeRanks[--PP_numFree];
+		PP_active[workerRank - 1] = 1;
+		struct PP_Control_Package *waiting = &PP_awaitingStarts[0];
+		struct PP_Control_Package out_command = createStartPackage(PP_WAKE, waiting->actorType, waiting->payload, waiting->payloadLength);
+		out_command.data = waiting->data;
+		if (PP_DEBUG)
+			printf("[Master] Starting process %d\n", workerRank);
+		MPI_Send(&out_command, 1, PP_COMMAND_TYPE, workerRank, PP_CONTROL_TAG, PP_comm);
+		if (start != NULL && PP_processesAwaitingStart == 1)
+			awaitingProcessMPIRank = workerRank; // The start just requested, this rank is returned to the caller
+		PP_processesAwaitingStart--;
+		memmove(PP_awaitingStarts, PP_awaitingStarts + 1, sizeof(struct PP_Control_Package) * PP_processesAwaitingStart);
 	}
 	return awaitingProcessMPIRank;
 }
@@ -281,7 +341,7 @@ static int handleRecievedCommand()
 	if (in_command.command == PP_WAKE)
 	{
 		// If we are told to wake then post a recv for the next command and return true to continues
-		MPI_Irecv(&in_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, MPI_COMM_WORLD, &PP_pollRecvCommandRequest);
+		MPI_Irecv(&in_command, 1, PP_COMMAND_TYPE, 0, PP_CONTROL_TAG, PP_comm, &PP_pollRecvCommandRequest);
 		if (PP_DEBUG)
 			printf("[Worker] Process %d woken to work\n", PP_myRank);
 		return 1;
@@ -310,18 +370,21 @@ static void errorMessage(char *message)
 }
 
 /**
- * Initialises the command package MPI type, we use this to illustrate how additional information (this case
- * the parent rank) can be associated with commands
+ * Initialises the command package MPI type, we use this to associate additional information (the parent rank, the
+ * actor type and a small payload) with commands
  */
 static void initialiseType()
 {
 	struct PP_Control_Package package;
-	MPI_Aint pckAddress, dataAddress;
+	MPI_Aint pckAddress, dataAddress, typeAddress, lengthAddress, payloadAddress;
 	MPI_Get_address(&package, &pckAddress);
 	MPI_Get_address(&package.data, &dataAddress);
-	int blocklengths[3] = {1, 1}, nitems = 2;
-	MPI_Datatype types[3] = {MPI_CHAR, MPI_INT};
-	MPI_Aint offsets[3] = {0, dataAddress - pckAddress};
+	MPI_Get_address(&package.actorType, &typeAddress);
+	MPI_Get_address(&package.payloadLength, &lengthAddress);
+	MPI_Get_address(&package.payload, &payloadAddress);
+	int blocklengths[5] = {1, 1, 1, 1, PP_MAX_PAYLOAD}, nitems = 5;
+	MPI_Datatype types[5] = {MPI_INT, MPI_INT, MPI_INT, MPI_INT, MPI_INT};
+	MPI_Aint offsets[5] = {0, dataAddress - pckAddress, typeAddress - pckAddress, lengthAddress - pckAddress, payloadAddress - pckAddress};
 	MPI_Type_create_struct(nitems, blocklengths, offsets, types, &PP_COMMAND_TYPE);
 	MPI_Type_commit(&PP_COMMAND_TYPE);
 }
@@ -333,5 +396,22 @@ static struct PP_Control_Package createCommandPackage(enum PP_Control_Command de
 {
 	struct PP_Control_Package package;
 	package.command = desiredCommand;
+	package.data = 0;
+	package.actorType = -1;
+	package.payloadLength = 0;
+	return package;
+}
+
+/**
+ * A helper function which will create a command package carrying the actor type and payload of a worker to start
+ */
+static struct PP_Control_Package createStartPackage(enum PP_Control_Command desiredCommand, int actorType, int *payload, int payloadLength)
+{
+	struct PP_Control_Package package = createCommandPackage(desiredCommand);
+	package.actorType = actorType;
+	package.payloadLength = payloadLength;
+	int i;
+	for (i = 0; i < payloadLength; i++)
+		package.payload[i] = payload[i];
 	return package;
 }
@@ -0,0 +1,1320 @@
+// src/routing.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/data_structures.h"
+#include "../include/routing.h"
+
+// The route planners other than the original Dijkstra search in planRoute(), along with their preprocessing. Road
+// costs are the travel times planRoute() uses, roadLength / speed in whole units, where the speed is the road's
+// maxSpeed except on the roads leaving the source junction which use their currentSpeed
+
+// A binary min-heap of junctions keyed by distance, a junction can be in it more than once and the stale entries
+// are skipped when popped
+struct RouteHeap
+{
+    int *keys, *junctions;
+    int size, capacity;
+};
+
+static void heapPush(struct RouteHeap *, int, int);
+static int heapPop(struct RouteHeap *, int *);
+static void staticDistances(int, int, int *, int *);
+static int landmarkBound(int, int);
+static void chooseLandmarks();
+static unsigned long long mapChecksum();
+static int loadChCache(char *, unsigned long long);
+static void saveChCache(char *, unsigned long long);
+static void addChEdge(int, int, int, int);
+static int witnessSearch(int, int, int);
+static int contractJunction(int, int);
+static void buildContractionHierarchy();
+static int chSearch(int, int, int *);
+static int chEdgeMid(int, int);
+static int chEdgePasses(int, int, int);
+static int chRouteAvoids(int, int);
+static int searchRoute(int, int);
+static struct RouteTree *findTree(int);
+static void buildTree(struct RouteTree *, int);
+static void repairTree(struct RouteTree *, int *, int *, int);
+static void nextQueryStamp();
+static void useSharedRouting();
+
+// The routing's state is kept per actor, as the threaded engine runs several vehicle actors in one process. The
+// reverse road graph in compressed rows, the roads arriving at junction v are from reverse_offsets[v] up to
+// reverse_offsets[v + 1]
+static ACTOR_LOCAL int *reverse_offsets = NULL, *reverse_from = NULL, *reverse_cost = NULL;
+// Each road by its id, the junction it leaves and its place in the reverse graph
+static ACTOR_LOCAL struct RoadStruct **road_of = NULL;
+static ACTOR_LOCAL int *road_from = NULL, *road_slot = NULL;
+// Free flow distances from every junction to every landmark and from every landmark to every junction
+static ACTOR_LOCAL int num_landmarks = 0, *landmarks = NULL, *to_landmark = NULL, *from_landmark = NULL;
+// Per query state, a junction's entries are only valid if its stamp matches the current query's
+static ACTOR_LOCAL int *dist = NULL, *prev = NULL, *bound = NULL, *stamp = NULL, *settled = NULL, query_stamp = 0;
+static ACTOR_LOCAL struct RouteHeap heap;
+// The backward half of a bidirectional query, next is the junction after this one on the way to the destination
+static ACTOR_LOCAL int *back_dist = NULL, *back_next = NULL, *back_stamp = NULL, *back_settled = NULL;
+static ACTOR_LOCAL struct RouteHeap back_heap;
+// The contraction hierarchy, a junction's upward edges lead to higher ranked junctions and its downward edges come
+// from higher ranked junctions (so the backward search also only goes upwards)
+static ACTOR_LOCAL int *ch_rank = NULL, *up_offsets = NULL, *down_offsets = NULL;
+static ACTOR_LOCAL struct ChEdge *up_edges = NULL, *down_edges = NULL;
+// The graph as it is contracted, every junction's edges out and in including the shortcuts added so far
+struct ChEdgeList
+{
+    struct ChEdge *edges;
+    int count, capacity;
+};
+static ACTOR_LOCAL struct ChEdgeList *ch_out = NULL, *ch_in = NULL;
+static ACTOR_LOCAL char *contracted = NULL;
+// The destination trees held, which tree each junction's is (-1 if it has none) and how often each has been used
+static ACTOR_LOCAL struct RouteTree *trees = NULL;
+static ACTOR_LOCAL int num_trees = 0, max_trees = 0, tree_ints = 0, *tree_of = NULL;
+// The ids of the roads whose cost a change of speeds has changed, and what they used to cost
+static ACTOR_LOCAL int *changed_roads = NULL, *old_costs = NULL;
+static ACTOR_LOCAL long tree_clock = 0;
+// Counts the changes to the road speeds, a next junction worked out in an earlier epoch is stale
+static ACTOR_LOCAL int speed_epoch = 0;
+
+// The searching done by this actor, declared in routing.h
+ACTOR_LOCAL struct RoutingCounters routing_counters;
+
+// The landmarks and contraction hierarchy one thread has worked out for the threads it starts afterwards (the
+// threaded engine's vehicle threads) to read. They only depend on the map, so are never written once shared. An
+// actor using them leaves freeing them to the thread that shared them
+struct SharedRouting
+{
+    int shared;
+    int num_landmarks, *landmarks, *to_landmark, *from_landmark;
+    int *ch_rank, *up_offsets, *down_offsets;
+    struct ChEdge *up_edges, *down_edges;
+};
+static struct SharedRouting shared_routing;
+static ACTOR_LOCAL int sharing = 0, using_shared = 0;
+
+void routingDefaults()
+{
+    routing_settings.mode = ROUTING_DIJKSTRA;
+    routing_settings.num_landmarks = ROUTING_DEFAULT_LANDMARKS;
+    routing_settings.tree_memory_mb = ROUTING_TREE_MEMORY_MB;
+    routing_settings.live_trees = 0;
+    routing_settings.num_actors = 0;
+}
+
+int routingModeFromName(const char *name)
+{
+    for (int i = 0; i < NUM_ROUTING_MODES; i++)
+    {
+        if (strcmp(name, routing_mode_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void heapPush(struct RouteHeap *h, int key, int junction)
+{
+    if (h->size == h->capacity)
+    {
+        h->capacity = h->capacity > 0 ? h->capacity * 2 : 1024;
+        h->keys = (int *)realloc(h->keys, sizeof(int) * h->capacity);
+        h->junctions = (int *)realloc(h->junctions, sizeof(int) * h->capacity);
+    }
+    int i = h->size++;
+    while (i > 0 && h->keys[(i - 1) / 2] > key)
+    {
+        h->keys[i] = h->keys[(i - 1) / 2];
+        h->junctions[i] = h->junctions[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h->keys[i] = key;
+    h->junctions[i] = junction;
+}
+
+/**
+ * Removes the entry with the smallest key, returning its junction and setting its key
+ **/
+static int heapPop(struct RouteHeap *h, int *key)
+{
+    int junction = h->junctions[0];
+    *key = h->keys[0];
+    int last_key = h->keys[--h->size], last_junction = h->junctions[h->size];
+    int i = 0;
+    while (2 * i + 1 < h->size)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < h->size && h->keys[child + 1] < h->keys[child])
+            child++;
+        if (h->keys[child] >= last_key)
+            break;
+        h->keys[i] = h->keys[child];
+        h->junctions[i] = h->junctions[child];
+        i = child;
+    }
+    h->keys[i] = last_key;
+    h->junctions[i] = last_junction;
+    return junction;
+}
+
+/**
+ * Fills in the free flow distance from the source to every junction, or from every junction to the source over
+ * the reverse graph if reverse is set. If parents is given it is filled in with the junction before each one on its
+ * shortest route (after it, going backwards), -1 for the source and the junctions that can not be reached
+ **/
+static void staticDistances(int source, int reverse, int *distances, int *parents)
+{
+    for (int i = 0; i < num_junctions; i++)
+    {
+        distances[i] = ROUTING_UNREACHABLE;
+        if (parents != NULL)
+            parents[i] = -1;
+    }
+    distances[source] = 0;
+    heap.size = 0;
+    heapPush(&heap, 0, source);
+    while (heap.size > 0)
+    {
+        int key, v = heapPop(&heap, &key);
+        if (key > distances[v])
+            continue;
+        int num_edges = reverse ? reverse_offsets[v + 1] - reverse_offsets[v] : roadMap[v].num_roads;
+        for (int e = 0; e < num_edges; e++)
+        {
+            int u, cost;
+            if (reverse)
+            {
+                u = reverse_from[reverse_offsets[v] + e];
+                cost = reverse_cost[reverse_offsets[v] + e];
+            }
+            else
+            {
+                u = roadMap[v].roads[e].to->id;
+                cost = roadMap[v].roads[e].roadLength / roadMap[v].roads[e].maxSpeed;
+            }
+            if (key + cost < distances[u])
+            {
+                distances[u] = key + cost;
+                if (parents != NULL)
+                    parents[u] = v;
+                heapPush(&heap, key + cost, u);
+            }
+        }
+    }
+}
+
+/**
+ * Builds the reverse graph and does the preprocessing for the routing mode: the landmarks for ALT routing, the
+ * contraction hierarchy (loaded from its cache next to the map if it has already been built for this map), or room
+ * for as many destination trees as fit in their memory
+ **/
+void routingInit(char *map_filename)
+{
+    dist = (int *)malloc(sizeof(int) * num_junctions);
+    prev = (int *)malloc(sizeof(int) * num_junctions);
+    bound = (int *)malloc(sizeof(int) * num_junctions);
+    stamp = (int *)calloc(num_junctions, sizeof(int));
+    settled = (int *)calloc(num_junctions, sizeof(int));
+    back_dist = (int *)malloc(sizeof(int) * num_junctions);
+    back_next = (int *)malloc(sizeof(int) * num_junctions);
+    back_stamp = (int *)calloc(num_junctions, sizeof(int));
+    back_settled = (int *)calloc(num_junctions, sizeof(int));
+    query_stamp = 0;
+    memset(&heap, 0, sizeof(struct RouteHeap));
+    memset(&back_heap, 0, sizeof(struct RouteHeap));
+
+    reverse_offsets = (int *)calloc(num_junctions + 1, sizeof(int));
+    reverse_from = (int *)malloc(sizeof(int) * (num_roads + 1));
+    reverse_cost = (int *)malloc(sizeof(int) * (num_roads + 1));
+    road_of = (struct RoadStruct **)malloc(sizeof(struct RoadStruct *) * (num_roads + 1));
+    road_from = (int *)malloc(sizeof(int) * (num_roads + 1));
+    road_slot = (int *)malloc(sizeof(int) * (num_roads + 1));
+    for (int i = 0; i < num_junctions; i++)
+    {
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+            reverse_offsets[roadMap[i].roads[j].to->id + 1]++;
+    }
+    for (int i = 0; i < num_junctions; i++)
+    {
+        reverse_offsets[i + 1] += reverse_offsets[i];
+    }
+    int *next = (int *)malloc(sizeof(int) * (num_junctions + 1));
+    memcpy(next, reverse_offsets, sizeof(int) * (num_junctions + 1));
+    for (int i = 0; i < num_junctions; i++)
+    {
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[i].roads[j];
+            int slot = next[road->to->id]++;
+            reverse_from[slot] = i;
+            reverse_cost[slot] = road->roadLength / road->maxSpeed;
+            road_of[road->id] = road;
+            road_from[road->id] = i;
+            road_slot[road->id] = slot;
+        }
+    }
+    free(next);
+
+    num_landmarks = 0;
+    if (num_junctions == 0)
+        return;
+    if (shared_routing.shared && (routing_settings.mode == ROUTING_ALT || routing_settings.mode == ROUTING_CH))
+    {
+        useSharedRouting();
+    }
+    else if (routing_settings.mode == ROUTING_ALT)
+    {
+        chooseLandmarks();
+    }
+    else if (routing_settings.mode == ROUTING_CH)
+    {
+        unsigned long long checksum = mapChecksum();
+        char cache_filename[4096];
+        snprintf(cache_filename, sizeof(cache_filename), "%s%s", map_filename, CH_CACHE_SUFFIX);
+        if (!loadChCache(cache_filename, checksum))
+        {
+            buildContractionHierarchy();
+            saveChCache(cache_filename, checksum);
+        }
+    }
+    else if (routing_settings.mode == ROUTING_TREES)
+    {
+        // A live tree holds two ints per junction and the others five. The live trees are searched over the reverse
+        // graph costed at the current speeds
+        tree_ints = routing_settings.live_trees ? 2 : 5;
+        for (int r = 0; r < num_roads && routing_settings.live_trees; r++)
+            reverse_cost[road_slot[r]] = road_of[r]->roadLength / road_of[r]->currentSpeed;
+        changed_roads = (int *)malloc(sizeof(int) * (num_roads + 1));
+        old_costs = (int *)malloc(sizeof(int) * (num_roads + 1));
+        long tree_bytes = (long)tree_ints * sizeof(int) * num_junctions;
+        max_trees = (int)((long)routing_settings.tree_memory_mb * 1024 * 1024 / tree_bytes);
+        if (max_trees < 1)
+            max_trees = 1;
+        if (max_trees > num_junctions)
+            max_trees = num_junctions;
+        trees = (struct RouteTree *)calloc(max_trees, sizeof(struct RouteTree));
+        tree_of = (int *)malloc(sizeof(int) * num_junctions);
+        for (int i = 0; i < num_junctions; i++)
+            tree_of[i] = -1;
+        num_trees = 0;
+        tree_clock = 0;
+    }
+}
+
+/**
+ * Shares this thread's landmarks and contraction hierarchy with the threads that call routingInit after it, which
+ * then skip working them out (and writing the hierarchy's cache) for themselves
+ **/
+void routingShare()
+{
+    shared_routing.num_landmarks = num_landmarks;
+    shared_routing.landmarks = landmarks;
+    shared_routing.to_landmark = to_landmark;
+    shared_routing.from_landmark = from_landmark;
+    shared_routing.ch_rank = ch_rank;
+    shared_routing.up_offsets = up_offsets;
+    shared_routing.down_offsets = down_offsets;
+    shared_routing.up_edges = up_edges;
+    shared_routing.down_edges = down_edges;
+    shared_routing.shared = 1;
+    sharing = 1;
+}
+
+/**
+ * Points this actor's landmarks and contraction hierarchy at the shared ones
+ **/
+static void useSharedRouting()
+{
+    num_landmarks = shared_routing.num_landmarks;
+    landmarks = shared_routing.landmarks;
+    to_landmark = shared_routing.to_landmark;
+    from_landmark = shared_routing.from_landmark;
+    ch_rank = shared_routing.ch_rank;
+    up_offsets = shared_routing.up_offsets;
+    down_offsets = shared_routing.down_offsets;
+    up_edges = shared_routing.up_edges;
+    down_edges = shared_routing.down_edges;
+    using_shared = 1;
+}
+
+/**
+ * Chooses the landmarks and works out the distances to and from them. Each landmark is the junction furthest (going
+ * there and back) from those already chosen, starting from the one furthest from junction 0, which spreads them
+ * around the edge of the map where their bounds are tightest
+ **/
+static void chooseLandmarks()
+{
+    int wanted = routing_settings.num_landmarks < num_junctions ? routing_settings.num_landmarks : num_junctions;
+    landmarks = (int *)malloc(sizeof(int) * wanted);
+    to_landmark = (int *)malloc(sizeof(int) * wanted * num_junctions);
+    from_landmark = (int *)malloc(sizeof(int) * wanted * num_junctions);
+    // The round trip from each junction to its closest landmark, junctions that can not be reached count as far away
+    long *closest = (long *)malloc(sizeof(long) * num_junctions);
+    staticDistances(0, 0, dist, NULL);
+    int candidate = 0;
+    for (int i = 0; i < num_junctions; i++)
+    {
+        closest[i] = 2L * ROUTING_UNREACHABLE;
+        if (dist[i] != ROUTING_UNREACHABLE && dist[i] > dist[candidate])
+            candidate = i;
+    }
+    while (num_landmarks < wanted)
+    {
+        int l = num_landmarks++;
+        landmarks[l] = candidate;
+        staticDistances(candidate, 0, &from_landmark[l * num_junctions], NULL);
+        staticDistances(candidate, 1, &to_landmark[l * num_junctions], NULL);
+        candidate = -1;
+        for (int i = 0; i < num_junctions; i++)
+        {
+            long round_trip = (long)from_landmark[l * num_junctions + i] + to_landmark[l * num_junctions + i];
+            if (round_trip < closest[i])
+                closest[i] = round_trip;
+            if (closest[i] > 0 && (candidate < 0 || closest[i] > closest[candidate]))
+                candidate = i;
+        }
+        if (candidate < 0)
+            break; // Every junction is already a landmark
+    }
+    free(closest);
+}
+
+void routingFinalise()
+{
+    if (using_shared)
+    {
+        // Freed by the thread that shared them
+        landmarks = to_landmark = from_landmark = NULL;
+        ch_rank = up_offsets = down_offsets = NULL;
+        up_edges = down_edges = NULL;
+        using_shared = 0;
+    }
+    if (sharing)
+    {
+        memset(&shared_routing, 0, sizeof(struct SharedRouting));
+        sharing = 0;
+    }
+    free(dist);
+    free(prev);
+    free(bound);
+    free(stamp);
+    free(settled);
+    free(back_dist);
+    free(back_next);
+    free(back_stamp);
+    free(back_settled);
+    free(heap.keys);
+    free(heap.junctions);
+    free(back_heap.keys);
+    free(back_heap.junctions);
+    free(reverse_offsets);
+    free(reverse_from);
+    free(reverse_cost);
+    free(road_of);
+    free(road_from);
+    free(road_slot);
+    free(changed_roads);
+    free(old_costs);
+    free(landmarks);
+    free(to_landmark);
+    free(from_landmark);
+    free(ch_rank);
+    free(up_offsets);
+    free(up_edges);
+    free(down_offsets);
+    free(down_edges);
+    for (int t = 0; t < num_trees; t++)
+        free(trees[t].dist);
+    free(trees);
+    free(tree_of);
+    trees = NULL;
+    tree_of = NULL;
+    num_trees = max_trees = 0;
+    dist = prev = bound = stamp = settled = NULL;
+    back_dist = back_next = back_stamp = back_settled = NULL;
+    reverse_offsets = reverse_from = reverse_cost = NULL;
+    road_of = NULL;
+    road_from = road_slot = changed_roads = old_costs = NULL;
+    landmarks = to_landmark = from_landmark = NULL;
+    ch_rank = up_offsets = down_offsets = NULL;
+    up_edges = down_edges = NULL;
+    memset(&heap, 0, sizeof(struct RouteHeap));
+    memset(&back_heap, 0, sizeof(struct RouteHeap));
+    num_landmarks = 0;
+}
+
+/**
+ * Starts a new query, the junctions' entries from earlier queries become stale
+ **/
+static void nextQueryStamp()
+{
+    if (++query_stamp == 0)
+    {
+        // The stamps have wrapped around, so clear them all
+        memset(stamp, 0, sizeof(int) * num_junctions);
+        memset(settled, 0, sizeof(int) * num_junctions);
+        memset(back_stamp, 0, sizeof(int) * num_junctions);
+        memset(back_settled, 0, sizeof(int) * num_junctions);
+        query_stamp = 1;
+    }
+}
+
+/**
+ * A lower bound on the free flow distance from v to t by the triangle inequality, d(v,t) >= d(v,L) - d(t,L) and
+ * d(v,t) >= d(L,t) - d(L,v) for every landmark L. Returns ROUTING_UNREACHABLE if a landmark shows t can not be
+ * reached from v: t reaches L but v does not, or L reaches v but not t
+ **/
+static int landmarkBound(int v, int t)
+{
+    int best = 0;
+    for (int l = 0; l < num_landmarks; l++)
+    {
+        int *to = &to_landmark[l * num_junctions], *from = &from_landmark[l * num_junctions];
+        if (to[t] != ROUTING_UNREACHABLE)
+        {
+            if (to[v] == ROUTING_UNREACHABLE)
+                return ROUTING_UNREACHABLE;
+            if (to[v] - to[t] > best)
+                best = to[v] - to[t];
+        }
+        if (from[v] != ROUTING_UNREACHABLE)
+        {
+            if (from[t] == ROUTING_UNREACHABLE)
+                return ROUTING_UNREACHABLE;
+            if (from[t] - from[v] > best)
+                best = from[t] - from[v];
+        }
+    }
+    return best;
+}
+
+int altRoute(int source_id, int dest_id)
+{
+    routing_counters.queries++;
+    return searchRoute(source_id, dest_id);
+}
+
+/**
+ * A* search from source to dest, settling junctions in order of their distance plus the landmark bound to dest
+ * (without landmarks this is Dijkstra's algorithm). The roads leaving the source cost at least their free flow time,
+ * so the bounds stay consistent and the first time dest is settled its route is a shortest one. Only the junctions
+ * the search touches are reset between queries
+ **/
+static int searchRoute(int source_id, int dest_id)
+{
+    if (source_id == dest_id)
+        return -1;
+    nextQueryStamp();
+    heap.size = 0;
+    stamp[source_id] = query_stamp;
+    dist[source_id] = 0;
+    prev[source_id] = -1;
+    bound[source_id] = landmarkBound(source_id, dest_id);
+    if (bound[source_id] == ROUTING_UNREACHABLE)
+        return -1;
+    heapPush(&heap, bound[source_id], source_id);
+    int found = 0;
+    while (heap.size > 0)
+    {
+        int key, v = heapPop(&heap, &key);
+        if (settled[v] == query_stamp || key != dist[v] + bound[v])
+            continue;
+        settled[v] = query_stamp;
+        routing_counters.settled++;
+        if (v == dest_id)
+        {
+            found = 1;
+            break;
+        }
+        struct JunctionStruct *junction = &roadMap[v];
+        for (int i = 0; i < junction->num_roads; i++)
+        {
+            struct RoadStruct *road = &junction->roads[i];
+            int u = road->to->id;
+            int alt = dist[v] + road->roadLength / (v == source_id ? road->currentSpeed : road->maxSpeed);
+            if (stamp[u] != query_stamp)
+            {
+                stamp[u] = query_stamp;
+                bound[u] = landmarkBound(u, dest_id);
+                dist[u] = ROUTING_UNREACHABLE;
+            }
+            if (bound[u] == ROUTING_UNREACHABLE || settled[u] == query_stamp || alt >= dist[u])
+                continue;
+            dist[u] = alt;
+            prev[u] = v;
+            heapPush(&heap, alt + bound[u], u);
+        }
+    }
+    if (!found)
+        return -1;
+    int u = dest_id;
+    while (prev[u] != source_id)
+    {
+        u = prev[u];
+    }
+    return u;
+}
+
+/**
+ * FNV-1a over every road's junctions, length and maximum speed, which is all the contraction hierarchy depends on
+ **/
+static unsigned long long mapChecksum()
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < num_junctions; i++)
+    {
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            int values[4] = {i, roadMap[i].roads[j].to->id, roadMap[i].roads[j].roadLength, roadMap[i].roads[j].maxSpeed};
+            for (int k = 0; k < 4; k++)
+            {
+                hash = (hash ^ (unsigned int)values[k]) * 0x100000001b3ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+/**
+ * Loads the contraction hierarchy from its cache, returns zero if there is none or it was built for another map
+ **/
+static int loadChCache(char *filename, unsigned long long checksum)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+        return 0;
+    struct ChCacheHeader header;
+    if (fread(&header, sizeof(struct ChCacheHeader), 1, f) != 1 || memcmp(header.magic, CH_CACHE_MAGIC, 8) != 0 ||
+        header.num_junctions != num_junctions || header.num_roads != num_roads || header.checksum != checksum)
+    {
+        fclose(f);
+        return 0;
+    }
+    ch_rank = (int *)malloc(sizeof(int) * num_junctions);
+    up_offsets = (int *)malloc(sizeof(int) * (num_junctions + 1));
+    down_offsets = (int *)malloc(sizeof(int) * (num_junctions + 1));
+    up_edges = (struct ChEdge *)malloc(sizeof(struct ChEdge) * (header.num_up + 1));
+    down_edges = (struct ChEdge *)malloc(sizeof(struct ChEdge) * (header.num_down + 1));
+    int read = fread(ch_rank, sizeof(int), num_junctions, f) == (size_t)num_junctions &&
+               fread(up_offsets, sizeof(int), num_junctions + 1, f) == (size_t)(num_junctions + 1) &&
+               fread(up_edges, sizeof(struct ChEdge), header.num_up, f) == (size_t)header.num_up &&
+               fread(down_offsets, sizeof(int), num_junctions + 1, f) == (size_t)(num_junctions + 1) &&
+               fread(down_edges, sizeof(struct ChEdge), header.num_down, f) == (size_t)header.num_down;
+    fclose(f);
+    if (!read)
+    {
+        free(ch_rank);
+        free(up_offsets);
+        free(down_offsets);
+        free(up_edges);
+        free(down_edges);
+        ch_rank = up_offsets = down_offsets = NULL;
+        up_edges = down_edges = NULL;
+    }
+    return read;
+}
+
+/**
+ * Caches the contraction hierarchy next to the map. Every vehicle actor may build it at the same time, so each
+ * writes a uniquely named file of its own and renames it into place. If the map's directory can not be written it
+ * is just rebuilt next time
+ **/
+static void saveChCache(char *filename, unsigned long long checksum)
+{
+    char temporary[4096 + 32];
+    snprintf(temporary, sizeof(temporary), "%s.XXXXXX", filename);
+    int fd = mkstemp(temporary);
+    if (fd < 0)
+        return;
+    FILE *f = fdopen(fd, "wb");
+    if (f == NULL)
+    {
+        close(fd);
+        remove(temporary);
+        return;
+    }
+    struct ChCacheHeader header;
+    memset(&header, 0, sizeof(struct ChCacheHeader));
+    memcpy(header.magic, CH_CACHE_MAGIC, 8);
+    header.num_junctions = num_junctions;
+    header.num_roads = num_roads;
+    header.num_up = up_offsets[num_junctions];
+    header.num_down = down_offsets[num_junctions];
+    header.checksum = checksum;
+    int written = fwrite(&header, sizeof(struct ChCacheHeader), 1, f) == 1 &&
+                  fwrite(ch_rank, sizeof(int), num_junctions, f) == (size_t)num_junctions &&
+                  fwrite(up_offsets, sizeof(int), num_junctions + 1, f) == (size_t)(num_junctions + 1) &&
+                  fwrite(up_edges, sizeof(struct ChEdge), header.num_up, f) == (size_t)header.num_up &&
+                  fwrite(down_offsets, sizeof(int), num_junctions + 1, f) == (size_t)(num_junctions + 1) &&
+                  fwrite(down_edges, sizeof(struct ChEdge), header.num_down, f) == (size_t)header.num_down;
+    if (fclose(f) != 0 || !written || rename(temporary, filename) != 0)
+    {
+        remove(temporary);
+    }
+}
+
+/**
+ * Adds an edge to the graph being contracted, or lowers the cost of the edge already between the two junctions
+ **/
+static void addChEdge(int from, int to, int cost, int mid)
+{
+    struct ChEdgeList *out = &ch_out[from], *in = &ch_in[to];
+    for (int i = 0; i < out->count; i++)
+    {
+        if (out->edges[i].node == to)
+        {
+            if (cost < out->edges[i].cost)
+            {
+                out->edges[i].cost = cost;
+                out->edges[i].mid = mid;
+                for (int j = 0; j < in->count; j++)
+                {
+                    if (in->edges[j].node == from)
+                    {
+                        in->edges[j].cost = cost;
+                        in->edges[j].mid = mid;
+                    }
+                }
+            }
+            return;
+        }
+    }
+    struct ChEdgeList *lists[2] = {out, in};
+    for (int l = 0; l < 2; l++)
+    {
+        if (lists[l]->count == lists[l]->capacity)
+        {
+            lists[l]->capacity = lists[l]->capacity > 0 ? lists[l]->capacity * 2 : 4;
+            lists[l]->edges = (struct ChEdge *)realloc(lists[l]->edges, sizeof(struct ChEdge) * lists[l]->capacity);
+        }
+        struct ChEdge edge = {l == 0 ? to : from, cost, mid};
+        lists[l]->edges[lists[l]->count++] = edge;
+    }
+}
+
+/**
+ * Searches outwards from source through the junctions not yet contracted, avoiding the one being contracted, until
+ * every junction within limit is settled or the search has gone on too long. The distances found are in dist
+ * (valid where stamp matches the current query) and are upper bounds on the true ones
+ **/
+static int witnessSearch(int source, int excluded, int limit)
+{
+    nextQueryStamp();
+    heap.size = 0;
+    stamp[source] = query_stamp;
+    dist[source] = 0;
+    heapPush(&heap, 0, source);
+    int num_settled = 0;
+    while (heap.size > 0 && num_settled < CH_WITNESS_SETTLE_LIMIT)
+    {
+        int key, v = heapPop(&heap, &key);
+        if (key > dist[v])
+            continue;
+        if (key > limit)
+            break;
+        num_settled++;
+        for (int i = 0; i < ch_out[v].count; i++)
+        {
+            struct ChEdge *edge = &ch_out[v].edges[i];
+            if (contracted[edge->node] || edge->node == excluded)
+                continue;
+            int alt = key + edge->cost;
+            if (stamp[edge->node] != query_stamp || alt < dist[edge->node])
+            {
+                stamp[edge->node] = query_stamp;
+                dist[edge->node] = alt;
+                heapPush(&heap, alt, edge->node);
+            }
+        }
+    }
+    return num_settled;
+}
+
+/**
+ * Works out the shortcuts needed to contract junction v: one from each remaining junction u with a road to v to
+ * each remaining junction w that v has a road to, unless a witness route from u to w avoiding v is no longer.
+ * The shortcuts are only added if add is set. Returns the number of shortcuts
+ **/
+static int contractJunction(int v, int add)
+{
+    int shortcuts = 0, max_out = 0;
+    for (int j = 0; j < ch_out[v].count; j++)
+    {
+        if (!contracted[ch_out[v].edges[j].node] && ch_out[v].edges[j].cost > max_out)
+            max_out = ch_out[v].edges[j].cost;
+    }
+    for (int i = 0; i < ch_in[v].count; i++)
+    {
+        struct ChEdge in = ch_in[v].edges[i];
+        if (contracted[in.node])
+            continue;
+        witnessSearch(in.node, v, in.cost + max_out);
+        for (int j = 0; j < ch_out[v].count; j++)
+        {
+            struct ChEdge out = ch_out[v].edges[j];
+            if (contracted[out.node] || out.node == in.node)
+                continue;
+            int via = in.cost + out.cost;
+            if (stamp[out.node] == query_stamp && dist[out.node] <= via)
+                continue;
+            shortcuts++;
+            if (add)
+                addChEdge(in.node, out.node, via, v);
+        }
+    }
+    return shortcuts;
+}
+
+/**
+ * Contracts the junctions one at a time, cheapest first by edge difference (the shortcuts contracting a junction
+ * adds less the edges it removes) plus the neighbours already contracted, which keeps the contraction spread over
+ * the map. The priorities are updated lazily: a junction whose priority has risen past the next one's is put back.
+ * Each junction's rank is its place in the order, and the edges between junctions are kept in the direction going
+ * up the ranks
+ **/
+static void buildContractionHierarchy()
+{
+    ch_out = (struct ChEdgeList *)calloc(num_junctions, sizeof(struct ChEdgeList));
+    ch_in = (struct ChEdgeList *)calloc(num_junctions, sizeof(struct ChEdgeList));
+    contracted = (char *)calloc(num_junctions, sizeof(char));
+    int *deleted_neighbours = (int *)calloc(num_junctions, sizeof(int));
+    ch_rank = (int *)malloc(sizeof(int) * num_junctions);
+    for (int i = 0; i < num_junctions; i++)
+    {
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[i].roads[j];
+            if (road->to->id != i)
+                addChEdge(i, road->to->id, road->roadLength / road->maxSpeed, -1);
+        }
+    }
+
+    struct RouteHeap order;
+    memset(&order, 0, sizeof(struct RouteHeap));
+    for (int v = 0; v < num_junctions; v++)
+    {
+        heapPush(&order, contractJunction(v, 0) - ch_in[v].count - ch_out[v].count, v);
+    }
+    int next_rank = 0;
+    while (order.size > 0)
+    {
+        int key, v = heapPop(&order, &key);
+        int degree = 0;
+        for (int i = 0; i < ch_in[v].count; i++)
+            degree += !contracted[ch_in[v].edges[i].node];
+        for (int i = 0; i < ch_out[v].count; i++)
+            degree += !contracted[ch_out[v].edges[i].node];
+        int priority = contractJunction(v, 0) - degree + deleted_neighbours[v];
+        if (order.size > 0 && priority > order.keys[0])
+        {
+            heapPush(&order, priority, v);
+            continue;
+        }
+        contractJunction(v, 1);
+        contracted[v] = 1;
+        ch_rank[v] = next_rank++;
+        for (int i = 0; i < ch_in[v].count; i++)
+            deleted_neighbours[ch_in[v].edges[i].node]++;
+        for (int i = 0; i < ch_out[v].count; i++)
+            deleted_neighbours[ch_out[v].edges[i].node]++;
+    }
+    free(order.keys);
+    free(order.junctions);
+
+    // Keep the upward edges out of each junction and the edges into it from above
+    up_offsets = (int *)calloc(num_junctions + 1, sizeof(int));
+    down_offsets = (int *)calloc(num_junctions + 1, sizeof(int));
+    for (int v = 0; v < num_junctions; v++)
+    {
+        up_offsets[v + 1] = up_offsets[v];
+        for (int i = 0; i < ch_out[v].count; i++)
+            up_offsets[v + 1] += ch_rank[ch_out[v].edges[i].node] > ch_rank[v];
+        down_offsets[v + 1] = down_offsets[v];
+        for (int i = 0; i < ch_in[v].count; i++)
+            down_offsets[v + 1] += ch_rank[ch_in[v].edges[i].node] > ch_rank[v];
+    }
+    up_edges = (struct ChEdge *)malloc(sizeof(struct ChEdge) * (up_offsets[num_junctions] + 1));
+    down_edges = (struct ChEdge *)malloc(sizeof(struct ChEdge) * (down_offsets[num_junctions] + 1));
+    for (int v = 0; v < num_junctions; v++)
+    {
+        int up = up_offsets[v], down = down_offsets[v];
+        for (int i = 0; i < ch_out[v].count; i++)
+        {
+            if (ch_rank[ch_out[v].edges[i].node] > ch_rank[v])
+                up_edges[up++] = ch_out[v].edges[i];
+        }
+        for (int i = 0; i < ch_in[v].count; i++)
+        {
+            if (ch_rank[ch_in[v].edges[i].node] > ch_rank[v])
+                down_edges[down++] = ch_in[v].edges[i];
+        }
+        free(ch_out[v].edges);
+        free(ch_in[v].edges);
+    }
+    free(ch_out);
+    free(ch_in);
+    free(contracted);
+    free(deleted_neighbours);
+    ch_out = ch_in = NULL;
+    contracted = NULL;
+}
+
+/**
+ * Bidirectional search of the contraction hierarchy, forwards from source and backwards from dest, each only going
+ * up the ranks. Stops once neither side can improve on the best route through a junction both have reached. Returns
+ * the free flow distance and sets the junction the route goes highest through, or returns ROUTING_UNREACHABLE
+ **/
+static int chSearch(int source_id, int dest_id, int *meeting)
+{
+    nextQueryStamp();
+    heap.size = 0;
+    back_heap.size = 0;
+    stamp[source_id] = back_stamp[dest_id] = query_stamp;
+    dist[source_id] = back_dist[dest_id] = 0;
+    prev[source_id] = back_next[dest_id] = -1;
+    heapPush(&heap, 0, source_id);
+    heapPush(&back_heap, 0, dest_id);
+    int best = ROUTING_UNREACHABLE;
+    *meeting = -1;
+    while (heap.size > 0 || back_heap.size > 0)
+    {
+        int forward_min = heap.size > 0 ? heap.keys[0] : ROUTING_UNREACHABLE;
+        int backward_min = back_heap.size > 0 ? back_heap.keys[0] : ROUTING_UNREACHABLE;
+        if (forward_min >= best && backward_min >= best)
+            break;
+        int forwards = forward_min <= backward_min;
+        struct RouteHeap *h = forwards ? &heap : &back_heap;
+        int *d = forwards ? dist : back_dist, *s = forwards ? stamp : back_stamp, *done = forwards ? settled : back_settled;
+        int *link = forwards ? prev : back_next, *other_d = forwards ? back_dist : dist, *other_s = forwards ? back_stamp : stamp;
+        int *offsets = forwards ? up_offsets : down_offsets;
+        struct ChEdge *edges = forwards ? up_edges : down_edges;
+        int key, v = heapPop(h, &key);
+        if (done[v] == query_stamp || key > d[v])
+            continue;
+        done[v] = query_stamp;
+        routing_counters.settled++;
+        if (other_s[v] == query_stamp && key + other_d[v] < best)
+        {
+            best = key + other_d[v];
+            *meeting = v;
+        }
+        for (int e = offsets[v]; e < offsets[v + 1]; e++)
+        {
+            int u = edges[e].node, alt = key + edges[e].cost;
+            if (s[u] != query_stamp || alt < d[u])
+            {
+                s[u] = query_stamp;
+                d[u] = alt;
+                link[u] = v;
+                heapPush(h, alt, u);
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * The junction a hierarchy edge from a to b bypasses, -1 if the edge is a road. An edge up the ranks is kept with
+ * the junction it leaves and an edge down the ranks with the junction it arrives at
+ **/
+static int chEdgeMid(int a, int b)
+{
+    int mid = -1, cost = ROUTING_UNREACHABLE;
+    if (ch_rank[a] < ch_rank[b])
+    {
+        for (int e = up_offsets[a]; e < up_offsets[a + 1]; e++)
+        {
+            if (up_edges[e].node == b && up_edges[e].cost < cost)
+            {
+                cost = up_edges[e].cost;
+                mid = up_edges[e].mid;
+            }
+        }
+    }
+    else
+    {
+        for (int e = down_offsets[b]; e < down_offsets[b + 1]; e++)
+        {
+            if (down_edges[e].node == a && down_edges[e].cost < cost)
+            {
+                cost = down_edges[e].cost;
+                mid = down_edges[e].mid;
+            }
+        }
+    }
+    return mid;
+}
+
+/**
+ * Whether the roads a hierarchy edge from a to b stands for go through junction avoid (other than at a)
+ **/
+static int chEdgePasses(int a, int b, int avoid)
+{
+    if (b == avoid)
+        return 1;
+    int mid = chEdgeMid(a, b);
+    return mid != -1 && (chEdgePasses(a, mid, avoid) || chEdgePasses(mid, b, avoid));
+}
+
+/**
+ * Whether the route the last search found, from its start up to the meeting junction and down to its end, keeps
+ * away from junction avoid
+ **/
+static int chRouteAvoids(int meeting, int avoid)
+{
+    for (int v = meeting; prev[v] != -1; v = prev[v])
+    {
+        if (chEdgePasses(prev[v], v, avoid))
+            return 0;
+    }
+    for (int v = meeting; back_next[v] != -1; v = back_next[v])
+    {
+        if (chEdgePasses(v, back_next[v], avoid))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * The next junction on the shortest route with the contraction hierarchy. If the roads leaving the source take
+ * their free flow time the hierarchy's route is planRoute()'s, so the first edge of the route is unpacked down to a
+ * road. If they are congested each is costed at its current speed and followed by a free flow distance query from
+ * where it leads. The free flow distances are never more than the real ones, so the cheapest is the answer as long
+ * as its route does not come back through the source (where planRoute() would cost it at the current speed), and
+ * otherwise the query falls back to a plain Dijkstra search
+ **/
+int chRoute(int source_id, int dest_id)
+{
+    routing_counters.queries++;
+    if (source_id == dest_id)
+        return -1;
+    struct JunctionStruct *source = &roadMap[source_id];
+    int free_flow = 1;
+    for (int i = 0; i < source->num_roads; i++)
+    {
+        struct RoadStruct *road = &source->roads[i];
+        free_flow = free_flow && road->roadLength / road->currentSpeed == road->roadLength / road->maxSpeed;
+    }
+
+    int meeting;
+    if (!free_flow)
+    {
+        int best = ROUTING_UNREACHABLE, next_jnct = -1;
+        for (int i = 0; i < source->num_roads; i++)
+        {
+            struct RoadStruct *road = &source->roads[i];
+            int rest = road->to->id == dest_id ? 0 : chSearch(road->to->id, dest_id, &meeting);
+            if (rest != ROUTING_UNREACHABLE && road->roadLength / road->currentSpeed + rest < best)
+            {
+                best = road->roadLength / road->currentSpeed + rest;
+                next_jnct = road->to->id;
+            }
+        }
+        if (next_jnct == -1 || next_jnct == dest_id)
+            return next_jnct;
+        chSearch(next_jnct, dest_id, &meeting);
+        if (chRouteAvoids(meeting, source_id))
+            return next_jnct;
+        routing_counters.fallback_queries++;
+        return searchRoute(source_id, dest_id);
+    }
+
+    if (chSearch(source_id, dest_id, &meeting) == ROUTING_UNREACHABLE)
+        return -1;
+    // The first edge of the route, which is the forward search's if it reached the meeting junction by going up
+    int next_jnct;
+    if (meeting != source_id)
+    {
+        next_jnct = meeting;
+        while (prev[next_jnct] != source_id)
+            next_jnct = prev[next_jnct];
+    }
+    else
+    {
+        next_jnct = back_next[source_id];
+    }
+    // Unpack the shortcuts, the first half of each is the start of the route
+    int mid = chEdgeMid(source_id, next_jnct);
+    while (mid != -1)
+    {
+        next_jnct = mid;
+        mid = chEdgeMid(source_id, next_jnct);
+    }
+    return next_jnct;
+}
+
+/**
+ * The next junctions the trees have worked out are stale once the speeds have changed. The live trees' distances
+ * are stale too, so the roads whose cost has changed are costed again and every tree is repaired
+ **/
+void routingSpeedsChanged(int *roads, int count)
+{
+    speed_epoch++;
+    if (routing_settings.mode != ROUTING_TREES || !routing_settings.live_trees)
+        return;
+    int num_changed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        struct RoadStruct *road = road_of[roads[i]];
+        int slot = road_slot[roads[i]], cost = road->roadLength / road->currentSpeed;
+        if (cost != reverse_cost[slot])
+        {
+            changed_roads[num_changed] = roads[i];
+            old_costs[num_changed++] = reverse_cost[slot];
+            reverse_cost[slot] = cost;
+        }
+    }
+    for (int t = 0; t < num_trees && num_changed > 0; t++)
+        repairTree(&trees[t], changed_roads, old_costs, num_changed);
+}
+
+/**
+ * Builds the tree for dest: Dijkstra's algorithm backwards over the roads arriving at each junction gives every
+ * junction's distance to dest and the junction after it, then (unless the tree is live) a depth first walk numbers
+ * each subtree
+ **/
+static void buildTree(struct RouteTree *tree, int dest_id)
+{
+    tree->dest = dest_id;
+    if (routing_settings.live_trees)
+    {
+        staticDistances(dest_id, 1, tree->dist, tree->next);
+        for (int v = 0; v < num_junctions; v++)
+        {
+            if (tree->dist[v] != ROUTING_UNREACHABLE)
+                routing_counters.settled++;
+        }
+        return;
+    }
+    int *parent = prev, *child_offsets = bound, *children = back_dist, *stack = back_next, *position = back_stamp;
+    staticDistances(dest_id, 1, tree->dist, parent);
+    // The children of each junction in compressed rows, child_offsets[v] ends up where v's children start
+    memset(child_offsets, 0, sizeof(int) * num_junctions);
+    int num_children = 0;
+    for (int v = 0; v < num_junctions; v++)
+    {
+        tree->next_epoch[v] = 0;
+        tree->enter[v] = tree->leave[v] = -1;
+        if (tree->dist[v] != ROUTING_UNREACHABLE)
+            routing_counters.settled++;
+        if (parent[v] >= 0)
+        {
+            child_offsets[parent[v]]++;
+            num_children++;
+        }
+    }
+    for (int v = 1; v < num_junctions; v++)
+        child_offsets[v] += child_offsets[v - 1];
+    for (int v = num_junctions - 1; v >= 0; v--)
+    {
+        if (parent[v] >= 0)
+            children[--child_offsets[parent[v]]] = v;
+    }
+
+    int clock = 0, top = 0;
+    stack[top++] = dest_id;
+    tree->enter[dest_id] = clock++;
+    position[dest_id] = child_offsets[dest_id];
+    while (top > 0)
+    {
+        int v = stack[top - 1];
+        int end = v + 1 < num_junctions ? child_offsets[v + 1] : num_children;
+        if (position[v] < end)
+        {
+            int c = children[position[v]++];
+            tree->enter[c] = clock++;
+            position[c] = child_offsets[c];
+            stack[top++] = c;
+        }
+        else
+        {
+            tree->leave[v] = clock++;
+            top--;
+        }
+    }
+    // back_stamp was borrowed for the walk, so the next query must not trust the stamps
+    memset(back_stamp, 0, sizeof(int) * num_junctions);
+}
+
+/**
+ * The tree for dest, building it if there is not one. When the trees have used up their memory the least recently
+ * used one makes way for it
+ **/
+static struct RouteTree *findTree(int dest_id)
+{
+    struct RouteTree *tree;
+    if (tree_of[dest_id] >= 0)
+    {
+        tree = &trees[tree_of[dest_id]];
+    }
+    else
+    {
+        int slot;
+        if (num_trees < max_trees)
+        {
+            slot = num_trees++;
+            trees[slot].dist = (int *)malloc(sizeof(int) * tree_ints * num_junctions);
+            trees[slot].next = trees[slot].dist + num_junctions;
+            if (!routing_settings.live_trees)
+            {
+                trees[slot].enter = trees[slot].next + num_junctions;
+                trees[slot].leave = trees[slot].enter + num_junctions;
+                trees[slot].next_epoch = trees[slot].leave + num_junctions;
+            }
+        }
+        else
+        {
+            slot = 0;
+            for (int t = 1; t < num_trees; t++)
+            {
+                if (trees[t].last_used < trees[slot].last_used)
+                    slot = t;
+            }
+            tree_of[trees[slot].dest] = -1;
+            routing_counters.tree_evictions++;
+        }
+        tree = &trees[slot];
+        routing_counters.tree_builds++;
+        buildTree(tree, dest_id);
+        tree_of[dest_id] = slot;
+    }
+    tree->last_used = ++tree_clock;
+    return tree;
+}
+
+/**
+ * Every vehicle heading for the same destination shares its tree. The next junction is the road out of the source
+ * with the cheapest time at its current speed plus the free flow distance on from where it leads, which is the
+ * answer as long as the tree's route from there does not come back through the source (where planRoute() would cost
+ * it at the current speed). Otherwise the query falls back to a plain Dijkstra search. The answer only depends on
+ * the speeds of the roads leaving the source, so it is kept until they next change. A live tree is kept up to date
+ * with the current speeds, so its answer is just the source's parent
+ **/
+int treeRoute(int source_id, int dest_id)
+{
+    routing_counters.queries++;
+    if (source_id == dest_id)
+        return -1;
+    struct RouteTree *tree = findTree(dest_id);
+    if (routing_settings.live_trees)
+        return tree->next[source_id];
+    if (tree->next_epoch[source_id] != speed_epoch + 1)
+    {
+        struct JunctionStruct *source = &roadMap[source_id];
+        int best = ROUTING_UNREACHABLE, next_jnct = -1;
+        for (int i = 0; i < source->num_roads; i++)
+        {
+            struct RoadStruct *road = &source->roads[i];
+            int u = road->to->id;
+            if (tree->dist[u] != ROUTING_UNREACHABLE && road->roadLength / road->currentSpeed + tree->dist[u] < best)
+            {
+                best = road->roadLength / road->currentSpeed + tree->dist[u];
+                next_jnct = u;
+            }
+        }
+        // The source is on the route from next_jnct exactly when next_jnct is in the source's subtree
+        if (next_jnct != -1 && tree->enter[source_id] >= 0 && tree->enter[source_id] <= tree->enter[next_jnct] &&
+            tree->leave[next_jnct] <= tree->leave[source_id])
+            next_jnct = ROUTING_TREE_SEARCH;
+        tree->next[source_id] = next_jnct;
+        tree->next_epoch[source_id] = speed_epoch + 1;
+    }
+    if (tree->next[source_id] != ROUTING_TREE_SEARCH)
+        return tree->next[source_id];
+    routing_counters.fallback_queries++;
+    return searchRoute(source_id, dest_id);
+}
+
+/**
+ * Repairs a live tree after the given roads changed cost. The junctions whose routes used a road that slowed down
+ * are cut out of the tree and each is given its best route through a road into the rest of the tree. Those, and
+ * the junctions at the start of a road that sped up enough to give them a shorter route, are then settled in order
+ * of their new distances, passing any improvement back to the junctions that lead to them. The tree is built again
+ * instead if too much of it would be cut out
+ **/
+static void repairTree(struct RouteTree *tree, int *roads, int *old, int count)
+{
+    // The junctions cut out are marked with the query stamp, each one's subtree is found through the roads arriving
+    // at it from junctions whose next junction it is
+    nextQueryStamp();
+    int *cut = back_next, num_cut = 0, limit = num_junctions * ROUTING_TREE_REPAIR_PERCENT / 100;
+    for (int i = 0; i < count; i++)
+    {
+        int u = road_from[roads[i]], w = road_of[roads[i]]->to->id;
+        if (reverse_cost[road_slot[roads[i]]] > old[i] && tree->next[u] == w && stamp[u] != query_stamp &&
+            tree->dist[u] == old[i] + tree->dist[w])
+        {
+            stamp[u] = query_stamp;
+            cut[num_cut++] = u;
+        }
+    }
+    for (int i = 0; i < num_cut && num_cut <= limit; i++)
+    {
+        int x = cut[i];
+        for (int s = reverse_offsets[x]; s < reverse_offsets[x + 1]; s++)
+        {
+            int z = reverse_from[s];
+            if (tree->next[z] == x && stamp[z] != query_stamp)
+            {
+                stamp[z] = query_stamp;
+                cut[num_cut++] = z;
+            }
+        }
+    }
+    if (num_cut > limit)
+    {
+        routing_counters.tree_rebuilds++;
+        buildTree(tree, tree->dest);
+        return;
+    }
+    routing_counters.tree_repairs++;
+
+    heap.size = 0;
+    for (int i = 0; i < num_cut; i++)
+    {
+        tree->dist[cut[i]] = ROUTING_UNREACHABLE;
+        tree->next[cut[i]] = -1;
+    }
+    for (int i = 0; i < num_cut; i++)
+    {
+        int x = cut[i];
+        for (int j = 0; j < roadMap[x].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[x].roads[j];
+            int y = road->to->id, cost = reverse_cost[road_slot[road->id]];
+            if (stamp[y] != query_stamp && tree->dist[y] != ROUTING_UNREACHABLE && tree->dist[y] + cost < tree->dist[x])
+            {
+                tree->dist[x] = tree->dist[y] + cost;
+                tree->next[x] = y;
+            }
+        }
+        if (tree->dist[x] != ROUTING_UNREACHABLE)
+            heapPush(&heap, tree->dist[x], x);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int u = road_from[roads[i]], w = road_of[roads[i]]->to->id, cost = reverse_cost[road_slot[roads[i]]];
+        if (cost < old[i] && tree->dist[w] != ROUTING_UNREACHABLE && tree->dist[w] + cost < tree->dist[u])
+        {
+            tree->dist[u] = tree->dist[w] + cost;
+            tree->next[u] = w;
+            heapPush(&heap, tree->dist[u], u);
+        }
+    }
+    while (heap.size > 0)
+    {
+        int key, x = heapPop(&heap, &key);
+        if (key > tree->dist[x])
+            continue;
+        routing_counters.settled++;
+        for (int s = reverse_offsets[x]; s < reverse_offsets[x + 1]; s++)
+        {
+            int z = reverse_from[s];
+            if (key + reverse_cost[s] < tree->dist[z])
+            {
+                tree->dist[z] = key + reverse_cost[s];
+                tree->next[z] = x;
+                heapPush(&heap, key + reverse_cost[s], z);
+            }
+        }
+    }
+}
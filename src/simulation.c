@@ -0,0 +1,792 @@
+// src/simulation.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/instrument.h"
+#include "../include/perf_counters.h"
+#include "../include/data_structures.h"
+#include "../include/utils.h"
+#include "../include/routing.h"
+#include "../include/simulation.h"
+
+// The state each actor keeps to itself, declared in data_structures.h
+ACTOR_LOCAL struct JunctionStruct *roadMap;
+ACTOR_LOCAL int num_junctions, num_roads;
+ACTOR_LOCAL struct VehicleStruct *vehicles;
+ACTOR_LOCAL int *route_request_vehicles, num_route_requests;
+ACTOR_LOCAL struct RandomStream random_stream;
+ACTOR_LOCAL int total_vehicles;
+ACTOR_LOCAL int passengers_delivered;
+ACTOR_LOCAL int vehicles_exhausted_fuel;
+ACTOR_LOCAL int passengers_stranded;
+ACTOR_LOCAL int vehicles_crashed;
+
+// The roads indexed by id, for applying published changes
+static ACTOR_LOCAL struct RoadStruct **roads_by_id;
+
+// The road network and vehicle model, shared by the actors and free of MPI so it can also be benchmarked on its own
+
+static int dijkstraRoute(int, int, struct JunctionStruct *, int, int);
+
+void handleVehicleUpdate(int i)
+{
+
+    if (getCurrentSeconds() - vehicles[i].start_t > vehicles[i].fuel)
+    {
+        vehicles_exhausted_fuel++;
+        passengers_stranded += vehicles[i].passengers;
+
+        retireVehicle(i);
+        return;
+    }
+
+    // If the vehicle is on a certain road rather than at a certain intersection
+    if (vehicles[i].roadOn != NULL && vehicles[i].currentJunction == NULL)
+    {
+        // Means that the vehicle is currently on a road
+        time_t sec = getCurrentSeconds();
+        int latest_time = sec - vehicles[i].last_distance_check_secs;
+        if (latest_time < 1)
+            return;
+        vehicles[i].last_distance_check_secs = sec;
+        double travelled_length = latest_time * vehicles[i].speed;
+        vehicles[i].remaining_distance -= travelled_length;
+        if (vehicles[i].remaining_distance <= 0)
+        {
+            // Left the road and arrived at the target junction
+            vehicles[i].arrived_road_time = 0;
+            vehicles[i].last_distance_check_secs = 0;
+            vehicles[i].remaining_distance = 0;
+            vehicles[i].speed = 0;
+            vehicles[i].currentJunction = vehicles[i].roadOn->to;
+            vehicles[i].currentJunction->num_vehicles++;
+            vehicles[i].currentJunction->total_number_vehicles++;
+            vehicles[i].roadOn->numVehiclesOnRoad--;
+            vehicles[i].roadOn = NULL;
+        }
+    }
+
+    // If the vehicle is at a certain intersection
+
+    if (vehicles[i].currentJunction != NULL)
+    {
+        // If the vehicle is at an intersection and is not on the road
+        if (vehicles[i].roadOn == NULL)
+        {
+            // If the road is NULL then the vehicle is on a junction and not on a road
+            if (vehicles[i].currentJunction->id == vehicles[i].dest)
+            {
+                // Arrived! Job done!
+                passengers_delivered += vehicles[i].passengers;
+                retireVehicle(i);
+                return;
+            }
+            else
+            {
+                int next_junction_target;
+                if (routing_settings.num_actors > 0)
+                {
+                    // The routing actors answer once a tick, so the vehicle waits at the junction until they have
+                    if (vehicles[i].next_junction == ROUTE_UNKNOWN)
+                    {
+                        requestRoute(i);
+                    }
+                    if (vehicles[i].next_junction < -1)
+                    {
+                        return;
+                    }
+                    next_junction_target = vehicles[i].next_junction;
+                    vehicles[i].next_junction = ROUTE_UNKNOWN;
+                    if (next_junction_target == -1)
+                    {
+                        // A new vehicle's destination is not checked when it is activated, so if it can not be
+                        // reached the vehicle heads somewhere else instead
+                        vehicles[i].dest = vehicles[i].currentJunction->id;
+                        while (vehicles[i].dest == vehicles[i].currentJunction->id)
+                        {
+                            vehicles[i].dest = getRandomInteger(0, num_junctions);
+                        }
+                        requestRoute(i);
+                        return;
+                    }
+                }
+                else
+                {
+                    next_junction_target = planRoute(vehicles[i].currentJunction->id, vehicles[i].dest, roadMap, num_junctions, num_roads);
+                }
+                if (next_junction_target != -1)
+                {
+                    int road_to_take = findAppropriateRoad(next_junction_target, vehicles[i].currentJunction);
+                    assert(vehicles[i].currentJunction->roads[road_to_take].to->id == next_junction_target);
+
+                    vehicles[i].roadOn = &(vehicles[i].currentJunction->roads[road_to_take]);
+                    vehicles[i].roadOn->numVehiclesOnRoad++;
+                    vehicles[i].roadOn->total_number_vehicles++;
+                    // If the number of vehicles on the road exceeds the maximum number of vehicles on the road, update the maximum number of vehicles
+                    if (vehicles[i].roadOn->max_concurrent_vehicles < vehicles[i].roadOn->numVehiclesOnRoad)
+                    {
+                        vehicles[i].roadOn->max_concurrent_vehicles = vehicles[i].roadOn->numVehiclesOnRoad;
+                    }
+                    // The remaining distance of the vehicle on this road is the length of the selected road
+                    vehicles[i].remaining_distance = vehicles[i].roadOn->roadLength;
+                    // The vehicle's speed is updated to the minimum of the vehicle's maximum speed and the current speed of the road
+                    vehicles[i].speed = vehicles[i].roadOn->currentSpeed;
+                    if (vehicles[i].speed > vehicles[i].maxSpeed)
+                        vehicles[i].speed = vehicles[i].maxSpeed;
+                }
+                else
+                {
+                    // Report error (this should never happen)
+                    fprintf(stderr, "No longer a viable route\n");
+                    exit(-1);
+                }
+            }
+        }
+        // Here we have selected a junction, now it's time to determine if the vehicle can be released from the junction
+        char take_road = 0;
+        if (vehicles[i].currentJunction->hasTrafficLights)
+        {
+            // Need to check that we can go, otherwise need to wait until road enabled by traffic light
+            take_road = vehicles[i].roadOn == &vehicles[i].currentJunction->roads[vehicles[i].currentJunction->trafficLightsRoadEnabled];
+        }
+        else
+        {
+            // If not traffic light then there is a chance of collision
+            int collision = randomInteger(&vehicles[i].random, 0, 8) * vehicles[i].currentJunction->num_vehicles;
+            if (collision > 20)
+            {
+                // Vehicle has crashed!
+                passengers_stranded += vehicles[i].passengers;
+                vehicles_crashed++;
+                vehicles[i].currentJunction->total_number_crashes++;
+                retireVehicle(i);
+                return;
+            }
+            take_road = 1;
+        }
+        // If take the road then clear the junction
+        if (take_road)
+        {
+            vehicles[i].last_distance_check_secs = getCurrentSeconds();
+            vehicles[i].currentJunction->num_vehicles--;
+            vehicles[i].currentJunction = NULL;
+        }
+    }
+}
+
+/**
+ * Takes a vehicle out of the simulation, off the road or junction it was counted on
+ **/
+void retireVehicle(int i)
+{
+    if (vehicles[i].currentJunction != NULL)
+    {
+        vehicles[i].currentJunction->num_vehicles--;
+    }
+    if (vehicles[i].roadOn != NULL)
+    {
+        vehicles[i].roadOn->numVehiclesOnRoad--;
+    }
+    vehicles[i].active = 0;
+    vehicles[i].currentJunction = NULL;
+    vehicles[i].roadOn = NULL;
+}
+
+int initVehicles(int num_initial)
+{
+    int count = 0;
+    for (int i = 0; i < num_initial; i++)
+    {
+        enum VehicleType vehicleType;
+        vehicleType = activateRandomVehicle();
+        int res = activateVehicle(vehicleType);
+        if (res != -1)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Loads the road map, building it from the node's shared image when main has set one up so the file is only parsed
+ * once per node
+ **/
+void loadRoadMap(char *filename)
+{
+    if (shared_map_image != NULL)
+    {
+        buildRoadMap(shared_map_image);
+        return;
+    }
+    int *image = readRoadMapImage(filename);
+    buildRoadMap(image);
+    free(image);
+}
+
+/**
+ * Parses the road map file into an image made only of ints, so it can be copied into memory shared between processes:
+ * the number of junctions, roads and traffic lights, then the from, to, length and speed of every road and then the
+ * junctions with traffic lights
+ **/
+int *readRoadMapImage(char *filename)
+{
+    enum ReadMode currentMode = NONE;
+    char buffer[MAX_ROAD_LEN];
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error opening roadmap file '%s'\n", filename);
+        exit(-1);
+    }
+
+    int image_junctions = 0, image_roads = 0, image_lights = 0, road_capacity = 1024, light_capacity = 64;
+    int *roads = (int *)malloc(sizeof(int) * MAP_IMAGE_ROAD_LEN * road_capacity);
+    int *lights = (int *)malloc(sizeof(int) * light_capacity);
+    while (fgets(buffer, MAX_ROAD_LEN, f))
+    {
+        if (buffer[0] == '%')
+            continue;
+        if (buffer[0] == '#')
+        {
+            if (strncmp("# Road layout:", buffer, 14) == 0)
+            {
+                char *s = strstr(buffer, ":");
+                image_junctions = atoi(&s[1]);
+                image_roads = 0;
+                currentMode = ROADMAP;
+            }
+            if (strncmp("# Traffic lights:", buffer, 17) == 0)
+            {
+                currentMode = TRAFFICLIGHTS;
+            }
+        }
+        else
+        {
+            if (currentMode == ROADMAP)
+            {
+                char *space = strstr(buffer, " ");
+                *space = '\0';
+                int from_id = atoi(buffer);
+                char *nextspace = strstr(&space[1], " ");
+                *nextspace = '\0';
+                int to_id = atoi(&space[1]);
+                char *nextspace2 = strstr(&nextspace[1], " ");
+                *nextspace = '\0';
+                int roadlength = atoi(&nextspace[1]);
+                int speed = atoi(&nextspace2[1]);
+                if (image_roads == road_capacity)
+                {
+                    road_capacity *= 2;
+                    roads = (int *)realloc(roads, sizeof(int) * MAP_IMAGE_ROAD_LEN * road_capacity);
+                }
+                int *road = &roads[image_roads * MAP_IMAGE_ROAD_LEN];
+                road[0] = from_id;
+                road[1] = to_id;
+                road[2] = roadlength;
+                road[3] = speed;
+                image_roads++;
+            }
+            else if (currentMode == TRAFFICLIGHTS)
+            {
+                if (image_lights == light_capacity)
+                {
+                    light_capacity *= 2;
+                    lights = (int *)realloc(lights, sizeof(int) * light_capacity);
+                }
+                lights[image_lights++] = atoi(buffer);
+            }
+        }
+    }
+    fclose(f);
+
+    int *image = (int *)malloc(sizeof(int) * (MAP_IMAGE_HEADER_LEN + MAP_IMAGE_ROAD_LEN * image_roads + image_lights));
+    image[0] = image_junctions;
+    image[1] = image_roads;
+    image[2] = image_lights;
+    memcpy(&image[MAP_IMAGE_HEADER_LEN], roads, sizeof(int) * MAP_IMAGE_ROAD_LEN * image_roads);
+    memcpy(&image[MAP_IMAGE_HEADER_LEN + MAP_IMAGE_ROAD_LEN * image_roads], lights, sizeof(int) * image_lights);
+    free(roads);
+    free(lights);
+    return image;
+}
+
+/**
+ * The number of ints in a road map image
+ **/
+int roadMapImageLength(int *image)
+{
+    return MAP_IMAGE_HEADER_LEN + MAP_IMAGE_ROAD_LEN * image[1] + image[2];
+}
+
+/**
+ * Builds roadMap from an image read by readRoadMapImage, setting num_junctions and num_roads
+ **/
+void buildRoadMap(int *image)
+{
+    num_junctions = image[0];
+    num_roads = 0;
+    roadMap = (struct JunctionStruct *)malloc(sizeof(struct JunctionStruct) * num_junctions);
+    for (int i = 0; i < num_junctions; i++)
+    {
+        roadMap[i].id = i;
+        roadMap[i].num_roads = 0;
+        roadMap[i].num_vehicles = 0;
+        roadMap[i].hasTrafficLights = 0;
+        roadMap[i].trafficLightsRoadEnabled = 0;
+        roadMap[i].total_number_crashes = 0;
+        roadMap[i].total_number_vehicles = 0;
+        // Not ideal to allocate all roads size here
+        roadMap[i].roads = (struct RoadStruct *)malloc(sizeof(struct RoadStruct) * MAX_NUM_ROADS_PER_JUNCTION);
+    }
+    for (int r = 0; r < image[1]; r++)
+    {
+        int *road = &image[MAP_IMAGE_HEADER_LEN + r * MAP_IMAGE_ROAD_LEN];
+        int from_id = road[0], to_id = road[1];
+        if (roadMap[from_id].num_roads >= MAX_NUM_ROADS_PER_JUNCTION)
+        {
+            fprintf(stderr, "Error: Tried to create road %d at junction %d, but maximum number of roads is %d, increase 'MAX_NUM_ROADS_PER_JUNCTION'",
+                    roadMap[from_id].num_roads, from_id, MAX_NUM_ROADS_PER_JUNCTION);
+            exit(-1);
+        }
+        roadMap[from_id].roads[roadMap[from_id].num_roads].id = num_roads;
+        roadMap[from_id].roads[roadMap[from_id].num_roads].from = &roadMap[from_id];
+        roadMap[from_id].roads[roadMap[from_id].num_roads].to = &roadMap[to_id];
+        roadMap[from_id].roads[roadMap[from_id].num_roads].roadLength = road[2];
+        roadMap[from_id].roads[roadMap[from_id].num_roads].maxSpeed = road[3];
+        roadMap[from_id].roads[roadMap[from_id].num_roads].numVehiclesOnRoad = 0;
+        roadMap[from_id].roads[roadMap[from_id].num_roads].currentSpeed = road[3];
+        roadMap[from_id].roads[roadMap[from_id].num_roads].total_number_vehicles = 0;
+        roadMap[from_id].roads[roadMap[from_id].num_roads].max_concurrent_vehicles = 0;
+        roadMap[from_id].num_roads++;
+        num_roads++;
+    }
+    int *lights = &image[MAP_IMAGE_HEADER_LEN + MAP_IMAGE_ROAD_LEN * image[1]];
+    for (int i = 0; i < image[2]; i++)
+    {
+        if (roadMap[lights[i]].num_roads > 0)
+            roadMap[lights[i]].hasTrafficLights = 1;
+    }
+    roads_by_id = (struct RoadStruct **)malloc(sizeof(struct RoadStruct *) * (num_roads + 1));
+    for (int i = 0; i < num_junctions; i++)
+    {
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            roads_by_id[roadMap[i].roads[j].id] = &roadMap[i].roads[j];
+        }
+    }
+}
+
+/**
+ * Roadjunction's update for a tick: switches the traffic lights and slows each road down by the vehicles on it,
+ * summed over the occupancy reported by each vehicle actor (num_roads ints each). The new speeds and then the lights
+ * are written to published, ready to go to the vehicle actors
+ **/
+void updateJunctions(int elapsed_mins, int *occupancy, int num_actors, int *published)
+{
+    for (int i = 0; i < num_junctions; i++)
+    {
+        // Check and update traffic lights if necessary
+        if (roadMap[i].hasTrafficLights && roadMap[i].num_roads > 0)
+        {
+            roadMap[i].trafficLightsRoadEnabled = elapsed_mins % roadMap[i].num_roads;
+        }
+        published[num_roads + i] = roadMap[i].trafficLightsRoadEnabled;
+
+        // Iterate over each road connected to the current junction
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[i].roads[j];
+            int num_vehicles_on_road = 0;
+            for (int count = 0; count < num_actors; count++)
+            {
+                num_vehicles_on_road += occupancy[count * num_roads + road->id];
+            }
+
+            // Adjust road speed based on the number of vehicles (congestion)
+            road->currentSpeed = road->maxSpeed - num_vehicles_on_road;
+            if (road->currentSpeed < 10)
+            {
+                road->currentSpeed = 10;
+            }
+            published[road->id] = road->currentSpeed;
+        }
+    }
+}
+
+/**
+ * Writes how many of this actor's vehicles are on each road to occupancy. If last is given, returns how far the
+ * occupancy has drifted from it, the total change in vehicles over all the roads
+ **/
+int readOccupancy(int *occupancy, int *last)
+{
+    int drift = 0;
+    for (int i = 0; i < num_junctions; i++)
+    {
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[i].roads[j];
+            occupancy[road->id] = road->numVehiclesOnRoad;
+            if (last != NULL)
+            {
+                drift += abs(road->numVehiclesOnRoad - last[road->id]);
+            }
+        }
+    }
+    return drift;
+}
+
+/**
+ * Applies the road speeds and traffic lights published by roadjunction to the road map, listing the roads whose
+ * speed has changed. Returns how many there are
+ **/
+int applyPublishedSpeeds(int *published, int *changed_roads)
+{
+    int num_changed = 0;
+    for (int i = 0; i < num_junctions; i++)
+    {
+        roadMap[i].trafficLightsRoadEnabled = published[num_roads + i];
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[i].roads[j];
+            if (road->currentSpeed != published[road->id])
+            {
+                changed_roads[num_changed++] = road->id;
+                road->currentSpeed = published[road->id];
+            }
+        }
+    }
+    return num_changed;
+}
+
+/**
+ * Encodes roadjunction's published table for sending as the entries that differ from last, or as the whole table if
+ * full is set or there are too many of them, and brings last up to date. Returns the number of ints in publication,
+ * which needs room for the whole table and its header
+ **/
+int encodePublication(int *published, int *last, int full, int *publication)
+{
+    int length = num_roads + num_junctions, max_changes = length * PUBLICATION_DELTA_PERCENT / 200, changes = 0;
+    for (int i = 0; i < length && !full; i++)
+    {
+        if (published[i] != last[i])
+        {
+            if (changes == max_changes)
+            {
+                full = 1;
+                break;
+            }
+            publication[1 + 2 * changes] = i;
+            publication[2 + 2 * changes] = published[i];
+            changes++;
+        }
+    }
+    memcpy(last, published, sizeof(int) * length);
+    if (full)
+    {
+        publication[0] = PUBLICATION_FULL;
+        memcpy(&publication[1], published, sizeof(int) * length);
+        return length + 1;
+    }
+    publication[0] = changes;
+    return 1 + 2 * changes;
+}
+
+/**
+ * Applies a publication encoded by encodePublication to the road map, listing the roads whose speed has changed as
+ * applyPublishedSpeeds does. Returns how many there are
+ **/
+int applyPublication(int *publication, int *changed_roads)
+{
+    if (publication[0] == PUBLICATION_FULL)
+    {
+        return applyPublishedSpeeds(&publication[1], changed_roads);
+    }
+    int num_changed = 0;
+    for (int c = 0; c < publication[0]; c++)
+    {
+        int index = publication[1 + 2 * c], value = publication[2 + 2 * c];
+        if (index >= num_roads)
+        {
+            roadMap[index - num_roads].trafficLightsRoadEnabled = value;
+        }
+        else if (roads_by_id[index]->currentSpeed != value)
+        {
+            changed_roads[num_changed++] = index;
+            roads_by_id[index]->currentSpeed = value;
+        }
+    }
+    return num_changed;
+}
+
+/**
+ * Frees the road map, a pool worker loads it again each time it is started as an actor
+ **/
+void freeRoadMap()
+{
+    for (int i = 0; i < num_junctions; i++)
+    {
+        free(roadMap[i].roads);
+    }
+    free(roadMap);
+    roadMap = NULL;
+    free(roads_by_id);
+    roads_by_id = NULL;
+}
+
+/**
+ * Activates a vehicle and sets its type and route randomly
+ **/
+int activateRandomVehicle()
+{
+    int random_vehicle_type = getRandomInteger(0, 5);
+    enum VehicleType vehicleType;
+    if (random_vehicle_type == 0)
+    {
+        vehicleType = BUS;
+    }
+    else if (random_vehicle_type == 1)
+    {
+        vehicleType = CAR;
+    }
+    else if (random_vehicle_type == 2)
+    {
+        vehicleType = MINI_BUS;
+    }
+    else if (random_vehicle_type == 3)
+    {
+        vehicleType = COACH;
+    }
+    else if (random_vehicle_type == 4)
+    {
+        vehicleType = MOTORBIKE;
+    }
+    else if (random_vehicle_type == 5)
+    {
+        vehicleType = BIKE;
+    }
+    // 返回激活的车辆的索引
+    return vehicleType;
+}
+
+void requestRoute(int i)
+{
+    vehicles[i].next_junction = ROUTE_REQUESTED;
+    route_request_vehicles[num_route_requests++] = i;
+}
+
+/**
+ * Activates a vehicle with a specific type, will find an idle vehicle data
+ * element and then initialise this with a random (but valid) route between
+ * two junction. The new vehicle's index is returned,
+ * or -1 if there are no free slots.
+ **/
+int activateVehicle(enum VehicleType vehicleType)
+{
+    int id = findFreeVehicle();
+    if (id >= 0)
+    {
+        vehicles[id].id = id;
+        vehicles[id].active = 1;
+        // The vehicle's stream is keyed from the actor's, so the same seed gives every vehicle the same stream
+        vehicles[id].random.key = randomNext(&random_stream);
+        vehicles[id].random.counter = 0;
+        vehicles[id].start_t = getCurrentSeconds();
+        vehicles[id].last_distance_check_secs = 0;
+        vehicles[id].speed = 0;
+        vehicles[id].remaining_distance = 0;
+        vehicles[id].arrived_road_time = 0;
+        vehicles[id].next_junction = ROUTE_UNKNOWN;
+        vehicles[id].source = vehicles[id].dest = getRandomInteger(0, num_junctions);
+        while (vehicles[id].dest == vehicles[id].source)
+        {
+            // Ensure that the source and destination are different, the routing actors (if there are any) check the
+            // route once the vehicle first asks for it
+            vehicles[id].dest = getRandomInteger(0, num_junctions);
+            if (vehicles[id].dest != vehicles[id].source && routing_settings.num_actors == 0)
+            {
+                // See if there is a viable route between the source and destination
+                int next_jnct = planRoute(vehicles[id].source, vehicles[id].dest, roadMap, num_junctions, num_roads);
+                if (next_jnct == -1)
+                {
+                    // Regenerate source and dest
+                    vehicles[id].source = vehicles[id].dest = getRandomInteger(0, num_junctions);
+                }
+            }
+        }
+        vehicles[id].currentJunction = &roadMap[vehicles[id].source];
+        vehicles[id].currentJunction->num_vehicles++;
+        vehicles[id].currentJunction->total_number_vehicles++;
+        vehicles[id].roadOn = NULL;
+        if (vehicleType == CAR)
+        {
+            vehicles[id].maxSpeed = CAR_MAX_SPEED;
+            vehicles[id].passengers = getRandomInteger(1, CAR_PASSENGERS);
+            vehicles[id].fuel = getRandomInteger(CAR_MIN_FUEL, CAR_MAX_FUEL);
+        }
+        else if (vehicleType == BUS)
+        {
+            vehicles[id].maxSpeed = BUS_MAX_SPEED;
+            vehicles[id].passengers = getRandomInteger(1, BUS_PASSENGERS);
+            vehicles[id].fuel = getRandomInteger(BUS_MIN_FUEL, BUS_MAX_FUEL);
+        }
+        else if (vehicleType == MINI_BUS)
+        {
+            vehicles[id].maxSpeed = MINI_BUS_MAX_SPEED;
+            vehicles[id].passengers = getRandomInteger(1, MINI_BUS_PASSENGERS);
+            vehicles[id].fuel = getRandomInteger(MINI_BUS_MIN_FUEL, MINI_BUS_MAX_FUEL);
+        }
+        else if (vehicleType == COACH)
+        {
+            vehicles[id].maxSpeed = COACH_MAX_SPEED;
+            vehicles[id].passengers = getRandomInteger(1, COACH_PASSENGERS);
+            vehicles[id].fuel = getRandomInteger(COACH_MIN_FUEL, COACH_MAX_FUEL);
+        }
+        else if (vehicleType == MOTORBIKE)
+        {
+            vehicles[id].maxSpeed = MOTOR_BIKE_MAX_SPEED;
+            vehicles[id].passengers = getRandomInteger(1, MOTOR_BIKE_PASSENGERS);
+            vehicles[id].fuel = getRandomInteger(MOTOR_BIKE_MIN_FUEL, MOTOR_BIKE_MAX_FUEL);
+        }
+        else if (vehicleType == BIKE)
+        {
+            vehicles[id].maxSpeed = BIKE_MAX_SPEED;
+            vehicles[id].passengers = getRandomInteger(1, BIKE_PASSENGERS);
+            vehicles[id].fuel = getRandomInteger(BIKE_MIN_FUEL, BIKE_MAX_FUEL);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown vehicle type\n");
+        }
+        return id;
+    }
+    return -1;
+}
+
+/**
+ * Returns the next junction on the shortest route from the source to the destination with the routing mode in use,
+ * or -1 if there is no route. Leaving the source is costed at the roads' current speeds and the rest of the route at
+ * their maximum speeds
+ **/
+int planRoute(int source_id, int dest_id, struct JunctionStruct *roadMap, int num_junctions, int num_roads)
+{
+    instrumentBegin(INSTR_ROUTING);
+    perfRegionBegin(PERF_ROUTE_QUERY);
+    int next_jnct;
+    if (routing_settings.mode == ROUTING_ALT)
+    {
+        next_jnct = altRoute(source_id, dest_id);
+    }
+    else if (routing_settings.mode == ROUTING_CH)
+    {
+        next_jnct = chRoute(source_id, dest_id);
+    }
+    else if (routing_settings.mode == ROUTING_TREES)
+    {
+        next_jnct = treeRoute(source_id, dest_id);
+    }
+    else
+    {
+        next_jnct = dijkstraRoute(source_id, dest_id, roadMap, num_junctions, num_roads);
+    }
+    perfRegionEnd(PERF_ROUTE_QUERY, 1);
+    instrumentEnd(INSTR_ROUTING);
+    return next_jnct;
+}
+
+/**
+ * The original planner, Dijkstra's algorithm outwards from the source scanning every junction for the closest
+ * unvisited one until the destination is reached
+ **/
+static int dijkstraRoute(int source_id, int dest_id, struct JunctionStruct *roadMap, int num_junctions, int num_roads)
+{
+    routing_counters.queries++;
+    if (VERBOSE_ROUTE_PLANNER)
+        printf("Search for route from %d to %d\n", source_id, dest_id);
+    double *dist = (double *)malloc(sizeof(double) * num_junctions);
+    char *active = (char *)malloc(sizeof(char) * num_junctions);
+    struct JunctionStruct **prev = (struct JunctionStruct **)malloc(sizeof(struct JunctionStruct *) * num_junctions);
+
+    int activeJunctions = num_junctions;
+    for (int i = 0; i < num_junctions; i++)
+    {
+        active[i] = 1;
+        prev[i] = NULL;
+        if (i != source_id)
+        {
+            dist[i] = LARGE_NUM;
+        }
+    }
+    dist[source_id] = 0;
+    while (activeJunctions > 0)
+    {
+        int v_idx = findIndexOfMinimum(dist, active, num_junctions);
+        if (v_idx == dest_id)
+            break;
+        struct JunctionStruct *v = &roadMap[v_idx];
+        active[v_idx] = 0;
+        activeJunctions--;
+        routing_counters.settled++;
+
+        for (int i = 0; i < v->num_roads; i++)
+        {
+            if (active[v->roads[i].to->id] && dist[v_idx] != LARGE_NUM)
+            {
+                double alt = dist[v_idx] + v->roads[i].roadLength / (v->id == source_id ? v->roads[i].currentSpeed : v->roads[i].maxSpeed);
+                if (alt < dist[v->roads[i].to->id])
+                {
+                    dist[v->roads[i].to->id] = alt;
+                    prev[v->roads[i].to->id] = v;
+                }
+            }
+        }
+    }
+    free(dist);
+    free(active);
+    int u_idx = dest_id;
+    int *route = (int *)malloc(sizeof(int) * num_junctions);
+    int route_len = 0;
+    if (prev[u_idx] != NULL || u_idx == source_id)
+    {
+        if (VERBOSE_ROUTE_PLANNER)
+            printf("Start at %d\n", u_idx);
+        while (prev[u_idx] != NULL)
+        {
+            route[route_len] = u_idx;
+            u_idx = prev[u_idx]->id;
+            if (VERBOSE_ROUTE_PLANNER)
+                printf("Route %d\n", u_idx);
+            route_len++;
+        }
+    }
+    free(prev);
+    if (route_len > 0)
+    {
+        int next_jnct = route[route_len - 1];
+        if (VERBOSE_ROUTE_PLANNER)
+            printf("Found next junction is %d\n", next_jnct);
+        free(route);
+        return next_jnct;
+    }
+    if (VERBOSE_ROUTE_PLANNER)
+        printf("Failed to find route between %d and %d\n", source_id, dest_id);
+    free(route);
+    return -1;
+}
+
+void writeDetailedInfo()
+{
+    FILE *f = fopen("../result/results", "w");
+    for (int i = 0; i < num_junctions; i++)
+    {
+        fprintf(f, "Junction %d: %d total vehicles and %d crashes\n", i, roadMap[i].total_number_vehicles, roadMap[i].total_number_crashes);
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            fprintf(f, "--> Road from %d to %d: Total vehicles %d and %d maximum concurrently\n", roadMap[i].roads[j].from->id,
+                    roadMap[i].roads[j].to->id, roadMap[i].roads[j].total_number_vehicles, roadMap[i].roads[j].max_concurrent_vehicles);
+        }
+    }
+    fclose(f);
+}
@@ -0,0 +1,123 @@
+// src/simulation_check.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../include/data_structures.h"
+#include "../include/utils.h"
+#include "../include/simulation.h"
+#include "../include/routing.h"
+#include "../include/simulation_check.h"
+
+static int checkCounts(int);
+
+/**
+ * Checks the vehicle model keeps its counts of the vehicles on each road and at each junction in step with the active
+ * vehicles. A full pool of vehicles is moved along their routes, with the clock wound forward so that they arrive,
+ * crash and take new roads, until the rest are made to run out of fuel. The counts are checked after every step and
+ * must all be back to zero at the end. Returns non-zero if they are not
+ **/
+int main(int argc, char *argv[])
+{
+    char *map = argc > 1 ? argv[1] : SIMULATION_CHECK_DEFAULT_MAP;
+    routingDefaults();
+    random_stream.key = randomKey(1, 0, 0);
+    random_stream.counter = 0;
+    loadRoadMap(map);
+    routingInit(map);
+    vehicles = (struct VehicleStruct *)malloc(sizeof(struct VehicleStruct) * MAX_VEHICLES);
+    for (int i = 0; i < MAX_VEHICLES; i++)
+    {
+        vehicles[i].active = 0;
+        vehicles[i].roadOn = NULL;
+        vehicles[i].currentJunction = NULL;
+        vehicles[i].maxSpeed = 0;
+    }
+    initVehicles(MAX_VEHICLES);
+
+    int failures = 0;
+    for (int step = 0; step < SIMULATION_CHECK_STEPS && failures == 0; step++)
+    {
+        for (int i = 0; i < MAX_VEHICLES; i++)
+        {
+            if (vehicles[i].active)
+            {
+                // A second has passed for every vehicle on a road, which is far enough to reach its end
+                vehicles[i].last_distance_check_secs = getCurrentSeconds() - 1;
+                vehicles[i].start_t = getCurrentSeconds();
+                if (vehicles[i].roadOn != NULL && vehicles[i].currentJunction == NULL)
+                {
+                    vehicles[i].remaining_distance = 0;
+                }
+                handleVehicleUpdate(i);
+            }
+        }
+        failures += checkCounts(step);
+    }
+
+    // Whatever is still running runs out of fuel
+    for (int i = 0; i < MAX_VEHICLES; i++)
+    {
+        if (vehicles[i].active)
+        {
+            vehicles[i].start_t = 0;
+            handleVehicleUpdate(i);
+        }
+    }
+    failures += checkCounts(SIMULATION_CHECK_STEPS);
+    for (int i = 0; i < MAX_VEHICLES; i++)
+    {
+        if (vehicles[i].active)
+        {
+            fprintf(stderr, "FAIL: vehicle %d is still active after running out of fuel\n", i);
+            failures++;
+        }
+    }
+    printf("%s: %d vehicles, %d passengers delivered, %d crashed vehicles, %d vehicles exhausted fuel\n",
+           failures == 0 ? "PASS" : "FAIL", MAX_VEHICLES, passengers_delivered, vehicles_crashed, vehicles_exhausted_fuel);
+
+    free(vehicles);
+    routingFinalise();
+    freeRoadMap();
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * Compares the count on every road and junction with the active vehicles on it, returning how many differ
+ **/
+static int checkCounts(int step)
+{
+    int *on_road = (int *)calloc(num_roads, sizeof(int));
+    int *at_junction = (int *)calloc(num_junctions, sizeof(int));
+    for (int i = 0; i < MAX_VEHICLES; i++)
+    {
+        if (!vehicles[i].active)
+            continue;
+        if (vehicles[i].roadOn != NULL)
+            on_road[vehicles[i].roadOn->id]++;
+        if (vehicles[i].currentJunction != NULL)
+            at_junction[vehicles[i].currentJunction->id]++;
+    }
+    int failures = 0;
+    for (int i = 0; i < num_junctions; i++)
+    {
+        if (roadMap[i].num_vehicles != at_junction[i])
+        {
+            fprintf(stderr, "FAIL: step %d junction %d counts %d vehicles but has %d\n", step, i, roadMap[i].num_vehicles,
+                    at_junction[i]);
+            failures++;
+        }
+        for (int j = 0; j < roadMap[i].num_roads; j++)
+        {
+            struct RoadStruct *road = &roadMap[i].roads[j];
+            if (road->numVehiclesOnRoad != on_road[road->id])
+            {
+                fprintf(stderr, "FAIL: step %d road %d counts %d vehicles but has %d\n", step, road->id,
+                        road->numVehiclesOnRoad, on_road[road->id]);
+                failures++;
+            }
+        }
+    }
+    free(on_road);
+    free(at_junction);
+    return failures;
+}
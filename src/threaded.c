@@ -0,0 +1,349 @@
+// src/threaded.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "mpi.h"
+
+#include "../include/instrument.h"
+#include "../include/options.h"
+#include "../include/data_structures.h"
+#include "../include/utils.h"
+#include "../include/simulation.h"
+#include "../include/routing.h"
+#include "../include/threaded.h"
+#include "../include/live_metrics.h"
+
+// The threaded engine runs the vehicle actors as threads of this one process, with control and roadjunction taking
+// turns on the main thread (control only waits while roadjunction works). Each thread loads a road map of its own, as
+// each actor does, and only the read-only routing preprocessing is shared. They hand each other the tick's command,
+// occupancy, speeds and results through memory, with a barrier between each step in place of the messages the actors
+// otherwise send. Control here has no elastic scaling or load balancing, so the vehicle threads keep the vehicles
+// they start with and create
+
+static struct ThreadedEngine engine;
+
+static void threadedControl();
+static void *threadedVehicle(void *);
+static void splitThreadedVehicles(int, int *);
+static double threadClock();
+
+/**
+ * Starts the vehicle threads, runs control and roadjunction on this thread until the run is over and then waits for
+ * the vehicle threads to finish. Their routing counters are added to this thread's so they are reported as usual
+ **/
+void threadedRun(int num_vehicle_threads)
+{
+    engine.num_vehicle_threads = num_vehicle_threads;
+    engine.stop = 0;
+    pthread_barrier_init(&engine.command_ready, NULL, num_vehicle_threads + 1);
+    pthread_barrier_init(&engine.occupancy_ready, NULL, num_vehicle_threads + 1);
+    pthread_barrier_init(&engine.speeds_ready, NULL, num_vehicle_threads + 1);
+    pthread_barrier_init(&engine.results_ready, NULL, num_vehicle_threads + 1);
+    // Roadjunction's road map, which sets the size of the occupancy and speeds. The landmarks or contraction
+    // hierarchy are worked out once here and shared with the vehicle threads, rather than by each of them
+    loadRoadMap(map_filename);
+    routingInit(map_filename);
+    routingShare();
+    engine.occupancy = (int *)malloc(sizeof(int) * num_roads * num_vehicle_threads);
+    engine.published = (int *)malloc(sizeof(int) * (num_roads + num_junctions));
+
+    pthread_t vehicle_threads[THREADED_MAX_VEHICLE_THREADS];
+    int thread_ids[THREADED_MAX_VEHICLE_THREADS];
+    for (int t = 0; t < num_vehicle_threads; t++)
+    {
+        thread_ids[t] = t;
+        pthread_create(&vehicle_threads[t], NULL, threadedVehicle, &thread_ids[t]);
+    }
+
+    instrumentSetActor(CONTROL_ACTOR);
+    random_stream.key = randomKey(run_options.seed, CONTROL_RANK, 1);
+    random_stream.counter = 0;
+    threadedControl();
+
+    for (int t = 0; t < num_vehicle_threads; t++)
+    {
+        pthread_join(vehicle_threads[t], NULL);
+        struct RoutingCounters *counters = &engine.routing[t];
+        routing_counters.queries += counters->queries;
+        routing_counters.settled += counters->settled;
+        routing_counters.fallback_queries += counters->fallback_queries;
+        routing_counters.tree_builds += counters->tree_builds;
+        routing_counters.tree_evictions += counters->tree_evictions;
+        routing_counters.tree_repairs += counters->tree_repairs;
+        routing_counters.tree_rebuilds += counters->tree_rebuilds;
+    }
+    pthread_barrier_destroy(&engine.command_ready);
+    pthread_barrier_destroy(&engine.occupancy_ready);
+    pthread_barrier_destroy(&engine.speeds_ready);
+    pthread_barrier_destroy(&engine.results_ready);
+    free(engine.occupancy);
+    free(engine.published);
+    routingFinalise();
+    freeRoadMap();
+}
+
+/**
+ * Control as in the actor version, without the elastic vehicle actors, load balancing and checkpoints: each tick it
+ * hands out the command, does roadjunction's update once the vehicle threads have reported their occupancy and then
+ * adds up their results
+ **/
+static void threadedControl()
+{
+    time_t seconds = 0;
+    time_t start_seconds = getCurrentSeconds();
+    int elapsed_mins = 0;
+
+    printf("Random seed is: %llu\n", run_options.seed);
+    printf("Threaded engine with %d vehicle threads\n", engine.num_vehicle_threads);
+    if (run_options.live_metrics_name != NULL)
+    {
+        liveMetricsOpen(run_options.live_metrics_name, run_options.seed, 0);
+    }
+    total_vehicles += run_options.initial_vehicles;
+
+    int loads[THREADED_MAX_VEHICLE_THREADS] = {0}, update_usecs[THREADED_MAX_VEHICLE_THREADS] = {0};
+    int round = 0, publications = 0, last_publication = 0, early_publications = 0, drift = 0;
+    double total_time = 0.0, start_time, startup_time = 0.0;
+    while (elapsed_mins < run_options.max_mins)
+    {
+        start_time = MPI_Wtime();
+        if (round == 0)
+        {
+            startup_time = start_time - program_start_time;
+        }
+        instrumentBegin(INSTR_CONTROL_TICK);
+
+        int minute_passed = 0;
+        memset(engine.new_vehicles, 0, sizeof(engine.new_vehicles));
+        time_t current_seconds = getCurrentSeconds();
+        if (current_seconds != seconds)
+        {
+            seconds = current_seconds;
+            if (seconds - start_seconds > 0 && (seconds - start_seconds) % MIN_LENGTH_SECONDS == 0)
+            {
+                elapsed_mins++;
+                minute_passed = 1;
+                splitThreadedVehicles(getRandomInteger(100, 200), loads);
+            }
+        }
+
+        // The speeds are published as the actors' roadjunction would, the first tick being when the threads start
+        engine.publish = round == 0 || round - last_publication >= run_options.sync_every;
+        if (!engine.publish && run_options.sync_drift > 0 && drift >= run_options.sync_drift)
+        {
+            engine.publish = 1;
+            early_publications++;
+        }
+        if (engine.publish)
+        {
+            publications++;
+            last_publication = round;
+        }
+
+        pthread_barrier_wait(&engine.command_ready);
+        if (engine.publish)
+        {
+            instrumentBegin(INSTR_CONTROL_WAIT);
+            pthread_barrier_wait(&engine.occupancy_ready);
+            instrumentEnd(INSTR_CONTROL_WAIT);
+            instrumentBegin(INSTR_JUNCTION_UPDATE);
+            updateJunctions(elapsed_mins, engine.occupancy, engine.num_vehicle_threads, engine.published);
+            instrumentEnd(INSTR_JUNCTION_UPDATE);
+            pthread_barrier_wait(&engine.speeds_ready);
+        }
+        instrumentBegin(INSTR_CONTROL_WAIT);
+        pthread_barrier_wait(&engine.results_ready);
+        instrumentEnd(INSTR_CONTROL_WAIT);
+
+        drift = 0;
+        for (int t = 0; t < engine.num_vehicle_threads; t++)
+        {
+            int *data = engine.results[t];
+            vehicles_exhausted_fuel += data[RES_EXHAUSTED_FUEL];
+            passengers_stranded += data[RES_PASSENGERS_STRANDED];
+            vehicles_crashed += data[RES_VEHICLES_CRASHED];
+            passengers_delivered += data[RES_PASSENGERS_DELIVERED];
+            total_vehicles += data[RES_VEHICLES_CREATED];
+            loads[t] = data[RES_ACTIVE_VEHICLES];
+            update_usecs[t] = data[RES_UPDATE_USECS];
+            drift += data[RES_OCCUPANCY_DRIFT];
+        }
+
+        if (minute_passed && elapsed_mins % SUMMARY_FREQUENCY == 0)
+        {
+            printf("[Time: %d mins] %d vehicles, %d passengers delivered, %d stranded passengers, %d crashed vehicles, %d vehicles exhausted fuel\n",
+                   elapsed_mins, total_vehicles, passengers_delivered, passengers_stranded, vehicles_crashed, vehicles_exhausted_fuel);
+        }
+
+        instrumentEnd(INSTR_CONTROL_TICK);
+        double tick_time = MPI_Wtime() - start_time;
+        total_time += tick_time;
+        round++;
+        // The vehicle threads stand in for the vehicle actors, with their thread number for a rank
+        struct LiveMetrics *metrics = liveMetricsBegin();
+        if (metrics != NULL)
+        {
+            metrics->elapsed_mins = elapsed_mins;
+            metrics->ticks = round;
+            metrics->total_vehicles = total_vehicles;
+            metrics->passengers_delivered = passengers_delivered;
+            metrics->passengers_stranded = passengers_stranded;
+            metrics->vehicles_crashed = vehicles_crashed;
+            metrics->vehicles_exhausted_fuel = vehicles_exhausted_fuel;
+            metrics->num_actors = engine.num_vehicle_threads;
+            for (int t = 0; t < engine.num_vehicle_threads; t++)
+            {
+                metrics->actors[t].rank = t;
+                metrics->actors[t].vehicles = loads[t];
+                metrics->actors[t].update_usecs = update_usecs[t];
+            }
+            liveMetricsEnd(metrics, tick_time);
+        }
+        if (round % 50 == 0)
+        {
+            printf("After %d loops, average time per loop is: %f seconds\n", round, total_time / round);
+        }
+    }
+    // The threads see the stop as soon as they are past the barrier and finish
+    engine.stop = 1;
+    pthread_barrier_wait(&engine.command_ready);
+    liveMetricsClose();
+
+    printf("Finished after %d mins: %d vehicles, %d passengers delivered, %d passengers stranded, %d crashed vehicles, %d vehicles exhausted fuel\n",
+           elapsed_mins, total_vehicles, passengers_delivered, passengers_stranded, vehicles_crashed, vehicles_exhausted_fuel);
+    printf("Total time for %d loops is: %f seconds\n", round, total_time);
+    printf("Average time per loop is: %f seconds\n", total_time / round);
+    printf("Startup time is: %f seconds\n", startup_time);
+    if (run_options.sync_every > 1 || run_options.sync_drift > 0)
+    {
+        printf("[Sync] Road speeds published on %d of %d ticks (every %d ticks, %d brought forward by drift), %.1f ticks per second\n",
+               publications, round, run_options.sync_every, early_publications, round / total_time);
+    }
+}
+
+/**
+ * Gives each new vehicle to the vehicle thread that will have the fewest, as control does for the vehicle actors
+ **/
+static void splitThreadedVehicles(int total_new_vehicles, int *loads)
+{
+    for (int n = 0; n < total_new_vehicles; n++)
+    {
+        int lightest = 0;
+        for (int t = 1; t < engine.num_vehicle_threads; t++)
+        {
+            if (loads[t] + engine.new_vehicles[t] < loads[lightest] + engine.new_vehicles[lightest])
+            {
+                lightest = t;
+            }
+        }
+        engine.new_vehicles[lightest]++;
+    }
+}
+
+/**
+ * A vehicle actor, which creates its share of the initial vehicles and then each tick creates the vehicles control
+ * asked for, reports its occupancy, takes the new speeds and updates its vehicles
+ **/
+static void *threadedVehicle(void *arg)
+{
+    int t = *(int *)arg, n = engine.num_vehicle_threads;
+    random_stream.key = randomKey(run_options.seed, ROADJUNCTION_RANK + 1 + t, 1);
+    random_stream.counter = 0;
+    loadRoadMap(map_filename);
+    routingInit(map_filename);
+    vehicles = (struct VehicleStruct *)malloc(sizeof(struct VehicleStruct) * MAX_VEHICLES);
+    for (int i = 0; i < MAX_VEHICLES; i++)
+    {
+        vehicles[i].active = 0;
+        vehicles[i].roadOn = NULL;
+        vehicles[i].currentJunction = NULL;
+        vehicles[i].maxSpeed = 0;
+    }
+    initVehicles(run_options.initial_vehicles / n + (t == n - 1 ? run_options.initial_vehicles % n : 0));
+    int *changed_roads = (int *)malloc(sizeof(int) * (num_roads + 1));
+    int *published_occupancy = (int *)calloc(num_roads, sizeof(int));
+
+    while (1)
+    {
+        pthread_barrier_wait(&engine.command_ready);
+        if (engine.stop)
+        {
+            break;
+        }
+        int count = 0;
+        for (int i = 0; i < engine.new_vehicles[t]; i++)
+        {
+            if (activateVehicle(activateRandomVehicle()) != -1)
+            {
+                count++;
+            }
+        }
+
+        int *occupancy = &engine.occupancy[t * num_roads], drift = 0;
+        if (engine.publish)
+        {
+            readOccupancy(occupancy, NULL);
+            pthread_barrier_wait(&engine.occupancy_ready);
+            pthread_barrier_wait(&engine.speeds_ready);
+            int num_changed = applyPublishedSpeeds(engine.published, changed_roads);
+            if (num_changed > 0)
+            {
+                routingSpeedsChanged(changed_roads, num_changed);
+            }
+            memcpy(published_occupancy, occupancy, sizeof(int) * num_roads);
+        }
+        else if (run_options.sync_drift > 0)
+        {
+            // Roadjunction is not reading this thread's occupancy this tick, so it can be overwritten
+            drift = readOccupancy(occupancy, published_occupancy);
+        }
+
+        int active_vehicles = 0;
+        double update_start = threadClock();
+        for (int i = 0; i < MAX_VEHICLES; i++)
+        {
+            if (vehicles[i].active)
+            {
+                handleVehicleUpdate(i);
+                active_vehicles += vehicles[i].active;
+            }
+        }
+        double update_time = threadClock() - update_start;
+
+        int *data = engine.results[t];
+        data[RES_EXHAUSTED_FUEL] = vehicles_exhausted_fuel;
+        data[RES_PASSENGERS_STRANDED] = passengers_stranded;
+        data[RES_VEHICLES_CRASHED] = vehicles_crashed;
+        data[RES_PASSENGERS_DELIVERED] = passengers_delivered;
+        data[RES_VEHICLES_CREATED] = count;
+        data[RES_ACTIVE_VEHICLES] = active_vehicles;
+        data[RES_UPDATE_USECS] = (int)(update_time * 1e6);
+        data[RES_OCCUPANCY_DRIFT] = drift;
+        vehicles_exhausted_fuel = 0;
+        passengers_stranded = 0;
+        vehicles_crashed = 0;
+        passengers_delivered = 0;
+        pthread_barrier_wait(&engine.results_ready);
+    }
+
+    engine.routing[t] = routing_counters;
+    instrumentMergeThread();
+    free(changed_roads);
+    free(published_occupancy);
+    free(vehicles);
+    routingFinalise();
+    freeRoadMap();
+    return NULL;
+}
+
+/**
+ * Seconds from an arbitrary point, for the vehicle threads which must not call MPI
+ **/
+static double threadClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -35,9 +35,44 @@
 }
 
 
+/**
+ * Returns a random integer from `from` up to but not including `to`, drawn from this actor's stream
+ **/
  int getRandomInteger(int from, int to)
 {
-    return (rand() % (to - from)) + from;
+    return randomInteger(&random_stream, from, to);
+}
+
+/**
+ * The splitmix64 finaliser, a bijection on 64 bit integers that mixes every input bit into every output bit
+ **/
+static unsigned long long mixBits(unsigned long long z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Derives the key of a stream from the seed and two identifiers, such as a rank and how many actors it has run
+ **/
+ unsigned long long randomKey(unsigned long long seed, unsigned long long a, unsigned long long b)
+{
+    return mixBits(mixBits(mixBits(seed + 0x9E3779B97F4A7C15ULL) ^ a) ^ b);
+}
+
+/**
+ * The next number of a counter-based stream, the counter is hashed and combined with the key before being hashed
+ * again, so streams with different keys are independent and no state is shared between them
+ **/
+ unsigned long long randomNext(struct RandomStream *stream)
+{
+    return mixBits(mixBits(++stream->counter) ^ stream->key);
+}
+
+ int randomInteger(struct RandomStream *stream, int from, int to)
+{
+    return (int)(randomNext(stream) % (unsigned long long)(to - from)) + from;
 }
 
  time_t getCurrentSeconds()